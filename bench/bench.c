@@ -0,0 +1,151 @@
+#include "bench.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+FILE *bench_output;
+char bench_directory[] = "/tmp/sisopper-bench-XXXXXX";
+
+int compare_long(const void *, const void *);
+int remove_directory(char *);
+
+/// Sends the logs of the code under test to /dev/null, keeping the original stdout for the results
+///
+/// @param name Printed before the results
+void bench_init(char *name)
+{
+    bench_output = fdopen(dup(STDOUT_FILENO), "w");
+    setvbuf(bench_output, NULL, _IOLBF, 0);
+
+    if (!freopen("/dev/null", "w", stdout))
+        bench_output = stderr;
+
+    bench_report("# %s\n", name);
+}
+
+/// Prints a line of the results
+void bench_report(char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(bench_output, fmt, args);
+    va_end(args);
+}
+
+/// @returns Microseconds since `start`, from CLOCK_MONOTONIC
+long bench_elapsed_usec(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start->tv_sec) * 1000000L + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+/// Prints the median, p99 and maximum of `samples`, which are sorted in place
+void bench_report_percentiles(char *label, long *samples, size_t length)
+{
+    if (length == 0)
+        return;
+
+    qsort(samples, length, sizeof(long), &compare_long);
+    bench_report("%-40s p50 %8ld  p99 %8ld  max %8ld\n", label, samples[length / 2], samples[length * 99 / 100], samples[length - 1]);
+}
+
+/// Moves into a new directory under /tmp, so that files written by the code under test don't
+/// get mixed with the ones of a server running from the current directory
+void bench_enter_temporary_directory(void)
+{
+    if (!mkdtemp(bench_directory) || chdir(bench_directory) < 0)
+    {
+        fprintf(stderr, "When creating a temporary directory: %d\n", errno);
+        exit(1);
+    }
+    bench_report("Working in %s\n", bench_directory);
+}
+
+/// Removes the directory of `bench_enter_temporary_directory`, with everything in it
+void bench_leave_temporary_directory(void)
+{
+    if (chdir("/tmp") < 0 || remove_directory(bench_directory) < 0)
+        fprintf(stderr, "When removing %s: %d\n", bench_directory, errno);
+}
+
+/// Listens on a free port of the loopback
+///
+/// @param port Where the chosen port is written
+///
+/// @returns The listening socket
+int bench_listen(int *port)
+{
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0), true = 1;
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &true, sizeof(true));
+
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = 0, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t length = sizeof(address);
+    if (bind(sockfd, (struct sockaddr *)&address, length) < 0 || listen(sockfd, 4096) < 0 ||
+        getsockname(sockfd, (struct sockaddr *)&address, &length) < 0)
+    {
+        fprintf(stderr, "When listening: %d\n", errno);
+        exit(1);
+    }
+
+    *port = ntohs(address.sin_port);
+    return sockfd;
+}
+
+/// Connects to a port of the loopback
+///
+/// @returns The connected socket, or -1 on error
+int bench_connect(int port)
+{
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0), true = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &true, sizeof(true));
+
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    if (connect(sockfd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+        close(sockfd);
+        return -1;
+    }
+
+    return sockfd;
+}
+
+int compare_long(const void *first, const void *second)
+{
+    long first_value = *(const long *)first, second_value = *(const long *)second;
+
+    return first_value < second_value ? -1 : first_value > second_value;
+}
+
+// Removes a directory with its files, and the directories in it
+int remove_directory(char *path)
+{
+    char entry_path[PATH_MAX];
+    DIR *directory = opendir(path);
+    for (struct dirent *entry; directory && (entry = readdir(directory));)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        snprintf(entry_path, sizeof(entry_path), "%s/%s", path, entry->d_name);
+        if (entry->d_type == DT_DIR)
+            remove_directory(entry_path);
+        else
+            unlink(entry_path);
+    }
+    if (directory)
+        closedir(directory);
+
+    return rmdir(path);
+}
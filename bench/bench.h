@@ -0,0 +1,20 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+
+// Helpers shared by the benchmarks in this directory. Each one is a standalone binary built by
+// `make bench`, which compares what we have now against a small copy of what it replaced.
+// Logs of the code under test go to /dev/null, and only the results are printed
+void bench_init(char *name);
+void bench_report(char *fmt, ...);
+long bench_elapsed_usec(struct timespec *start);
+void bench_report_percentiles(char *label, long *samples, size_t length);
+void bench_enter_temporary_directory(void);
+void bench_leave_temporary_directory(void);
+int bench_listen(int *port);
+int bench_connect(int port);
+
+#endif // BENCH_H
@@ -0,0 +1,169 @@
+#include "bench.h"
+
+#include "config.h"
+#include "event_loop.h"
+#include "notification.h"
+#include "protocol.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define BENCH_CLIENT_THREADS 8
+#define BENCH_SECONDS 2
+#define BENCH_MAX_SAMPLES (1 << 20) // Latencies kept by each client thread
+
+// Connections per second of the event loops, against a thread for every accepted connection like the
+// server had before. Each client connects, sends a LOGIN, waits for the answer and closes, which is
+// what keepalives, elections and ring hops look like
+
+typedef struct client_thread
+{
+    pthread_t tid;
+    int port;
+    atomic_int *stop;
+    long connections;
+    long failures;
+    long *samples; // Microseconds from connecting until the answer arrives
+} CLIENT_THREAD;
+
+void *client_run(void *);
+int handle_connection(CONNECTION *, NOTIFICATION *);
+void *thread_per_connection_accept(void *);
+void *thread_per_connection_handle(void *);
+void run_clients(char *, int);
+
+int main(int argc, char *argv[])
+{
+    bench_init("Connections per second, with a LOGIN answered on each one");
+
+    int loops_port, threads_port;
+    int loops_sockfd = bench_listen(&loops_port);
+    int threads_sockfd = bench_listen(&threads_port);
+
+    for (int loop_idx = 0; loop_idx < SERVER_EVENT_LOOP_THREADS; loop_idx++)
+        event_loop_start(event_loop_create(loops_sockfd, &handle_connection));
+
+    pthread_t accept_tid;
+    pthread_create(&accept_tid, NULL, &thread_per_connection_accept, (void *)(long)threads_sockfd);
+
+    run_clients("thread per connection", threads_port);
+    run_clients("event loops", loops_port);
+
+    return 0;
+}
+
+// Runs the clients against a port for BENCH_SECONDS, and reports what they did
+void run_clients(char *label, int port)
+{
+    atomic_int stop = 0;
+    CLIENT_THREAD clients[BENCH_CLIENT_THREADS];
+
+    for (int client_idx = 0; client_idx < BENCH_CLIENT_THREADS; client_idx++)
+    {
+        clients[client_idx] = (CLIENT_THREAD){.port = port, .stop = &stop, .samples = (long *)malloc(BENCH_MAX_SAMPLES * sizeof(long))};
+        pthread_create(&clients[client_idx].tid, NULL, &client_run, (void *)&clients[client_idx]);
+    }
+
+    sleep(BENCH_SECONDS);
+    atomic_store(&stop, 1);
+
+    long connections = 0, failures = 0;
+    long *samples = (long *)malloc(BENCH_CLIENT_THREADS * BENCH_MAX_SAMPLES * sizeof(long));
+    size_t samples_length = 0;
+    for (int client_idx = 0; client_idx < BENCH_CLIENT_THREADS; client_idx++)
+    {
+        CLIENT_THREAD *client = &clients[client_idx];
+        pthread_join(client->tid, NULL);
+
+        long kept = client->connections < BENCH_MAX_SAMPLES ? client->connections : BENCH_MAX_SAMPLES;
+        memcpy(samples + samples_length, client->samples, kept * sizeof(long));
+        samples_length += kept;
+        connections += client->connections;
+        failures += client->failures;
+        free(client->samples);
+    }
+
+    bench_report("%-22s %9.0f connections/s (%ld failed)\n", label, (double)connections / BENCH_SECONDS, failures);
+    bench_report_percentiles("  latency of each login (us)", samples, samples_length);
+    free(samples);
+
+    // Lets the sockets closed by the last connections go away before the next run
+    sleep(1);
+}
+
+void *client_run(void *void_client)
+{
+    CLIENT_THREAD *client = (CLIENT_THREAD *)void_client;
+
+    NOTIFICATION login = {.type = NOTIFICATION_TYPE__LOGIN, .command = LOGIN};
+    strcpy(login.author, "@bench");
+
+    while (!atomic_load(client->stop))
+    {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        NOTIFICATION answer;
+        int sockfd = bench_connect(client->port);
+        if (sockfd < 0 || protocol_write(sockfd, &login) < 0 || protocol_read(sockfd, &answer) <= 0)
+            client->failures++;
+        else
+        {
+            if (client->connections < BENCH_MAX_SAMPLES)
+                client->samples[client->connections] = bench_elapsed_usec(&start);
+            client->connections++;
+        }
+
+        if (sockfd >= 0)
+            close(sockfd);
+    }
+
+    return NULL;
+}
+
+// Answers with the same frame and closes, so the server side keeps the TIME_WAIT and clients don't run out of ports
+int handle_connection(CONNECTION *connection, NOTIFICATION *notification)
+{
+    if (!notification)
+        return 0;
+
+    uint8_t frame[PROTOCOL_MAX_FRAME_SIZE];
+    size_t length = protocol_encode(notification, frame);
+    event_loop_write(connection, frame, length);
+
+    return 0;
+}
+
+void *thread_per_connection_accept(void *void_sockfd)
+{
+    int listen_sockfd = (int)(long)void_sockfd;
+
+    while (1)
+    {
+        int sockfd = accept(listen_sockfd, NULL, NULL);
+        if (sockfd < 0)
+            continue;
+
+        pthread_t tid;
+        pthread_create(&tid, NULL, &thread_per_connection_handle, (void *)(long)sockfd);
+        pthread_detach(tid);
+    }
+
+    return NULL;
+}
+
+void *thread_per_connection_handle(void *void_sockfd)
+{
+    int sockfd = (int)(long)void_sockfd;
+
+    NOTIFICATION notification;
+    if (protocol_read(sockfd, &notification) > 0)
+        protocol_write(sockfd, &notification);
+    close(sockfd);
+
+    return NULL;
+}
@@ -0,0 +1,81 @@
+#include "bench.h"
+
+#include "deque.h"
+
+#include <stdlib.h>
+
+// Appends to a queue of pending messages as it grows, and pops until it is empty again. The DEQUE is
+// compared against the list it replaced, which walked to its end on every append and called malloc
+// and free for every node
+
+typedef struct chained_list
+{
+    void *val;
+    struct chained_list *next;
+} CHAINED_LIST;
+
+CHAINED_LIST *chained_list_append_end(CHAINED_LIST *, void *);
+void run_size(int);
+
+int main(int argc, char *argv[])
+{
+    bench_init("Pending messages queue, appends as it grows and pops until it is empty");
+
+    int sizes[] = {100, 1000, 10000, 30000};
+    for (int size_idx = 0; size_idx < 4; size_idx++)
+        run_size(sizes[size_idx]);
+
+    return 0;
+}
+
+// Grows both queues to `size` values and drains them, twice, so that the second round of the DEQUE
+// takes its nodes from the pool of the thread
+void run_size(int size)
+{
+    struct timespec start;
+    long list_usec = 0, deque_usec = 0;
+
+    for (int round = 0; round < 2; round++)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        CHAINED_LIST *list = NULL;
+        for (long value = 1; value <= size; value++)
+            list = chained_list_append_end(list, (void *)value);
+        while (list)
+        {
+            CHAINED_LIST *next = list->next;
+            free(list);
+            list = next;
+        }
+        list_usec += bench_elapsed_usec(&start);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        DEQUE deque;
+        deque_init(&deque);
+        for (long value = 1; value <= size; value++)
+            deque_push_back(&deque, (void *)value);
+        while (deque_pop_front(&deque))
+            ;
+        deque_usec += bench_elapsed_usec(&start);
+    }
+
+    bench_report("%5d values   list %10.1f ns per value   DEQUE %10.1f ns per value\n",
+                 size, list_usec * 1e3 / (2.0 * size), deque_usec * 1e3 / (2.0 * size));
+}
+
+CHAINED_LIST *chained_list_append_end(CHAINED_LIST *list, void *val)
+{
+    CHAINED_LIST *new_list = (CHAINED_LIST *)malloc(sizeof(CHAINED_LIST));
+    new_list->next = NULL;
+    new_list->val = val;
+
+    if (!list)
+        return new_list;
+
+    CHAINED_LIST *end_list = list;
+    while (end_list->next)
+        end_list = end_list->next;
+    end_list->next = new_list;
+
+    return list;
+}
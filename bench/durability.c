@@ -0,0 +1,94 @@
+#include "bench.h"
+
+#include "config.h"
+#include "user_directory.h"
+#include "wal.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define BENCH_USERS 1000
+#define BENCH_FOLLOWS 200000
+#define BENCH_SYNCED_FOLLOWS 200 // Each one waits for the disk, so there are fewer of them
+
+// Follows with and without the WAL. With it, follows are only appended to a buffer, and the flusher
+// thread writes and syncs them in groups, so the cost is the record and the contention with the
+// flusher. Waiting for the sync on every follow is also shown, as that is what group commit avoids
+
+USER *users[BENCH_USERS];
+
+long run_follows(int, int, int);
+int follow(USER *, USER *, int);
+
+int main(int argc, char *argv[])
+{
+    bench_init("Follows with durability off and on");
+    bench_enter_temporary_directory();
+    bench_report("WAL_FSYNC is %d, and groups are committed every %d us\n", WAL_FSYNC, WAL_GROUP_COMMIT_USEC);
+
+    USER_DIRECTORY *directory = user_directory_create();
+    for (int user_idx = 0; user_idx < BENCH_USERS; user_idx++)
+    {
+        char username[MAX_USERNAME_LENGTH + 1];
+        sprintf(username, "@user%d", user_idx);
+        users[user_idx] = user_directory_intern(directory, username, USER_ID_NONE, NULL);
+    }
+
+    long usec = run_follows(BENCH_FOLLOWS, 0, 0);
+    bench_report("no WAL                   %12.0f follows/s\n", BENCH_FOLLOWS * 1e6 / (usec + 1));
+
+    wal_open(0);
+
+    usec = run_follows(BENCH_FOLLOWS, 1, 0);
+    bench_report("WAL with group commit    %12.0f follows/s (until the last one is synced)\n", BENCH_FOLLOWS * 1e6 / (usec + 1));
+
+    usec = run_follows(BENCH_SYNCED_FOLLOWS, 1, 1);
+    bench_report("WAL synced every follow  %12.0f follows/s\n", BENCH_SYNCED_FOLLOWS * 1e6 / (usec + 1));
+    bench_report("WAL is %lu bytes\n", (unsigned long)wal_length());
+
+    bench_leave_temporary_directory();
+    return 0;
+}
+
+// Follows random pairs of users `follows` times, and returns how long it took in microseconds
+long run_follows(int follows, int logged, int synced)
+{
+    unsigned int seed = 1;
+    struct timespec start;
+
+    for (int user_idx = 0; user_idx < BENCH_USERS; user_idx++)
+    {
+        id_set_free(&users[user_idx]->followers);
+        id_set_init(&users[user_idx]->followers);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int follow_idx = 0; follow_idx < follows; follow_idx++)
+    {
+        USER *user = users[rand_r(&seed) % BENCH_USERS];
+        USER *follower = users[rand_r(&seed) % BENCH_USERS];
+
+        if (follow(user, follower, logged) && synced)
+            wal_sync();
+    }
+
+    if (logged)
+        wal_sync();
+
+    return bench_elapsed_usec(&start);
+}
+
+// Like the server, adds the follower under the locks of the user and logs it if it is new
+int follow(USER *user, USER *follower, int logged)
+{
+    pthread_mutex_lock(&user->followers_mutex);
+    pthread_mutex_lock(&user->mutex);
+    int followed = id_set_add(&user->followers, follower->id);
+    if (followed && logged)
+        wal_log_follow(user, follower);
+    pthread_mutex_unlock(&user->mutex);
+    pthread_mutex_unlock(&user->followers_mutex);
+
+    return followed;
+}
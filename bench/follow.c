@@ -0,0 +1,111 @@
+#include "bench.h"
+
+#include "config.h"
+#include "id_set.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_REPEATED_FOLLOWS 10000 // Follows of someone who already follows, done at the end
+
+// Follows of a single user, as its followers grow. The ID_SET is compared against the list of
+// usernames it replaced, where every follow was a strcmp scan for a repeated follower followed by
+// a walk to the end of the list
+
+typedef struct chained_list
+{
+    void *val;
+    struct chained_list *next;
+} CHAINED_LIST;
+
+void *chained_list_find(CHAINED_LIST *, char *);
+CHAINED_LIST *chained_list_append_end(CHAINED_LIST *, void *);
+void run_followers(int);
+
+int main(int argc, char *argv[])
+{
+    bench_init("Follows of a single user, as its followers grow");
+
+    int followers[] = {1000, 10000, 30000};
+    for (int followers_idx = 0; followers_idx < 3; followers_idx++)
+        run_followers(followers[followers_idx]);
+
+    return 0;
+}
+
+// Follows a user `followers` times, and then repeats some of those follows, which must all be refused
+void run_followers(int followers)
+{
+    char (*usernames)[MAX_USERNAME_LENGTH + 1] = malloc(followers * sizeof(*usernames));
+    for (int follower_idx = 0; follower_idx < followers; follower_idx++)
+        sprintf(usernames[follower_idx], "@user%d", follower_idx);
+
+    struct timespec start;
+    long list_refused = 0, set_refused = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHAINED_LIST *list = NULL;
+    for (int follower_idx = 0; follower_idx < followers; follower_idx++)
+        if (!chained_list_find(list, usernames[follower_idx]))
+            list = chained_list_append_end(list, strdup(usernames[follower_idx]));
+    long list_usec = bench_elapsed_usec(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int follow_idx = 0; follow_idx < BENCH_REPEATED_FOLLOWS; follow_idx++)
+        list_refused += chained_list_find(list, usernames[follow_idx * 7919L % followers]) != NULL;
+    long list_repeated_usec = bench_elapsed_usec(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ID_SET set;
+    id_set_init(&set);
+    for (int follower_idx = 0; follower_idx < followers; follower_idx++)
+        if (!id_set_contains(&set, follower_idx + 1))
+            id_set_add(&set, follower_idx + 1);
+    long set_usec = bench_elapsed_usec(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int follow_idx = 0; follow_idx < BENCH_REPEATED_FOLLOWS; follow_idx++)
+        set_refused += id_set_contains(&set, follow_idx * 7919L % followers + 1);
+    long set_repeated_usec = bench_elapsed_usec(&start);
+
+    bench_report("%d followers\n", followers);
+    bench_report("  list of usernames  %12.0f follows/s %12.0f repeated follows/s (%ld refused)\n",
+                 followers * 1e6 / (list_usec + 1), BENCH_REPEATED_FOLLOWS * 1e6 / (list_repeated_usec + 1), list_refused);
+    bench_report("  ID_SET             %12.0f follows/s %12.0f repeated follows/s (%ld refused)\n",
+                 followers * 1e6 / (set_usec + 1), BENCH_REPEATED_FOLLOWS * 1e6 / (set_repeated_usec + 1), set_refused);
+
+    for (CHAINED_LIST *next; list; list = next)
+    {
+        next = list->next;
+        free(list->val);
+        free(list);
+    }
+    id_set_free(&set);
+    free(usernames);
+}
+
+void *chained_list_find(CHAINED_LIST *list, char *username)
+{
+    for (; list; list = list->next)
+        if (strcmp(username, (char *)list->val) == 0)
+            return list->val;
+
+    return NULL;
+}
+
+CHAINED_LIST *chained_list_append_end(CHAINED_LIST *list, void *val)
+{
+    CHAINED_LIST *new_list = (CHAINED_LIST *)malloc(sizeof(CHAINED_LIST));
+    new_list->next = NULL;
+    new_list->val = val;
+
+    if (!list)
+        return new_list;
+
+    CHAINED_LIST *end_list = list;
+    while (end_list->next)
+        end_list = end_list->next;
+    end_list->next = new_list;
+
+    return list;
+}
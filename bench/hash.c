@@ -0,0 +1,216 @@
+#include "bench.h"
+
+#include "hash.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_SEQUENTIAL_HANDLES 50000
+#define BENCH_ANAGRAM_LETTERS "abcdefgh" // Every permutation is a handle, 8! of them
+#define BENCH_OLD_HASH_SIZE 1999
+
+// Distribution and lookup latency of the user table. The HASH_TABLE is compared against the
+// chained table of 1999 lists it replaced, whose hash multiplies the characters modulo the size.
+// Handles are either numbered or made of the same letters, which a weak hash groups together
+
+typedef struct old_hash_node
+{
+    char *key;
+    void *value;
+    struct old_hash_node *next;
+} OLD_HASH_NODE;
+
+int old_hash_address(char *);
+OLD_HASH_NODE *old_hash_find(OLD_HASH_NODE **, char *, int *);
+void old_hash_insert(OLD_HASH_NODE **, char *);
+int groups_probed(HASH_TABLE, char *);
+long elapsed_nsec(struct timespec *);
+void permute(char *, int, char **, int *);
+void run_keys(char *, char **, int);
+
+// Keeps the compiler from dropping lookups whose result isn't used
+void *volatile lookup_sink;
+
+int main(int argc, char *argv[])
+{
+    bench_init("User table, chained with a multiplicative hash against the HASH_TABLE");
+
+    char **keys = (char **)malloc(BENCH_SEQUENTIAL_HANDLES * sizeof(char *));
+    for (int key_idx = 0; key_idx < BENCH_SEQUENTIAL_HANDLES; key_idx++)
+    {
+        keys[key_idx] = (char *)malloc(HASH_KEY_SIZE);
+        sprintf(keys[key_idx], "@user%d", key_idx);
+    }
+    run_keys("sequential handles", keys, BENCH_SEQUENTIAL_HANDLES);
+
+    char letters[] = BENCH_ANAGRAM_LETTERS;
+    int anagrams_length = 1;
+    for (int letter_idx = 2; letter_idx <= (int)strlen(letters); letter_idx++)
+        anagrams_length *= letter_idx;
+
+    char **anagrams = (char **)malloc(anagrams_length * sizeof(char *));
+    int anagrams_idx = 0;
+    permute(letters, 0, anagrams, &anagrams_idx);
+    run_keys("anagram handles", anagrams, anagrams_length);
+
+    return 0;
+}
+
+// Builds both tables with `keys`, and reports how far lookups have to walk and how long they take
+void run_keys(char *label, char **keys, int length)
+{
+    bench_report("%s, %d of them\n", label, length);
+
+    OLD_HASH_NODE **old_table = (OLD_HASH_NODE **)calloc(BENCH_OLD_HASH_SIZE, sizeof(OLD_HASH_NODE *));
+    HASH_TABLE table = hash_init();
+    for (int key_idx = 0; key_idx < length; key_idx++)
+    {
+        old_hash_insert(old_table, keys[key_idx]);
+        hash_insert(table, keys[key_idx], keys[key_idx]);
+    }
+
+    int used_lists = 0;
+    for (int list_idx = 0; list_idx < BENCH_OLD_HASH_SIZE; list_idx++)
+        used_lists += old_table[list_idx] != NULL;
+    bench_report("  chained table uses %d of its %d lists\n", used_lists, BENCH_OLD_HASH_SIZE);
+
+    long *samples = (long *)malloc(length * sizeof(long));
+    for (int key_idx = 0; key_idx < length; key_idx++)
+    {
+        int compared;
+        old_hash_find(old_table, keys[key_idx], &compared);
+        samples[key_idx] = compared;
+    }
+    bench_report_percentiles("  chained nodes compared by a lookup", samples, length);
+
+    int probed_length = 0;
+    for (int key_idx = 0; key_idx < length; key_idx++)
+    {
+        int probed = groups_probed(table, keys[key_idx]);
+        if (probed > 0)
+            samples[probed_length++] = probed;
+    }
+    bench_report_percentiles("  HASH_TABLE groups probed by a lookup", samples, probed_length);
+
+    // Looked up in a random order, as users log in and are followed
+    char **lookups = (char **)malloc(length * sizeof(char *));
+    memcpy(lookups, keys, length * sizeof(char *));
+    srand(1);
+    for (int key_idx = length - 1; key_idx > 0; key_idx--)
+    {
+        int swap_idx = rand() % (key_idx + 1);
+        char *swap = lookups[key_idx];
+        lookups[key_idx] = lookups[swap_idx];
+        lookups[swap_idx] = swap;
+    }
+
+    struct timespec start;
+    for (int key_idx = 0; key_idx < length; key_idx++)
+    {
+        int compared;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        lookup_sink = old_hash_find(old_table, lookups[key_idx], &compared);
+        samples[key_idx] = elapsed_nsec(&start);
+    }
+    bench_report_percentiles("  chained lookup (ns)", samples, length);
+
+    for (int key_idx = 0; key_idx < length; key_idx++)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        lookup_sink = hash_find(table, lookups[key_idx]);
+        samples[key_idx] = elapsed_nsec(&start);
+    }
+    bench_report_percentiles("  HASH_TABLE lookup (ns)", samples, length);
+
+    free(lookups);
+    free(samples);
+    hash_free(table);
+}
+
+// The hash of the old table, unchanged
+int old_hash_address(char *key)
+{
+    int address = 1;
+
+    for (int key_idx = 0; key_idx < (int)strlen(key); key_idx++)
+        address = (address * key[key_idx]) % BENCH_OLD_HASH_SIZE + 1;
+
+    return address - 1;
+}
+
+OLD_HASH_NODE *old_hash_find(OLD_HASH_NODE **table, char *key, int *compared)
+{
+    *compared = 0;
+
+    for (OLD_HASH_NODE *node = table[old_hash_address(key)]; node; node = node->next)
+    {
+        (*compared)++;
+        if (strcmp(key, node->key) == 0)
+            return node;
+    }
+
+    return NULL;
+}
+
+void old_hash_insert(OLD_HASH_NODE **table, char *key)
+{
+    int compared;
+    if (old_hash_find(table, key, &compared))
+        return;
+
+    OLD_HASH_NODE *node = (OLD_HASH_NODE *)calloc(1, sizeof(OLD_HASH_NODE));
+    node->key = strdup(key);
+    node->value = key;
+
+    int address = old_hash_address(key);
+    node->next = table[address];
+    table[address] = node;
+}
+
+// Groups a lookup checks in the current array of the table, following the same probe sequence
+// as hash_find. Returns 0 for keys still in the previous array, while the table is resizing
+int groups_probed(HASH_TABLE table, char *key)
+{
+    HASH_BUCKETS *buckets = atomic_load(&table->buckets);
+    HASH_NODE *node = hash_find(table, key);
+    uint64_t group_idx = (node->hash >> 7) & (buckets->groups - 1);
+
+    for (uint64_t probe = 1; probe <= buckets->groups; group_idx = (group_idx + probe++) & (buckets->groups - 1))
+        for (int slot_idx = 0; slot_idx < HASH_GROUP_SIZE; slot_idx++)
+            if (&buckets->slots[group_idx * HASH_GROUP_SIZE + slot_idx] == node)
+                return (int)probe;
+
+    return 0;
+}
+
+long elapsed_nsec(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start->tv_sec) * 1000000000L + (now.tv_nsec - start->tv_nsec);
+}
+
+// Writes "@" followed by every permutation of `letters[from..]`
+void permute(char *letters, int from, char **handles, int *handles_idx)
+{
+    int length = (int)strlen(letters);
+    if (from == length)
+    {
+        handles[*handles_idx] = (char *)malloc(HASH_KEY_SIZE);
+        sprintf(handles[(*handles_idx)++], "@%s", letters);
+        return;
+    }
+
+    for (int letter_idx = from; letter_idx < length; letter_idx++)
+    {
+        char swap = letters[from];
+        letters[from] = letters[letter_idx];
+        letters[letter_idx] = swap;
+
+        permute(letters, from + 1, handles, handles_idx);
+
+        letters[letter_idx] = letters[from];
+        letters[from] = swap;
+    }
+}
@@ -0,0 +1,298 @@
+#include "bench.h"
+
+#include "config.h"
+#include "mpsc_queue.h"
+#include "notification_pool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BENCH_LOOPS 4           // Threads allocating, like the event loops
+#define BENCH_DEFAULT_SECONDS 10 // How long the soak runs, unless given as the first argument
+#define BENCH_WARMUP_ROUNDS 2   // Rounds after which the pool shouldn't need new slabs
+#define BENCH_ITEMS 50000       // Notifications allocated by each loop on every round
+
+// Soak test of the notification pool, with the ownership the server has: event loop threads allocate
+// copies of the frames, and the replication sender frees them once they are sent, so most frees
+// happen on a thread other than the one that allocated. The sender also answers each frame with a
+// notification the loop frees, like acknowledgements, so memory flows both ways.
+//
+// It runs rounds for BENCH_DEFAULT_SECONDS, or for the seconds given in the command line, so
+// `bin/bench_notification_pool 86400` soaks for a day. Every notification is stamped and checked
+// when freed, so one handed out twice is caught, and no notification may be outstanding at the end
+// of a round. The pool may only have the slabs needed by the most notifications ever outstanding,
+// plus what the threads keep in their caches, and the resident memory may only grow by that after
+// the warm up. Once the threads exit, every notification must be back in the shared pool, as their
+// caches are given back. It exits with 1 if any check fails
+
+typedef struct loop
+{
+    pthread_t tid;
+    int idx;
+    MPSC_QUEUE *acknowledgements; // Filled by the sender, with the ID of every frame it freed
+    uint64_t next_acknowledgement;
+    uint64_t round_end_id; // ID after the last frame of the current round
+} LOOP;
+
+MPSC_QUEUE *sender_queue;
+LOOP loops[BENCH_LOOPS];
+pthread_barrier_t round_start, round_end;
+atomic_int running = 1; // Checked by every thread after the start of a round
+atomic_long outstanding = 0;
+atomic_long max_outstanding = 0;
+int failures = 0;
+
+NOTIFICATION *allocate(NOTIFICATION *);
+void release(NOTIFICATION *);
+void push(MPSC_QUEUE *, NOTIFICATION *, LOOP *);
+void drain_acknowledgements(LOOP *, int);
+void *loop_run(void *);
+void *sender_run(void *);
+long resident_bytes(void);
+
+int main(int argc, char *argv[])
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : BENCH_DEFAULT_SECONDS;
+    if (seconds <= 0)
+        seconds = BENCH_DEFAULT_SECONDS;
+
+    bench_init("Notification pool soak, frames freed by the thread which sends them");
+    bench_report("%d loops, rounds of %d notifications each for %d s\n", BENCH_LOOPS, BENCH_ITEMS, seconds);
+
+    sender_queue = mpsc_queue_create(REPLICATION_QUEUE_SIZE);
+    pthread_barrier_init(&round_start, NULL, BENCH_LOOPS + 2);
+    pthread_barrier_init(&round_end, NULL, BENCH_LOOPS + 2);
+
+    pthread_t sender_tid;
+    pthread_create(&sender_tid, NULL, &sender_run, NULL);
+    for (int loop_idx = 0; loop_idx < BENCH_LOOPS; loop_idx++)
+    {
+        loops[loop_idx] = (LOOP){.idx = loop_idx, .acknowledgements = mpsc_queue_create(REPLICATION_QUEUE_SIZE)};
+        pthread_create(&loops[loop_idx].tid, NULL, &loop_run, (void *)&loops[loop_idx]);
+    }
+
+    long warm_bytes = 0, last_bytes = 0;
+    size_t warm_slabs = 0;
+    int rounds = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (1)
+    {
+        if (rounds >= BENCH_WARMUP_ROUNDS && bench_elapsed_usec(&start) >= seconds * 1000000L)
+            atomic_store(&running, 0);
+
+        pthread_barrier_wait(&round_start);
+        if (!atomic_load(&running))
+            break;
+        pthread_barrier_wait(&round_end);
+
+        if (atomic_load(&outstanding) != 0)
+        {
+            bench_report("FAILED: %ld notifications outstanding after round %d\n", atomic_load(&outstanding), rounds);
+            failures++;
+        }
+
+        last_bytes = resident_bytes();
+        if (++rounds == BENCH_WARMUP_ROUNDS)
+        {
+            warm_bytes = last_bytes;
+            warm_slabs = notification_pool_slabs();
+        }
+    }
+    long elapsed_usec = bench_elapsed_usec(&start);
+
+    pthread_join(sender_tid, NULL);
+    for (int loop_idx = 0; loop_idx < BENCH_LOOPS; loop_idx++)
+        pthread_join(loops[loop_idx].tid, NULL);
+
+    // A slab is only allocated when the cache of the thread and the shared pool are empty, so every
+    // other free notification is in the cache of another thread, which keeps at most two batches
+    size_t slabs = notification_pool_slabs();
+    size_t shared = notification_pool_shared();
+    size_t allowed_slabs = (atomic_load(&max_outstanding) + BENCH_LOOPS * 2 * NOTIFICATION_POOL_BATCH_SIZE) / NOTIFICATION_POOL_SLAB_SIZE + 1;
+    long allowed_bytes = (BENCH_LOOPS + 1) * (long)NOTIFICATION_POOL_SLAB_SIZE * sizeof(NOTIFICATION);
+
+    bench_report("%12.0f notifications/s in %d rounds, at most %ld outstanding\n",
+                 2.0 * BENCH_LOOPS * BENCH_ITEMS * rounds * 1e6 / elapsed_usec, rounds, atomic_load(&max_outstanding));
+    bench_report("slabs after warm up %8zu, at the end %8zu (up to %zu allowed)\n", warm_slabs, slabs, allowed_slabs);
+    bench_report("notifications back in the shared pool %8zu of %zu\n", shared, slabs * NOTIFICATION_POOL_SLAB_SIZE);
+    bench_report("resident after warm up %8ld KiB, at the end %8ld KiB (up to %ld KiB more allowed)\n",
+                 warm_bytes / 1024, last_bytes / 1024, allowed_bytes / 1024);
+
+    if (slabs > allowed_slabs)
+    {
+        bench_report("FAILED: the pool has %zu slabs, when %zu are enough\n", slabs, allowed_slabs);
+        failures++;
+    }
+
+    // Every thread exited, so their caches were given back too
+    if (shared != slabs * NOTIFICATION_POOL_SLAB_SIZE)
+    {
+        bench_report("FAILED: %zu notifications were lost with the caches of the threads\n", slabs * NOTIFICATION_POOL_SLAB_SIZE - shared);
+        failures++;
+    }
+
+    if (last_bytes - warm_bytes > allowed_bytes)
+    {
+        bench_report("FAILED: resident memory grew by %ld KiB after the warm up\n", (last_bytes - warm_bytes) / 1024);
+        failures++;
+    }
+
+    if (failures)
+        return 1;
+
+    bench_report("ok\n");
+    return 0;
+}
+
+// Allocates every loop's frames for a round, half of them copied like replication_link_send does,
+// and frees the acknowledgements the sender returns
+void *loop_run(void *void_loop)
+{
+    LOOP *loop = (LOOP *)void_loop;
+    uint64_t next_id = 0;
+
+    NOTIFICATION frame = {.type = NOTIFICATION_TYPE__REPLICATION, .command = SEND};
+    sprintf(frame.author, "@loop%d", loop->idx);
+
+    for (int round = 0;; round++)
+    {
+        pthread_barrier_wait(&round_start);
+        if (!atomic_load(&running))
+            break;
+        loop->round_end_id = next_id + BENCH_ITEMS;
+
+        for (int item_idx = 0; item_idx < BENCH_ITEMS; item_idx++)
+        {
+            NOTIFICATION *notification;
+            if (item_idx % 2)
+            {
+                frame.id = next_id++;
+                frame.data = round;
+                notification = allocate(&frame);
+            }
+            else
+            {
+                notification = allocate(NULL);
+                memcpy(notification->author, frame.author, sizeof(frame.author));
+                notification->id = next_id++;
+                notification->data = round;
+            }
+
+            push(sender_queue, notification, loop);
+            drain_acknowledgements(loop, 0);
+        }
+
+        drain_acknowledgements(loop, 1);
+        pthread_barrier_wait(&round_end);
+    }
+
+    return NULL;
+}
+
+// Frees the frames in the order each loop sent them, and answers each one
+void *sender_run(void *_)
+{
+    uint64_t next_ids[BENCH_LOOPS] = {0};
+
+    for (int round = 0;; round++)
+    {
+        pthread_barrier_wait(&round_start);
+        if (!atomic_load(&running))
+            break;
+
+        for (long item_idx = 0; item_idx < (long)BENCH_LOOPS * BENCH_ITEMS; item_idx++)
+        {
+            NOTIFICATION *notification = (NOTIFICATION *)mpsc_queue_pop(sender_queue);
+
+            int loop_idx = -1;
+            if (sscanf(notification->author, "@loop%d", &loop_idx) != 1 || loop_idx < 0 || loop_idx >= BENCH_LOOPS ||
+                notification->id != next_ids[loop_idx] || notification->data != round)
+            {
+                bench_report("FAILED: frame of %s with ID %lu in round %d was changed while allocated\n",
+                             notification->author, (unsigned long)notification->id, notification->data);
+                exit(1);
+            }
+            next_ids[loop_idx]++;
+            release(notification);
+
+            NOTIFICATION *acknowledgement = allocate(NULL);
+            acknowledgement->type = NOTIFICATION_TYPE__REPLICATION_ACK;
+            acknowledgement->id = next_ids[loop_idx] - 1;
+            push(loops[loop_idx].acknowledgements, acknowledgement, NULL);
+        }
+
+        pthread_barrier_wait(&round_end);
+    }
+
+    return NULL;
+}
+
+// Frees the acknowledgements received, and with `all` waits until every frame of the round was answered
+void drain_acknowledgements(LOOP *loop, int all)
+{
+    while (loop->next_acknowledgement < loop->round_end_id)
+    {
+        NOTIFICATION *acknowledgement = (NOTIFICATION *)(all ? mpsc_queue_pop(loop->acknowledgements) : mpsc_queue_try_pop(loop->acknowledgements));
+        if (!acknowledgement)
+            return;
+
+        if (acknowledgement->type != NOTIFICATION_TYPE__REPLICATION_ACK || acknowledgement->id != loop->next_acknowledgement)
+        {
+            bench_report("FAILED: acknowledgement %lu of @loop%d was changed while allocated\n", (unsigned long)loop->next_acknowledgement, loop->idx);
+            exit(1);
+        }
+        loop->next_acknowledgement++;
+        release(acknowledgement);
+    }
+}
+
+// Like the FE, waits for the consumer when the queue is full. Loops keep freeing what they receive
+// meanwhile, otherwise they and the sender could be waiting on each other
+void push(MPSC_QUEUE *queue, NOTIFICATION *notification, LOOP *loop)
+{
+    while (mpsc_queue_push(queue, (void *)notification) < 0)
+    {
+        if (loop)
+            drain_acknowledgements(loop, 0);
+        usleep(100);
+    }
+}
+
+// Allocates a notification, or a copy of `original` if it isn't NULL, and counts it as outstanding.
+// The count goes up before and down after the pool is used, so it is never below the real one
+NOTIFICATION *allocate(NOTIFICATION *original)
+{
+    long now = atomic_fetch_add(&outstanding, 1) + 1;
+    for (long max = atomic_load(&max_outstanding); now > max && !atomic_compare_exchange_weak(&max_outstanding, &max, now);)
+        ;
+
+    return original ? notification_pool_duplicate(original) : notification_pool_alloc();
+}
+
+void release(NOTIFICATION *notification)
+{
+    // Overwritten, so that if it is still used somewhere the check of its stamp fails
+    memset(notification->author, '?', sizeof(notification->author) - 1);
+    notification->id = -1;
+
+    notification_pool_free(notification);
+    atomic_fetch_sub(&outstanding, 1);
+}
+
+// From /proc/self/statm, whose second field is the resident pages
+long resident_bytes(void)
+{
+    FILE *statm = fopen("/proc/self/statm", "r");
+    long size = 0, resident = 0;
+
+    if (!statm || fscanf(statm, "%ld %ld", &size, &resident) != 2)
+        resident = 0;
+    if (statm)
+        fclose(statm);
+
+    return resident * sysconf(_SC_PAGESIZE);
+}
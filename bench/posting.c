@@ -0,0 +1,259 @@
+#include "bench.h"
+
+#include "config.h"
+#include "frame_batch.h"
+#include "front_end.h"
+#include "inbox.h"
+#include "message.h"
+#include "protocol.h"
+#include "user_directory.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define BENCH_MAX_POSTERS 16
+#define BENCH_FOLLOWERS 100   // Followers of every poster, the same ones for all of them
+#define BENCH_OFFLINE_EVERY 10 // One in this many followers is offline, and gets the posts in its inbox
+#define BENCH_POSTS 40000     // Posts of each run, split between its posters
+
+// Posts of many authors at once, fanned out to the same followers. The per-user locks of
+// receive_message are compared against the global MUTEX_FOLLOW held for the whole fan-out, and
+// the MUTEX_PENDING_NOTIFICATIONS taken for every offline delivery, like the server had before.
+// Online followers get their frames through FRAME_BATCHes, to sockets drained by a thread for
+// every FE, and offline ones get a reference in their inbox, which may spill to disk
+
+typedef struct poster
+{
+    pthread_t tid;
+    USER *author;
+    int posts;
+    long *samples; // Microseconds each post took to fan out
+} POSTER;
+
+USER_DIRECTORY *user_directory;
+USER *followers[BENCH_FOLLOWERS];
+
+int FE_SOCKFDS[NUMBER_OF_FES];
+pthread_mutex_t MUTEX_FE_SOCKFDS[NUMBER_OF_FES];
+
+pthread_mutex_t MUTEX_FOLLOW = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t MUTEX_PENDING_NOTIFICATIONS = PTHREAD_MUTEX_INITIALIZER;
+
+#define LOCK(mutex) pthread_mutex_lock(&mutex)
+#define UNLOCK(mutex) pthread_mutex_unlock(&mutex)
+
+void run_posters(char *, void (*)(USER *, MESSAGE *, FRAME_BATCH *), int);
+void *poster_run(void *);
+void *fe_drain(void *);
+void post(USER *, int);
+void fan_out_per_user(USER *, MESSAGE *, FRAME_BATCH *);
+void fan_out_global(USER *, MESSAGE *, FRAME_BATCH *);
+void deliver(MESSAGE *, USER *, FRAME_BATCH *, pthread_mutex_t *);
+
+void (*fan_out)(USER *, MESSAGE *, FRAME_BATCH *); // Of the current run
+
+int main(int argc, char *argv[])
+{
+    bench_init("Posting, many authors fanning out to the same followers");
+    bench_enter_temporary_directory();
+    inbox_open_directory(0);
+    bench_report("%ld CPUs online, %d followers of every poster, 1 in %d of them offline\n",
+                 sysconf(_SC_NPROCESSORS_ONLN), BENCH_FOLLOWERS, BENCH_OFFLINE_EVERY);
+
+    for (int fe_idx = 0; fe_idx < NUMBER_OF_FES; fe_idx++)
+    {
+        int sockfds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockfds) < 0)
+        {
+            bench_report("FAILED: couldn't create the socket of FE %d\n", fe_idx);
+            return 1;
+        }
+
+        FE_SOCKFDS[fe_idx] = sockfds[0];
+        pthread_mutex_init(&MUTEX_FE_SOCKFDS[fe_idx], NULL);
+
+        pthread_t tid;
+        pthread_create(&tid, NULL, &fe_drain, (void *)(long)sockfds[1]);
+    }
+
+    user_directory = user_directory_create();
+    for (int follower_idx = 0; follower_idx < BENCH_FOLLOWERS; follower_idx++)
+    {
+        char username[MAX_USERNAME_LENGTH + 1];
+        sprintf(username, "@follower%d", follower_idx);
+        followers[follower_idx] = user_directory_intern(user_directory, username, USER_ID_NONE, NULL);
+        followers[follower_idx]->sessions_number = follower_idx % BENCH_OFFLINE_EVERY != 0;
+    }
+
+    int posters[] = {1, 4, 16};
+    for (int posters_idx = 0; posters_idx < 3; posters_idx++)
+    {
+        run_posters("global locks", &fan_out_global, posters[posters_idx]);
+        run_posters("per user locks", &fan_out_per_user, posters[posters_idx]);
+    }
+
+    bench_leave_temporary_directory();
+    return 0;
+}
+
+// Splits BENCH_POSTS between `posters` threads, each posting as its own author, and reports how
+// long it took. The inboxes are emptied afterwards, so every run starts from the same state
+void run_posters(char *label, void (*function)(USER *, MESSAGE *, FRAME_BATCH *), int posters)
+{
+    fan_out = function;
+    POSTER threads[BENCH_MAX_POSTERS];
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int poster_idx = 0; poster_idx < posters; poster_idx++)
+    {
+        char username[MAX_USERNAME_LENGTH + 1];
+        sprintf(username, "@poster%d", poster_idx);
+
+        POSTER *poster = &threads[poster_idx];
+        *poster = (POSTER){.author = user_directory_intern(user_directory, username, USER_ID_NONE, NULL), .posts = BENCH_POSTS / posters};
+        poster->samples = (long *)malloc(poster->posts * sizeof(long));
+        for (int follower_idx = 0; follower_idx < BENCH_FOLLOWERS; follower_idx++)
+            id_set_add(&poster->author->followers, followers[follower_idx]->id);
+
+        pthread_create(&poster->tid, NULL, &poster_run, (void *)poster);
+    }
+
+    long *samples = (long *)malloc(BENCH_POSTS * sizeof(long));
+    size_t samples_length = 0;
+    for (int poster_idx = 0; poster_idx < posters; poster_idx++)
+    {
+        pthread_join(threads[poster_idx].tid, NULL);
+        memcpy(samples + samples_length, threads[poster_idx].samples, threads[poster_idx].posts * sizeof(long));
+        samples_length += threads[poster_idx].posts;
+        free(threads[poster_idx].samples);
+    }
+    long usec = bench_elapsed_usec(&start);
+
+    bench_report("%-16s %2d posters %10.0f posts/s\n", label, posters, samples_length * 1e6 / (usec + 1));
+    bench_report_percentiles("  fan-out of each post (us)", samples, samples_length);
+    free(samples);
+
+    for (int follower_idx = 0; follower_idx < BENCH_FOLLOWERS; follower_idx += BENCH_OFFLINE_EVERY)
+    {
+        LOCK(followers[follower_idx]->mutex);
+        inbox_clear(followers[follower_idx]);
+        UNLOCK(followers[follower_idx]->mutex);
+    }
+}
+
+void *poster_run(void *void_poster)
+{
+    POSTER *poster = (POSTER *)void_poster;
+
+    for (int post_idx = 0; post_idx < poster->posts; post_idx++)
+    {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        post(poster->author, post_idx);
+        poster->samples[post_idx] = bench_elapsed_usec(&start);
+    }
+
+    return NULL;
+}
+
+// Reads and drops every frame written to an FE
+void *fe_drain(void *void_sockfd)
+{
+    int sockfd = (int)(long)void_sockfd;
+    uint8_t buffer[65536];
+
+    while (read(sockfd, buffer, sizeof(buffer)) > 0)
+        ;
+
+    return NULL;
+}
+
+// Like receive_message, creates the message, encodes it once, and fans it out with the function of the run
+void post(USER *author, int post_idx)
+{
+    NOTIFICATION notification = {.id = post_idx, .timestamp = time(NULL), .type = NOTIFICATION_TYPE__MESSAGE};
+    strcpy(notification.author, author->username);
+    strcpy(notification.receiver, author->username);
+    sprintf(notification.message, "Post %d of %s", post_idx, author->username);
+
+    MESSAGE *message = message_create(&notification);
+
+    uint8_t fields[PROTOCOL_MAX_FRAME_SIZE];
+    uint32_t mask;
+    size_t fields_length = protocol_encode_fields(&notification, fields, &mask);
+
+    FRAME_BATCH batches[NUMBER_OF_FES];
+    for (int fe_idx = 0; fe_idx < NUMBER_OF_FES; fe_idx++)
+        frame_batch_init(&batches[fe_idx], FE_SOCKFDS[fe_idx], &MUTEX_FE_SOCKFDS[fe_idx], notification.type, mask, fields, fields_length);
+
+    fan_out(author, message, batches);
+
+    // The server keeps this reference in the author's timeline
+    message_release(message);
+}
+
+// The locks of receive_message: the author's fan_out_mutex, its followers copied under followers_mutex,
+// and the mutex of each follower only while choosing between its FE and its inbox
+void fan_out_per_user(USER *author, MESSAGE *message, FRAME_BATCH *batches)
+{
+    LOCK(author->fan_out_mutex);
+
+    LOCK(author->followers_mutex);
+    uint32_t *follower_ids = (uint32_t *)malloc((author->followers.count + 1) * sizeof(uint32_t));
+    int followers = 0;
+    for (uint32_t follower_idx = 0; follower_idx < author->followers.length; follower_idx++)
+        if (author->followers.ids[follower_idx] != ID_SET_EMPTY)
+            follower_ids[followers++] = author->followers.ids[follower_idx];
+    UNLOCK(author->followers_mutex);
+
+    for (int follower_idx = 0; follower_idx < followers; follower_idx++)
+        deliver(message, user_directory_get(user_directory, follower_ids[follower_idx]), batches, NULL);
+
+    for (int fe_idx = 0; fe_idx < NUMBER_OF_FES; fe_idx++)
+        frame_batch_flush(&batches[fe_idx]);
+    UNLOCK(author->fan_out_mutex);
+
+    free(follower_ids);
+}
+
+// The locks the server had before: MUTEX_FOLLOW for the whole fan-out, and MUTEX_PENDING_NOTIFICATIONS
+// for every message added to an inbox, which was also spilled under them
+void fan_out_global(USER *author, MESSAGE *message, FRAME_BATCH *batches)
+{
+    LOCK(MUTEX_FOLLOW);
+    for (uint32_t follower_idx = 0; follower_idx < author->followers.length; follower_idx++)
+        if (author->followers.ids[follower_idx] != ID_SET_EMPTY)
+            deliver(message, user_directory_get(user_directory, author->followers.ids[follower_idx]), batches, &MUTEX_PENDING_NOTIFICATIONS);
+
+    for (int fe_idx = 0; fe_idx < NUMBER_OF_FES; fe_idx++)
+        frame_batch_flush(&batches[fe_idx]);
+    UNLOCK(MUTEX_FOLLOW);
+}
+
+// Like fan_out_message, adds the frame of an online follower to the batch of its FE, or a reference
+// to the message to the inbox of an offline one, spilling it if it has too many. Only the choice is
+// made under the follower's mutex, and `inbox_mutex`, if it isn't NULL, is held until the spill ends
+void deliver(MESSAGE *message, USER *user, FRAME_BATCH *batches, pthread_mutex_t *inbox_mutex)
+{
+    if (inbox_mutex)
+        pthread_mutex_lock(inbox_mutex);
+    LOCK(user->mutex);
+
+    int online = user->sessions_number > 0, spill = 0;
+    if (!online)
+        spill = inbox_push(user, message_retain(message));
+
+    UNLOCK(user->mutex);
+
+    if (spill)
+        inbox_spill(user);
+    if (inbox_mutex)
+        pthread_mutex_unlock(inbox_mutex);
+
+    if (online)
+        frame_batch_add(&batches[user->address % NUMBER_OF_FES], user->username);
+}
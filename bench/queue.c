@@ -0,0 +1,253 @@
+#include "bench.h"
+
+#include "config.h"
+#include "mpsc_queue.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define BENCH_PRODUCERS 4
+#define BENCH_BURST_ITEMS 10000   // Pushed by each producer as fast as it can
+#define BENCH_PACED_ITEMS 20000   // Pushed by each producer, one every BENCH_PACED_USEC
+#define BENCH_PACED_USEC 20
+#define BENCH_IDLE_SECONDS 1
+
+// Throughput, latency and idle cost of the FE message queue, which is fed by the client connections
+// and drained by the thread sending to the server. The MPSC queue is compared against the list it
+// replaced, which was appended by walking to its end and polled under its mutex with usleep(5)
+
+typedef struct item
+{
+    struct timespec pushed;
+} ITEM;
+
+typedef struct queue_kind
+{
+    char *label;
+    void (*push)(void *);
+    void *(*pop)(void);
+} QUEUE_KIND;
+
+typedef struct producer
+{
+    pthread_t tid;
+    QUEUE_KIND *kind;
+    ITEM *items;
+    int length;
+    int pace_usec;
+} PRODUCER;
+
+typedef struct consumer
+{
+    pthread_t tid;
+    QUEUE_KIND *kind;
+    long expected;
+    long *samples; // Microseconds each item waited in the queue
+} CONSUMER;
+
+// The list of the old FE
+typedef struct chained_list
+{
+    void *val;
+    struct chained_list *next;
+} CHAINED_LIST;
+
+CHAINED_LIST *chained_list_messages = NULL;
+pthread_mutex_t MUTEX_MESSAGE_QUEUE = PTHREAD_MUTEX_INITIALIZER;
+MPSC_QUEUE *message_queue;
+
+void chained_list_push(void *);
+void *chained_list_pop(void);
+void mpsc_push(void *);
+void *mpsc_pop(void);
+void *producer_run(void *);
+void *consumer_run(void *);
+void run_burst(QUEUE_KIND *);
+void run_paced(QUEUE_KIND *);
+void run_idle(QUEUE_KIND *);
+
+int main(int argc, char *argv[])
+{
+    bench_init("FE message queue, with several producers and a single consumer");
+    bench_report("%d producers\n", BENCH_PRODUCERS);
+
+    message_queue = mpsc_queue_create(FE_MESSAGE_QUEUE_SIZE);
+
+    QUEUE_KIND kinds[] = {
+        {.label = "list polled under a mutex", .push = &chained_list_push, .pop = &chained_list_pop},
+        {.label = "MPSC queue", .push = &mpsc_push, .pop = &mpsc_pop},
+    };
+
+    for (int kind_idx = 0; kind_idx < 2; kind_idx++)
+    {
+        bench_report("%s\n", kinds[kind_idx].label);
+        run_burst(&kinds[kind_idx]);
+        run_paced(&kinds[kind_idx]);
+        run_idle(&kinds[kind_idx]);
+    }
+
+    return 0;
+}
+
+// Every producer pushes at once, so the queue gets long
+void run_burst(QUEUE_KIND *kind)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    CONSUMER consumer = {.kind = kind, .expected = (long)BENCH_PRODUCERS * BENCH_BURST_ITEMS};
+    consumer.samples = (long *)malloc(consumer.expected * sizeof(long));
+    pthread_create(&consumer.tid, NULL, &consumer_run, (void *)&consumer);
+
+    PRODUCER producers[BENCH_PRODUCERS];
+    for (int producer_idx = 0; producer_idx < BENCH_PRODUCERS; producer_idx++)
+    {
+        producers[producer_idx] = (PRODUCER){.kind = kind, .length = BENCH_BURST_ITEMS, .pace_usec = 0};
+        producers[producer_idx].items = (ITEM *)malloc(BENCH_BURST_ITEMS * sizeof(ITEM));
+        pthread_create(&producers[producer_idx].tid, NULL, &producer_run, (void *)&producers[producer_idx]);
+    }
+
+    for (int producer_idx = 0; producer_idx < BENCH_PRODUCERS; producer_idx++)
+        pthread_join(producers[producer_idx].tid, NULL);
+    pthread_join(consumer.tid, NULL);
+
+    long elapsed_usec = bench_elapsed_usec(&start);
+    bench_report("  burst of %ld items                   %12.0f items/s\n", consumer.expected, consumer.expected * 1e6 / elapsed_usec);
+    bench_report_percentiles("  burst wait in the queue (us)", consumer.samples, consumer.expected);
+
+    for (int producer_idx = 0; producer_idx < BENCH_PRODUCERS; producer_idx++)
+        free(producers[producer_idx].items);
+    free(consumer.samples);
+}
+
+// Producers push at a steady rate, like clients do, so the wait is mostly how fast the consumer notices
+void run_paced(QUEUE_KIND *kind)
+{
+    CONSUMER consumer = {.kind = kind, .expected = (long)BENCH_PRODUCERS * BENCH_PACED_ITEMS};
+    consumer.samples = (long *)malloc(consumer.expected * sizeof(long));
+    pthread_create(&consumer.tid, NULL, &consumer_run, (void *)&consumer);
+
+    PRODUCER producers[BENCH_PRODUCERS];
+    for (int producer_idx = 0; producer_idx < BENCH_PRODUCERS; producer_idx++)
+    {
+        producers[producer_idx] = (PRODUCER){.kind = kind, .length = BENCH_PACED_ITEMS, .pace_usec = BENCH_PACED_USEC};
+        producers[producer_idx].items = (ITEM *)malloc(BENCH_PACED_ITEMS * sizeof(ITEM));
+        pthread_create(&producers[producer_idx].tid, NULL, &producer_run, (void *)&producers[producer_idx]);
+    }
+
+    for (int producer_idx = 0; producer_idx < BENCH_PRODUCERS; producer_idx++)
+        pthread_join(producers[producer_idx].tid, NULL);
+    pthread_join(consumer.tid, NULL);
+
+    bench_report_percentiles("  paced wait in the queue (us)", consumer.samples, consumer.expected);
+
+    for (int producer_idx = 0; producer_idx < BENCH_PRODUCERS; producer_idx++)
+        free(producers[producer_idx].items);
+    free(consumer.samples);
+}
+
+// CPU the consumer burns while nothing is pushed
+void run_idle(QUEUE_KIND *kind)
+{
+    ITEM item;
+    CONSUMER consumer = {.kind = kind, .expected = 1};
+    consumer.samples = (long *)malloc(sizeof(long));
+    pthread_create(&consumer.tid, NULL, &consumer_run, (void *)&consumer);
+
+    clockid_t clock;
+    struct timespec cpu;
+    pthread_getcpuclockid(consumer.tid, &clock);
+
+    sleep(BENCH_IDLE_SECONDS);
+    clock_gettime(clock, &cpu);
+
+    clock_gettime(CLOCK_MONOTONIC, &item.pushed);
+    kind->push((void *)&item);
+    pthread_join(consumer.tid, NULL);
+
+    double cpu_ms = cpu.tv_sec * 1e3 + cpu.tv_nsec / 1e6;
+    bench_report("  consumer CPU while idle              %9.1f ms in %d s\n", cpu_ms, BENCH_IDLE_SECONDS);
+    free(consumer.samples);
+}
+
+void *producer_run(void *void_producer)
+{
+    PRODUCER *producer = (PRODUCER *)void_producer;
+
+    for (int item_idx = 0; item_idx < producer->length; item_idx++)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &producer->items[item_idx].pushed);
+        producer->kind->push((void *)&producer->items[item_idx]);
+
+        if (producer->pace_usec)
+            usleep(producer->pace_usec);
+    }
+
+    return NULL;
+}
+
+void *consumer_run(void *void_consumer)
+{
+    CONSUMER *consumer = (CONSUMER *)void_consumer;
+
+    for (long item_idx = 0; item_idx < consumer->expected; item_idx++)
+    {
+        ITEM *item = (ITEM *)consumer->kind->pop();
+        consumer->samples[item_idx] = bench_elapsed_usec(&item->pushed);
+    }
+
+    return NULL;
+}
+
+void chained_list_push(void *val)
+{
+    CHAINED_LIST *node = (CHAINED_LIST *)malloc(sizeof(CHAINED_LIST));
+    node->val = val;
+    node->next = NULL;
+
+    pthread_mutex_lock(&MUTEX_MESSAGE_QUEUE);
+    if (!chained_list_messages)
+        chained_list_messages = node;
+    else
+    {
+        CHAINED_LIST *end = chained_list_messages;
+        while (end->next)
+            end = end->next;
+        end->next = node;
+    }
+    pthread_mutex_unlock(&MUTEX_MESSAGE_QUEUE);
+}
+
+void *chained_list_pop(void)
+{
+    while (1)
+    {
+        pthread_mutex_lock(&MUTEX_MESSAGE_QUEUE);
+        CHAINED_LIST *node = chained_list_messages;
+        if (node)
+            chained_list_messages = node->next;
+        pthread_mutex_unlock(&MUTEX_MESSAGE_QUEUE);
+
+        if (node)
+        {
+            void *val = node->val;
+            free(node);
+            return val;
+        }
+
+        usleep(5);
+    }
+}
+
+// Like the FE, waits for the consumer when the queue is full
+void mpsc_push(void *val)
+{
+    while (mpsc_queue_push(message_queue, val) < 0)
+        usleep(100);
+}
+
+void *mpsc_pop(void)
+{
+    return mpsc_queue_pop(message_queue);
+}
@@ -0,0 +1,198 @@
+#include "bench.h"
+
+#include "config.h"
+#include "savefile.h"
+#include "user_directory.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_USERS 20000
+#define BENCH_FOLLOWERS_PER_USER 50 // The text format can't have more than 80 in a line
+#define BENCH_TEXT_SAVEFILE_PATH ".savefile-text"
+#define BENCH_OLD_HASH_SIZE 1999
+
+// Startup time of a server, which is loading its savefile. The binary savefile is compared against
+// the text one it replaced, with a line of followers' usernames for every user, each of them strdup'd
+// and appended to the end of a list, in a chained table of 1999 lists
+
+typedef struct chained_list
+{
+    void *val;
+    struct chained_list *next;
+} CHAINED_LIST;
+
+typedef struct old_user
+{
+    char username[MAX_USERNAME_LENGTH];
+    CHAINED_LIST *followers;
+} OLD_USER;
+
+typedef struct old_hash_node
+{
+    char *key;
+    void *value;
+    struct old_hash_node *next;
+} OLD_HASH_NODE;
+
+void write_text_savefile(USER_DIRECTORY *);
+OLD_HASH_NODE **read_text_savefile(void);
+CHAINED_LIST *chained_list_append_end(CHAINED_LIST *, void *);
+int old_hash_address(char *);
+void old_hash_insert(OLD_HASH_NODE **, char *, void *);
+
+int main(int argc, char *argv[])
+{
+    bench_init("Startup, loading the users and follows of the savefile");
+    bench_enter_temporary_directory();
+    savefile_open(0);
+
+    USER_DIRECTORY *directory = user_directory_create();
+    for (int user_idx = 0; user_idx < BENCH_USERS; user_idx++)
+    {
+        char username[MAX_USERNAME_LENGTH + 1];
+        sprintf(username, "@user%d", user_idx);
+        user_directory_intern(directory, username, user_idx + 1, NULL);
+    }
+    for (int user_idx = 0; user_idx < BENCH_USERS; user_idx++)
+    {
+        USER *user = user_directory_get(directory, user_idx + 1);
+        for (int follower_idx = 1; follower_idx <= BENCH_FOLLOWERS_PER_USER; follower_idx++)
+            id_set_add(&user->followers, (user_idx + follower_idx * 7919) % BENCH_USERS + 1);
+    }
+
+    save_savefile(directory);
+    write_text_savefile(directory);
+    bench_report("%d users with %d followers each\n", BENCH_USERS, BENCH_FOLLOWERS_PER_USER);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    OLD_HASH_NODE **old_table = read_text_savefile();
+    long text_usec = bench_elapsed_usec(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    USER_DIRECTORY *loaded = read_savefile();
+    long binary_usec = bench_elapsed_usec(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    user_directory_link_following(loaded);
+    long link_usec = bench_elapsed_usec(&start);
+
+    int old_users = 0;
+    for (int list_idx = 0; list_idx < BENCH_OLD_HASH_SIZE; list_idx++)
+        for (OLD_HASH_NODE *node = old_table[list_idx]; node; node = node->next)
+            old_users++;
+
+    bench_report("text savefile     %10.1f ms (%d users loaded)\n", text_usec / 1e3, old_users);
+    bench_report("binary savefile   %10.1f ms (%u users loaded)\n", binary_usec / 1e3, user_directory_last_id(loaded));
+    bench_report("  linking following %10.1f ms (the text savefile had no following sets)\n", link_usec / 1e3);
+
+    bench_leave_temporary_directory();
+    return 0;
+}
+
+// Same lines as the old save_savefile wrote: the username, and then its followers separated by commas
+void write_text_savefile(USER_DIRECTORY *directory)
+{
+    FILE *savefile = fopen(BENCH_TEXT_SAVEFILE_PATH, "w");
+
+    for (uint32_t id = 1; id <= user_directory_last_id(directory); id++)
+    {
+        USER *user = user_directory_get(directory, id);
+        fprintf(savefile, "%s\n", user->username);
+
+        for (uint32_t follower_idx = 0; follower_idx < user->followers.length; follower_idx++)
+            if (user->followers.ids[follower_idx] != ID_SET_EMPTY)
+                fprintf(savefile, "%s,", user_directory_get(directory, user->followers.ids[follower_idx])->username);
+        fprintf(savefile, "\n");
+    }
+
+    fclose(savefile);
+}
+
+// The old read_savefile, with only the parts which aren't loading removed
+OLD_HASH_NODE **read_text_savefile(void)
+{
+    FILE *savefile = fopen(BENCH_TEXT_SAVEFILE_PATH, "r");
+
+    int MAX_USERNAME_SIZE = MAX_USERNAME_LENGTH + 5,
+        MAX_FOLLOWERS_SIZE = MAX_USERNAME_SIZE * 80;
+
+    char *username = (char *)calloc(MAX_USERNAME_SIZE, sizeof(char)),
+         *followers = (char *)calloc(MAX_FOLLOWERS_SIZE, sizeof(char)),
+         *follower;
+    OLD_HASH_NODE **table = (OLD_HASH_NODE **)calloc(BENCH_OLD_HASH_SIZE, sizeof(OLD_HASH_NODE *));
+    while (fgets(username, MAX_USERNAME_SIZE, savefile))
+    {
+        if (username[0] == '\n')
+            break;
+
+        if (fgets(followers, MAX_FOLLOWERS_SIZE, savefile) == NULL)
+            break;
+
+        username[strcspn(username, "\n")] = 0;
+        followers[strcspn(followers, "\n")] = 0;
+
+        OLD_USER *user = (OLD_USER *)calloc(1, sizeof(OLD_USER));
+
+        follower = strtok(followers, ",");
+        while (follower != NULL)
+        {
+            user->followers = chained_list_append_end(user->followers, (void *)strdup(follower));
+            follower = strtok(NULL, ",");
+        }
+
+        strcpy(user->username, username);
+
+        old_hash_insert(table, username, (void *)user);
+    }
+
+    fclose(savefile);
+    free(username);
+    free(followers);
+
+    return table;
+}
+
+CHAINED_LIST *chained_list_append_end(CHAINED_LIST *list, void *val)
+{
+    CHAINED_LIST *new_list = (CHAINED_LIST *)malloc(sizeof(CHAINED_LIST));
+    new_list->next = NULL;
+    new_list->val = val;
+
+    if (!list)
+        return new_list;
+
+    CHAINED_LIST *end_list = list;
+    while (end_list->next)
+        end_list = end_list->next;
+    end_list->next = new_list;
+
+    return list;
+}
+
+int old_hash_address(char *key)
+{
+    int address = 1;
+
+    for (int key_idx = 0; key_idx < (int)strlen(key); key_idx++)
+        address = (address * key[key_idx]) % BENCH_OLD_HASH_SIZE + 1;
+
+    return address - 1;
+}
+
+// Like the old hash_insert, which looked for the key before adding it to the start of its list
+void old_hash_insert(OLD_HASH_NODE **table, char *key, void *value)
+{
+    int address = old_hash_address(key);
+
+    for (OLD_HASH_NODE *node = table[address]; node; node = node->next)
+        if (strcmp(key, node->key) == 0)
+            return;
+
+    OLD_HASH_NODE *node = (OLD_HASH_NODE *)calloc(1, sizeof(OLD_HASH_NODE));
+    node->key = strdup(key);
+    node->value = value;
+    node->next = table[address];
+    table[address] = node;
+}
@@ -0,0 +1,138 @@
+#include "bench.h"
+
+#include "user_directory.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define BENCH_USERS 50000           // Created before the threads start
+#define BENCH_SECONDS 1
+#define BENCH_LOGINS_PER_THOUSAND 10 // Operations which intern a new user, the rest are lookups
+
+// Mixed logins and lookups on the USER_DIRECTORY from several threads, against the same table behind
+// a single global mutex, like every access to the users was before. Lookups are split between names,
+// which is what FEs send, and IDs, which is what followers and replication keep
+
+typedef struct worker
+{
+    pthread_t tid;
+    int idx;
+    atomic_int *stop;
+    long operations;
+} WORKER;
+
+USER_DIRECTORY *directory;
+pthread_mutex_t MUTEX_USERS = PTHREAD_MUTEX_INITIALIZER;
+char usernames[BENCH_USERS][MAX_USERNAME_LENGTH + 1];
+
+// Keeps the compiler from dropping lookups whose result isn't used
+USER *volatile lookup_sink;
+
+void *directory_run(void *);
+void *global_mutex_run(void *);
+void run_workers(char *, void *(*)(void *), int);
+
+int main(int argc, char *argv[])
+{
+    bench_init("User directory, logins and lookups from many threads");
+    bench_report("%ld CPUs online, threads beyond them only add contention\n", sysconf(_SC_NPROCESSORS_ONLN));
+
+    directory = user_directory_create();
+    for (int user_idx = 0; user_idx < BENCH_USERS; user_idx++)
+    {
+        sprintf(usernames[user_idx], "@user%d", user_idx);
+        user_directory_intern(directory, usernames[user_idx], USER_ID_NONE, NULL);
+    }
+
+    int threads[] = {1, 4, 16};
+    for (int threads_idx = 0; threads_idx < 3; threads_idx++)
+    {
+        run_workers("global mutex", &global_mutex_run, threads[threads_idx]);
+        run_workers("USER_DIRECTORY", &directory_run, threads[threads_idx]);
+    }
+
+    return 0;
+}
+
+// Runs `threads` workers for BENCH_SECONDS, and reports how many operations they did
+void run_workers(char *label, void *(*run)(void *), int threads)
+{
+    atomic_int stop = 0;
+    WORKER *workers = (WORKER *)calloc(threads, sizeof(WORKER));
+
+    for (int worker_idx = 0; worker_idx < threads; worker_idx++)
+    {
+        workers[worker_idx] = (WORKER){.idx = worker_idx, .stop = &stop};
+        pthread_create(&workers[worker_idx].tid, NULL, run, (void *)&workers[worker_idx]);
+    }
+
+    sleep(BENCH_SECONDS);
+    atomic_store(&stop, 1);
+
+    long operations = 0;
+    for (int worker_idx = 0; worker_idx < threads; worker_idx++)
+    {
+        pthread_join(workers[worker_idx].tid, NULL);
+        operations += workers[worker_idx].operations;
+    }
+
+    bench_report("%-16s %2d threads %12.0f operations/s\n", label, threads, (double)operations / BENCH_SECONDS);
+    free(workers);
+}
+
+void *directory_run(void *void_worker)
+{
+    WORKER *worker = (WORKER *)void_worker;
+    unsigned int seed = worker->idx + 1;
+    char username[MAX_USERNAME_LENGTH + 1];
+
+    while (!atomic_load_explicit(worker->stop, memory_order_relaxed))
+    {
+        int operation = rand_r(&seed) % 1000;
+        int user_idx = rand_r(&seed) % BENCH_USERS;
+
+        if (operation < BENCH_LOGINS_PER_THOUSAND)
+        {
+            sprintf(username, "@d%dn%ld", worker->idx, worker->operations);
+            lookup_sink = user_directory_intern(directory, username, USER_ID_NONE, NULL);
+        }
+        else if (operation % 2)
+            lookup_sink = user_directory_find(directory, usernames[user_idx]);
+        else
+            lookup_sink = user_directory_get(directory, user_idx + 1);
+
+        worker->operations++;
+    }
+
+    return NULL;
+}
+
+// Same operations, but the IDs are also looked up in the table, as there was nothing else
+void *global_mutex_run(void *void_worker)
+{
+    WORKER *worker = (WORKER *)void_worker;
+    unsigned int seed = worker->idx + 1;
+    char username[MAX_USERNAME_LENGTH + 1];
+
+    while (!atomic_load_explicit(worker->stop, memory_order_relaxed))
+    {
+        int operation = rand_r(&seed) % 1000;
+        int user_idx = rand_r(&seed) % BENCH_USERS;
+
+        pthread_mutex_lock(&MUTEX_USERS);
+        if (operation < BENCH_LOGINS_PER_THOUSAND)
+        {
+            sprintf(username, "@m%dn%ld", worker->idx, worker->operations);
+            lookup_sink = user_directory_intern(directory, username, USER_ID_NONE, NULL);
+        }
+        else
+            lookup_sink = user_directory_find(directory, usernames[user_idx]);
+        pthread_mutex_unlock(&MUTEX_USERS);
+
+        worker->operations++;
+    }
+
+    return NULL;
+}
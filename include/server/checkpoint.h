@@ -0,0 +1,14 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "user_directory.h"
+
+// Checkpoints save the users to the savefile and replace the WAL with a smaller one, in the background.
+// Nothing is stopped for them: the WAL is rotated by swapping its buffer, and every user is locked
+// alone, for as long as copying its followers or logging its inbox takes. The same thread applies
+// the retention policies of the timeline store
+void checkpoint_start(USER_DIRECTORY *directory);
+void checkpoint_stop(void);
+int checkpoint_run(USER_DIRECTORY *directory);
+
+#endif // CHECKPOINT_H
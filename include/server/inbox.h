@@ -0,0 +1,33 @@
+#ifndef INBOX_H
+#define INBOX_H
+
+#include "message.h"
+#include "notification.h"
+#include "user.h"
+
+// Offline inbox of every user, made of its `pending_messages` and of an append-only segment on disk.
+// Only the newest INBOX_MEMORY_LIMIT messages stay in memory, and the older ones are spilled to
+// the segment, so that memory depends on the active users and not on the whole backlog.
+// Messages are always walked from the oldest (on disk) to the newest (in memory).
+//
+// Each inbox is guarded by the mutex of its user, which callers must hold, except for `inbox_spill`
+// which does its disk I/O without it, and for the INBOX_COPY functions other than `inbox_copy`
+typedef struct inbox_copy
+{
+    char receiver[MAX_USERNAME_LENGTH + 2];
+    int segment_fd;            // Opened when copied, so that it can be read after a clear, or -1
+    uint32_t spilled_messages; // Frames of the segment which were counted when copied
+    MESSAGE **messages;        // A reference to each message in memory
+    uint32_t length;
+} INBOX_COPY;
+
+void inbox_open_directory(int server_index);
+int inbox_push(USER *user, MESSAGE *message);
+void inbox_spill(USER *user);
+void inbox_iterate(USER *user, void (*function)(NOTIFICATION *, void *), void *arg);
+void inbox_clear(USER *user);
+void inbox_copy(USER *user, INBOX_COPY *copy);
+void inbox_copy_iterate(INBOX_COPY *copy, void (*function)(NOTIFICATION *, void *), void *arg);
+void inbox_copy_free(INBOX_COPY *copy);
+
+#endif // INBOX_H
@@ -0,0 +1,24 @@
+#ifndef NOTIFICATION_ID_H
+#define NOTIFICATION_ID_H
+
+#include <stdint.h>
+
+#define NOTIFICATION_ID_EPOCH_MS 1577836800000ULL // 2020-01-01, so that the milliseconds fit in their bits
+#define NOTIFICATION_ID_NODE_BITS 4               // Enough for MAX_RING_SIZE
+#define NOTIFICATION_ID_THREAD_BITS 8
+#define NOTIFICATION_ID_SEQUENCE_BITS 10
+#define NOTIFICATION_ID_CLOCK_SHIFT (NOTIFICATION_ID_NODE_BITS + NOTIFICATION_ID_THREAD_BITS + NOTIFICATION_ID_SEQUENCE_BITS)
+
+// 64 bits notification IDs, unique in the whole ring and roughly ordered by time:
+//
+//   [ 42 bits of clock (ms) | 4 bits of node | 8 bits of thread | 10 bits of sequence ]
+//
+// The clock is a hybrid logical clock: it follows the wall clock, but never goes back, and it
+// moves past every ID observed from other servers, so IDs given after a failover are bigger
+// than the ones given by the old primary. Each thread keeps its own clock and sequence,
+// so no lock is shared between them
+void notification_id_init(int node_index);
+uint64_t notification_id_next(void);
+void notification_id_observe(uint64_t id);
+
+#endif // NOTIFICATION_ID_H
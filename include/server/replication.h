@@ -0,0 +1,54 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "deque.h"
+#include "mpsc_queue.h"
+#include "notification.h"
+#include "server_ring.h"
+
+// Long lived connection to the next server in the ring, through which every replication
+// frame is pipelined. Frames are queued by any thread and written by a single sender thread,
+// which only reconnects when the connection breaks or the ring topology changes.
+//
+// It is also the replication log: the primary gives every frame a sequential LSN and keeps it
+// until the last server before the primary acknowledges it, and backups use the LSNs to find
+// duplicated and missing frames. Backups only apply frames in order, dropping the ones after a
+// missing frame, so the acknowledgement only covers what every server has. The primary resends
+// its whole log when it is not acknowledged for a while, and the missing frame is received again
+typedef struct replication_link
+{
+    SERVER_RING *ring;
+    int sockfd;                           // -1 while disconnected
+    int next_index;                       // Ring index we are connected to
+    int primary_idx;                      // Primary when we connected, so that we notice elections
+    MPSC_QUEUE *queue;                    // NOTIFICATION* waiting to be written, owned by the link
+    void (*acknowledged)(NOTIFICATION *); // Called for every frame once all servers have it
+    pthread_t tid;
+
+    // Primary side
+    uint64_t last_lsn;                    // Last LSN given to a frame, only given by the sender thread
+    uint64_t acknowledged_lsn;            // Every frame up to this one is in all servers
+    DEQUE unacknowledged;                 // Frames sent but not acknowledged yet, oldest first
+    struct timespec progressed_at;        // When the log was last acknowledged or resent, if not empty
+    pthread_mutex_t MUTEX_UNACKNOWLEDGED; // Frames are appended by the sender and removed by the acks
+
+    // Backup side
+    uint64_t applied_lsn;    // Last LSN received from the previous server, with every one before it
+    int applied_primary_idx; // Primary whose LSNs we are following
+    int applied_started;     // Unset until the first frame after a snapshot, which starts the sequence
+} REPLICATION_LINK;
+
+REPLICATION_LINK *replication_link_create(SERVER_RING *ring, void (*acknowledged)(NOTIFICATION *));
+void replication_link_send(REPLICATION_LINK *link, NOTIFICATION *notification);
+void replication_link_send_unsequenced(REPLICATION_LINK *link, NOTIFICATION *notification);
+int replication_link_receive(REPLICATION_LINK *link, NOTIFICATION *notification);
+void replication_link_acknowledge(REPLICATION_LINK *link, uint64_t lsn);
+uint64_t replication_link_snapshot_lsn(REPLICATION_LINK *link);
+void replication_link_start_at(REPLICATION_LINK *link, uint64_t lsn);
+void replication_link_ring_changed(REPLICATION_LINK *link);
+
+#endif // REPLICATION_H
@@ -1,9 +1,37 @@
 #ifndef SAVEFILE_H_
 #define SAVEFILE_H_
 
-#include "hash.h"
+#include <stdint.h>
 
-HASH_TABLE read_savefile(void);
-void save_savefile(HASH_TABLE);
+#include "user_directory.h"
+
+// A savefile is a SAVEFILE_HEADER, the followers of every user as one contiguous uint32_t array,
+// and then the index of users, which says where the followers of each one are in the array.
+// Everything is in the byte order of the host, so the file is mapped and read in place
+#define SAVEFILE_MAGIC 0x56415354 // "TSAV"
+#define SAVEFILE_VERSION 2
+
+typedef struct savefile_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t users;
+    uint32_t user_size; // sizeof(SAVEFILE_USER) of the writer
+    uint64_t followers; // Length of the followers array
+    uint64_t followers_offset;
+    uint64_t index_offset; // Aligned to 8 bytes
+} SAVEFILE_HEADER;
+
+typedef struct savefile_user
+{
+    uint32_t id;
+    uint32_t followers;      // How many followers it has
+    uint64_t first_follower; // Position of the first one in the followers array
+    char username[MAX_USERNAME_LENGTH + 2]; // Ends with '\0'
+} SAVEFILE_USER;
+
+void savefile_open(int server_index);
+USER_DIRECTORY *read_savefile(void);
+int save_savefile(USER_DIRECTORY *);
 
 #endif // SAVEFILE_H_
@@ -0,0 +1,27 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+
+#include "user_directory.h"
+
+// A snapshot is streamed as [magic][version][u64 LSN] followed by chunks of
+// [u32 payload length][u32 CRC32 of the payload][payload], ending with an empty chunk.
+// Payloads are a sequence of records, and a record never crosses a chunk boundary
+#define SNAPSHOT_MAGIC "TSNP"
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_HEADER_SIZE 13
+#define SNAPSHOT_CHUNK_HEADER_SIZE 8
+
+// Every record is [type][varint user ID] followed by its own fields
+typedef enum
+{
+    SNAPSHOT_RECORD__USER = 1,  // [username][varint sessions number][varint replication sequence], before any other record of the user
+    SNAPSHOT_RECORD__FOLLOWERS, // [u32 count][count varint IDs], a user may have many of these
+    SNAPSHOT_RECORD__PENDING    // [varint frame length][notification frame]
+} SNAPSHOT_RECORD;
+
+int snapshot_send(int sockfd, USER_DIRECTORY *directory, uint64_t lsn);
+int snapshot_receive(int sockfd, USER_DIRECTORY *directory, uint64_t *lsn);
+
+#endif // SNAPSHOT_H
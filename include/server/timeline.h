@@ -0,0 +1,28 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <stdint.h>
+
+#include "message.h"
+#include "notification.h"
+#include "user.h"
+#include "user_directory.h"
+
+// Store of the posts of every user, made of append-only segments of protocol frames in a directory
+// of this server. The index of each user says where its posts are, and is rebuilt from the segments
+// at startup. Only its newest TIMELINE_CACHE_SIZE posts are kept in memory.
+//
+// Posts older than TIMELINE_RETENTION_SECONDS, beyond TIMELINE_MAX_POSTS of their user, or in
+// the oldest segments beyond TIMELINE_MAX_SEGMENTS are dropped. Segments left with few posts
+// are compacted, moving their posts to the newest one.
+//
+// The index and the cache of each user are guarded by its mutex, which callers of timeline_append
+// and timeline_read must hold. timeline_read_feed takes them itself, one at a time
+void timeline_open(int server_index, USER_DIRECTORY *directory);
+void timeline_append(USER *user, MESSAGE *message);
+int timeline_read(USER *user, uint64_t before_id, NOTIFICATION *notifications, int max);
+int timeline_read_feed(USER_DIRECTORY *directory, USER *user, uint64_t before_id, NOTIFICATION *notifications, int max);
+void timeline_maintain(USER_DIRECTORY *directory);
+void timeline_sync(void);
+
+#endif // TIMELINE_H
@@ -0,0 +1,35 @@
+#ifndef USER_DIRECTORY_H
+#define USER_DIRECTORY_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "hash.h"
+#include "user.h"
+
+#define USER_DIRECTORY_PAGE_SIZE 4096 // Users in each page of the ID index
+#define USER_DIRECTORY_MAX_PAGES 65536
+
+// Interns every username as a dense uint32_t ID, given by the primary on the first login.
+// Internal structures (followers, replication, snapshots) only keep the IDs, and
+// names are only needed at the edges, when talking with FEs and clients.
+//
+// Both lookups take no lock. IDs index pages which are never moved nor freed,
+// and names go through the lock-free HASH_TABLE
+typedef struct user_directory
+{
+    HASH_TABLE by_name;
+    _Atomic(_Atomic(USER *) *) pages[USER_DIRECTORY_MAX_PAGES];
+    _Atomic uint32_t last_id;    // Biggest ID in the directory
+    pthread_mutex_t MUTEX_INTERN; // Users are created one at a time
+} USER_DIRECTORY;
+
+USER_DIRECTORY *user_directory_create(void);
+USER *user_directory_find(USER_DIRECTORY *directory, char *username);
+USER *user_directory_get(USER_DIRECTORY *directory, uint32_t id);
+USER *user_directory_intern(USER_DIRECTORY *directory, char *username, uint32_t id, int *created);
+uint32_t user_directory_last_id(USER_DIRECTORY *directory);
+void user_directory_link_following(USER_DIRECTORY *directory);
+
+#endif // USER_DIRECTORY_H
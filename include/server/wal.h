@@ -0,0 +1,45 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <stdint.h>
+
+#include "message.h"
+#include "notification.h"
+#include "user.h"
+#include "user_directory.h"
+
+#define WAL_RECORD_HEADER_SIZE 8 // [u32 payload length][u32 CRC32 of the payload]
+
+typedef enum
+{
+    WAL_RECORD__LOGIN = 1, // [varint user id][username]
+    WAL_RECORD__FOLLOW,    // [varint user id][varint follower id]
+    WAL_RECORD__MESSAGE,   // [varint frame length][frame], logged once per file before its first PENDING
+    WAL_RECORD__PENDING,   // [varint user id][varint message id]
+    WAL_RECORD__DELIVERED, // [varint user id], the inbox of the user was emptied
+} WAL_RECORD;
+
+// Append-only write-ahead log of the changes to the users, follows and offline inboxes since the last
+// savefile, which are replayed on top of it when a server starts as the primary.
+//
+// Records are appended to a buffer by any thread, and a single thread writes and syncs them in groups,
+// every WAL_GROUP_COMMIT_USEC. So logging never waits for the disk, and a crash loses at most the
+// records of the last interval. A record torn by a crash ends the replay, and is truncated away.
+//
+// Checkpoints rotate the file, log every inbox again in the new one, and save the savefile. Then the
+// rotated file has nothing that isn't somewhere else, and is removed
+void wal_open(int server_index);
+int wal_replay(USER_DIRECTORY *directory);
+void wal_reset(USER_DIRECTORY *directory);
+void wal_sync(void);
+int wal_rotate(long *paused_usec);
+void wal_remove_rotated(void);
+uint64_t wal_length(void);
+
+void wal_log_login(USER *user);
+void wal_log_follow(USER *user, USER *follower);
+void wal_log_pending(USER *user, MESSAGE *message);
+void wal_log_delivered(USER *user);
+void wal_log_inbox(USER *user);
+
+#endif // WAL_H
@@ -0,0 +1,35 @@
+#ifndef DEQUE_H
+#define DEQUE_H
+
+#include <stddef.h>
+
+#define DEQUE_NODE_POOL_SIZE 1024 // Free nodes each thread keeps for reuse
+
+typedef struct deque_node
+{
+    void *val;
+    struct deque_node *prev;
+    struct deque_node *next;
+} DEQUE_NODE;
+
+// Doubly linked list with O(1) push and pop at both ends. Nodes come from a free list
+// of the calling thread, so that most pushes and pops don't go through malloc and free. The free
+// list of a thread is freed when it exits
+typedef struct deque
+{
+    DEQUE_NODE *head;
+    DEQUE_NODE *tail;
+    size_t size;
+} DEQUE;
+
+void deque_init(DEQUE *deque);
+void deque_push_back(DEQUE *deque, void *val);
+void deque_push_front(DEQUE *deque, void *val);
+void *deque_pop_front(DEQUE *deque);
+void *deque_pop_back(DEQUE *deque);
+void *deque_find(DEQUE *deque, void *val, int(item_compare_function)(void *, void *));
+void deque_move(DEQUE *destination, DEQUE *source);
+void deque_iterate(DEQUE *deque, void (*iterate_function)(void *));
+void deque_clear(DEQUE *deque);
+
+#endif // DEQUE_H
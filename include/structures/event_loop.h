@@ -0,0 +1,56 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "notification.h"
+#include "stream_buffer.h"
+
+#define EVENT_LOOP_MAX_EVENTS 64
+#define EVENT_LOOP_READ_BUFFER_SIZE 4096
+#define EVENT_LOOP_WRITE_HIGH_WATER (4 << 20) // Bytes waiting to be written after which the peer is disconnected
+
+struct event_loop;
+
+typedef struct connection
+{
+    int sockfd;
+    int state;                   // Handler specific state, starts at 0 for every new connection
+    STREAM_BUFFER *read_buffer;  // Frames being reassembled from the socket
+    NOTIFICATION notification;   // Last notification decoded
+    char *write_buffer;          // Bytes which couldn't be written yet, flushed when the socket is writable
+    size_t write_length;         // How many bytes are waiting in `write_buffer`
+    size_t write_capacity;       // Allocated size of `write_buffer`
+    pthread_mutex_t write_mutex; // Writes can come from any thread
+    int closed;                  // Set under `write_mutex` once its loop lets go of it, so writes fail
+    atomic_int references;       // One of its loop, and one of every thread retaining it to write
+    struct event_loop *loop;     // Loop which owns this connection
+    void *data;                  // Handler specific data
+} CONNECTION;
+
+// Called for every complete notification received in a connection, and with a NULL
+// notification when the connection is closed by the other side or breaks.
+// Returns 0 when the connection should be closed, EVENT_LOOP_DETACH to hand its socket
+// over to someone else (which becomes responsible for closing it), anything else to keep it open
+typedef int (*EVENT_LOOP_HANDLER)(CONNECTION *, NOTIFICATION *);
+
+#define EVENT_LOOP_DETACH -1
+
+typedef struct event_loop
+{
+    int epoll_fd;
+    int listen_sockfd;
+    EVENT_LOOP_HANDLER handler;
+    pthread_t tid;
+} EVENT_LOOP;
+
+EVENT_LOOP *event_loop_create(int listen_sockfd, EVENT_LOOP_HANDLER handler);
+void event_loop_start(EVENT_LOOP *loop);
+void event_loop_run(EVENT_LOOP *loop);
+int event_loop_write(CONNECTION *connection, void *data, size_t length);
+CONNECTION *event_loop_retain(CONNECTION *connection);
+void event_loop_release(CONNECTION *connection);
+
+#endif // EVENT_LOOP_H
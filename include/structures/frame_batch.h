@@ -0,0 +1,34 @@
+#ifndef FRAME_BATCH_H
+#define FRAME_BATCH_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "protocol.h"
+
+// Frames flushed in a single syscall, each one uses two iovecs (its header and the shared fields)
+#define FRAME_BATCH_MAX_FRAMES 512
+
+// Frames with the same fields, which only differ on the receiver, waiting to be written
+// to the same socket. The fields are encoded once, and each frame only adds its own header
+typedef struct frame_batch
+{
+    int sockfd;
+    pthread_mutex_t *mutex; // Held while flushing, so frames from other writers don't interleave with ours
+    NOTIFICATION_TYPE type;
+    uint32_t mask;
+    uint8_t *fields; // Shared by every frame, encoded with `protocol_encode_fields`
+    size_t fields_length;
+    int frames;   // How many frames are waiting to be flushed
+    int syscalls; // How many syscalls were used to flush it until now
+    uint8_t headers[FRAME_BATCH_MAX_FRAMES][PROTOCOL_MAX_HEADER_SIZE];
+    struct iovec iov[FRAME_BATCH_MAX_FRAMES * 2];
+} FRAME_BATCH;
+
+void frame_batch_init(FRAME_BATCH *batch, int sockfd, pthread_mutex_t *mutex, NOTIFICATION_TYPE type, uint32_t mask, uint8_t *fields, size_t fields_length);
+int frame_batch_add(FRAME_BATCH *batch, char *receiver);
+int frame_batch_flush(FRAME_BATCH *batch);
+
+#endif // FRAME_BATCH_H
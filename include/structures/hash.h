@@ -4,24 +4,74 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
-#define HASH_SIZE 1999
+#include "config.h"
 
+#define HASH_INITIAL_SIZE 1024 // Slots, must be a power of two and a multiple of HASH_GROUP_SIZE
+#define HASH_GROUP_SIZE 8      // Slots whose control bytes are checked at once, as one 64 bit word
+#define HASH_MAX_LOAD_FACTOR_PERCENT 75
+#define HASH_REHASH_STEP 8 // Groups copied to the bigger array on every insert while resizing
+#define HASH_KEY_SIZE (MAX_USERNAME_LENGTH + 4)
+
+// Slot of the table, with the key inline so that a lookup touches a single cache line after
+// the control bytes. Slots are never changed nor freed after they are published, so a
+// HASH_NODE* is valid for as long as the table
 typedef struct hash_node
 {
-    char *key;
+    uint64_t hash; // So that resizing and failed comparisons don't need the key
     void *value;
-    struct hash_node *next;
+    char key[HASH_KEY_SIZE];
+    uint8_t moved; // Copy of a slot which was in the previous array
 } HASH_NODE;
 
-// C syntax is confuse here but HASH_TABLE is a HASH_NODE**
-typedef HASH_NODE **HASH_TABLE;
+// Open addressing array in the style of SwissTable: every group of slots has a word with one
+// control byte per slot, which is either HASH_CONTROL_EMPTY or the lowest 7 bits of the hash
+typedef struct hash_buckets
+{
+    _Atomic uint64_t *controls;
+    HASH_NODE *slots;
+    uint64_t groups; // Always a power of two
+
+    // While resizing, previous array whose slots are still being copied to this one
+    _Atomic(struct hash_buckets *) old;
+    uint64_t rehash_idx; // Every old group before this one was already copied
+
+    struct hash_buckets *retired_next;
+} HASH_BUCKETS;
+
+// Concurrent map where lookups take no lock, and inserts are serialized by MUTEX_WRITE.
+// The table doubles when it gets too full, but the slots are copied to the new array a few
+// groups at a time on the next inserts, so no single insert stalls on a big resize.
+// Old arrays are never changed again, and are kept until the table is freed because a
+// reader may still be walking them. Growing by doubling bounds that to the size of the table
+typedef struct hash_table
+{
+    _Atomic(HASH_BUCKETS *) buckets;
+    uint64_t count;
+    HASH_BUCKETS *retired; // Arrays already fully copied to a bigger one
+    pthread_mutex_t MUTEX_WRITE;
+} *HASH_TABLE;
+
+// Walks every node of a table. Inserts may happen meanwhile, and may or may not be returned
+typedef struct hash_iterator
+{
+    HASH_BUCKETS *buckets;
+    HASH_BUCKETS *old;
+    int in_old_buckets;
+    uint64_t slot_idx; // Next slot to be checked
+} HASH_ITERATOR;
 
 HASH_TABLE hash_init(void);
 void hash_free(HASH_TABLE table);
+uint64_t hash_string(char *key);
 int hash_address(char *key);
 HASH_NODE *hash_find(HASH_TABLE table, char *key);
 HASH_NODE *hash_insert(HASH_TABLE table, char *key, void *value);
+void hash_iterator_init(HASH_TABLE table, HASH_ITERATOR *iterator);
+HASH_NODE *hash_iterator_next(HASH_ITERATOR *iterator);
 void hash_print(HASH_TABLE table);
 
 #endif
@@ -0,0 +1,30 @@
+#ifndef ID_SET_H
+#define ID_SET_H
+
+#include <stdint.h>
+
+#define ID_SET_EMPTY 0 // Not a valid ID, marks the removed positions of `ids`
+#define ID_SET_INITIAL_INDEX_SIZE 8
+
+// Set of non zero uint32_t IDs, with O(1) expected membership, insertion and removal.
+// IDs are kept in insertion order in `ids`, so it can be walked like an array
+// (skipping ID_SET_EMPTY), and an open addressing index finds their positions
+typedef struct id_set
+{
+    uint32_t *ids;
+    uint32_t length; // Positions used in `ids`, removed ones included
+    uint32_t capacity;
+    uint32_t count;
+
+    uint32_t *index; // Position in `ids` plus one, or 0 for a free slot
+    uint32_t index_size; // Always a power of two
+} ID_SET;
+
+void id_set_init(ID_SET *set);
+void id_set_free(ID_SET *set);
+int id_set_contains(ID_SET *set, uint32_t id);
+int id_set_add(ID_SET *set, uint32_t id);
+int id_set_remove(ID_SET *set, uint32_t id);
+void id_set_load(ID_SET *set, uint32_t *ids, uint32_t count);
+
+#endif // ID_SET_H
@@ -0,0 +1,34 @@
+#ifndef MESSAGE_H
+#define MESSAGE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "config.h"
+#include "notification.h"
+
+// Immutable body of a message, shared by every recipient of it. Whoever keeps a pointer to it
+// (the author's timeline, or a recipient's pending messages) holds a reference, and it is freed
+// once the last one is released. The recipient is never stored, as it is whoever holds it.
+//
+// Besides `references`, `wal_epoch` is the only field which changes after it is created. Inboxes
+// of different users log it from different threads, so it is atomic, and only set by the WAL
+// with its buffer locked
+typedef struct message
+{
+    atomic_uint references;
+    atomic_uint wal_epoch; // WAL file its body was logged in, 0 if none
+    uint64_t id;
+    time_t timestamp;
+    NOTIFICATION_TYPE type;
+    char author[MAX_USERNAME_LENGTH + 2];
+    char body[MAX_MESSAGE_SIZE + 2];
+} MESSAGE;
+
+MESSAGE *message_create(NOTIFICATION *notification);
+MESSAGE *message_retain(MESSAGE *message);
+void message_release(MESSAGE *message);
+void message_to_notification(MESSAGE *message, char *receiver, NOTIFICATION *notification);
+
+#endif // MESSAGE_H
@@ -0,0 +1,31 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+typedef struct mpsc_queue_cell
+{
+    atomic_size_t sequence; // Tells if the cell is free to be written or ready to be read
+    void *val;
+} MPSC_QUEUE_CELL;
+
+// Bounded lock-free queue, with any number of producers and a single consumer
+typedef struct mpsc_queue
+{
+    MPSC_QUEUE_CELL *cells;
+    size_t mask;          // Capacity is always a power of two, so we can index with a mask
+    atomic_size_t tail;   // Shared between producers
+    size_t head;          // Only used by the consumer
+    atomic_int sleeping;  // Set when the consumer is blocked waiting for new values
+    int eventfd;          // Used to wake up the consumer
+} MPSC_QUEUE;
+
+MPSC_QUEUE *mpsc_queue_create(size_t capacity);
+int mpsc_queue_push(MPSC_QUEUE *queue, void *val);
+void *mpsc_queue_try_pop(MPSC_QUEUE *queue);
+void *mpsc_queue_pop(MPSC_QUEUE *queue);
+void *mpsc_queue_pop_timeout(MPSC_QUEUE *queue, int timeout_msec);
+void mpsc_queue_free(MPSC_QUEUE *queue);
+
+#endif // MPSC_QUEUE_H
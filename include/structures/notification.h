@@ -13,6 +13,7 @@ typedef enum Command
     UNKNOWN,
     LOGIN,
     LOGOUT,
+    TIMELINE,
 } COMMAND;
 
 typedef enum
@@ -26,20 +27,26 @@ typedef enum
     NOTIFICATION_TYPE__KEEPALIVE,
     NOTIFICATION_TYPE__REPLICATION,
     NOTIFICATION_TYPE__LOGOUT,
-    NOTIFICATION_TYPE__FE_CONNECTION
+    NOTIFICATION_TYPE__FE_CONNECTION,
+    NOTIFICATION_TYPE__RING_CHANGED,
+    NOTIFICATION_TYPE__REPLICATION_ACK,
+    NOTIFICATION_TYPE__SNAPSHOT_REQUEST,
+    NOTIFICATION_TYPE__TIMELINE
 } NOTIFICATION_TYPE;
 
 typedef struct __notification
 {
     COMMAND command;
-    uint32_t id;                            // Identificador da notificação (sugere-se um identificador único)
+    uint64_t id;                            // Identificador da notificação (sugere-se um identificador único)
     time_t timestamp;                       // Timestamp da notificação
     NOTIFICATION_TYPE type;                 // Tipo da notificação, para saber como mostrar na tela
     char message[MAX_MESSAGE_SIZE + 2];     // Dados da mensagem
     char author[MAX_USERNAME_LENGTH + 2];   // Nome do autor da mensagem
-    int data;                               // Dados inteiros passados quando estamos usando LEADER_QUESTION, ELECTION ou ELECTED
+    int data;                               // Dados inteiros passados quando estamos usando LEADER_QUESTION, ELECTION ou ELECTED, o ID do usuário nas replicações, ou se o login foi aceito na resposta do FE
     char receiver[MAX_USERNAME_LENGTH + 2]; // Nome do usuario que vai receber a notificação
     char target[MAX_USERNAME_LENGTH + 2];   // Nome do usuário que essa mensagem se refere (usando para replicar FOLLOW)
+    uint64_t lsn;                           // Posição no log de replicação, 0 quando não é sequenciada
+    uint64_t sequence;                      // Ordem das mudanças replicadas do usuário, para ignorar as que um snapshot já tinha
 } NOTIFICATION;
 
 #endif // NOTIFICATION_H
@@ -0,0 +1,26 @@
+#ifndef NOTIFICATION_POOL_H
+#define NOTIFICATION_POOL_H
+
+#include <stddef.h>
+
+#include "notification.h"
+
+#define NOTIFICATION_POOL_SLAB_SIZE 256  // Notifications carved from each malloc
+#define NOTIFICATION_POOL_BATCH_SIZE 128 // Notifications moved at once between a thread and the shared pool
+
+// Every heap NOTIFICATION comes from this pool. They are carved from slabs which are never returned
+// to the system, so that the memory is reused instead of growing and fragmenting the heap.
+// Each thread allocates and frees from its own cache, and only takes the pool lock to exchange
+// a whole batch with the other threads. A thread which exits gives its whole cache back.
+//
+// A notification has a single owner, which must give it back with notification_pool_free
+// (stored messages are MESSAGE instead, shared by reference):
+// - The replication link owns its copies until they are acknowledged, or written when not logged
+// - The FE message queue owns the notifications pushed to it, until they are sent to the server
+NOTIFICATION *notification_pool_alloc(void);
+NOTIFICATION *notification_pool_duplicate(NOTIFICATION *notification);
+void notification_pool_free(NOTIFICATION *notification);
+size_t notification_pool_slabs(void);
+size_t notification_pool_shared(void);
+
+#endif // NOTIFICATION_POOL_H
@@ -0,0 +1,43 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "notification.h"
+
+// Every frame is [varint body length][version][type][varint field mask][fields...]
+// and only the fields set in the mask (the ones that aren't zero/empty) are sent
+#define PROTOCOL_VERSION 2
+#define PROTOCOL_MAX_FRAME_SIZE 512
+
+// Length prefix, version, type, mask and the receiver, which is the only field that changes in a fan-out
+#define PROTOCOL_MAX_HEADER_SIZE (2 + 4 + 1 + MAX_USERNAME_LENGTH + 2)
+
+// Bits of the field mask, in the same order the fields are written
+#define PROTOCOL_FIELD__RECEIVER (1 << 0)
+#define PROTOCOL_FIELD__COMMAND (1 << 1)
+#define PROTOCOL_FIELD__ID (1 << 2)
+#define PROTOCOL_FIELD__TIMESTAMP (1 << 3)
+#define PROTOCOL_FIELD__AUTHOR (1 << 4)
+#define PROTOCOL_FIELD__MESSAGE (1 << 5)
+#define PROTOCOL_FIELD__DATA (1 << 6)
+#define PROTOCOL_FIELD__TARGET (1 << 7)
+#define PROTOCOL_FIELD__LSN (1 << 8)
+#define PROTOCOL_FIELD__SEQUENCE (1 << 9)
+
+size_t protocol_encode(NOTIFICATION *notification, uint8_t *buffer);
+size_t protocol_encode_fields(NOTIFICATION *notification, uint8_t *buffer, uint32_t *mask);
+size_t protocol_encode_header(NOTIFICATION_TYPE type, uint32_t mask, char *receiver, size_t fields_length, uint8_t *buffer);
+int protocol_decode(uint8_t *buffer, size_t length, NOTIFICATION *notification);
+int protocol_write(int sockfd, NOTIFICATION *notification);
+int protocol_write_frames(int sockfd, uint8_t *frames, size_t length);
+int protocol_read(int sockfd, NOTIFICATION *notification);
+
+// Building blocks of the frames, also used by other binary formats
+uint8_t *protocol_put_varint(uint8_t *buffer, uint64_t value);
+uint8_t *protocol_put_string(uint8_t *buffer, char *string, size_t max_size);
+uint8_t *protocol_get_varint(uint8_t *buffer, uint8_t *end, uint64_t *value);
+uint8_t *protocol_get_string(uint8_t *buffer, uint8_t *end, char *string, size_t max_size);
+
+#endif // PROTOCOL_H
@@ -0,0 +1,26 @@
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "notification.h"
+
+// Ring buffer which receives bytes from a socket in big chunks, and yields every
+// complete frame in it, keeping incomplete ones until the rest arrives
+typedef struct stream_buffer
+{
+    uint8_t *data;
+    size_t capacity; // Always a power of two
+    size_t start;    // Position of the first byte not decoded yet
+    size_t length;   // How many bytes were received but not decoded yet
+} STREAM_BUFFER;
+
+STREAM_BUFFER *stream_buffer_create(size_t capacity);
+int stream_buffer_fill(STREAM_BUFFER *buffer, int sockfd, int flags);
+int stream_buffer_next(STREAM_BUFFER *buffer, NOTIFICATION *notification);
+int stream_buffer_read(STREAM_BUFFER *buffer, int sockfd, NOTIFICATION *notification);
+void stream_buffer_clear(STREAM_BUFFER *buffer);
+void stream_buffer_free(STREAM_BUFFER *buffer);
+
+#endif // STREAM_BUFFER_H
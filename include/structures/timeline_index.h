@@ -0,0 +1,34 @@
+#ifndef TIMELINE_INDEX_H
+#define TIMELINE_INDEX_H
+
+#include <stdint.h>
+
+// Where a post of a user is in the timeline store
+typedef struct timeline_entry
+{
+    uint64_t id;
+    int64_t timestamp;
+    uint32_t segment; // Sequence number of the segment with its frame
+    uint32_t offset;  // Where its frame starts in the segment
+} TIMELINE_ENTRY;
+
+// Posts of a user sorted by ID, in a ring buffer so that the oldest ones are dropped in O(1).
+// Posts usually come in order, so inserting them is O(1) too
+typedef struct timeline_index
+{
+    TIMELINE_ENTRY *entries;
+    uint32_t start; // Position of the oldest entry in `entries`
+    uint32_t length;
+    uint32_t capacity; // Always a power of two, or 0 before the first insertion
+} TIMELINE_INDEX;
+
+void timeline_index_init(TIMELINE_INDEX *index);
+void timeline_index_free(TIMELINE_INDEX *index);
+TIMELINE_ENTRY *timeline_index_get(TIMELINE_INDEX *index, uint32_t position);
+uint32_t timeline_index_lower_bound(TIMELINE_INDEX *index, uint64_t id);
+TIMELINE_ENTRY *timeline_index_find(TIMELINE_INDEX *index, uint64_t id);
+TIMELINE_ENTRY *timeline_index_insert(TIMELINE_INDEX *index, TIMELINE_ENTRY *entry);
+int timeline_index_pop_front(TIMELINE_INDEX *index, TIMELINE_ENTRY *entry);
+uint32_t timeline_index_filter(TIMELINE_INDEX *index, int (*keep)(TIMELINE_ENTRY *, void *), void *arg);
+
+#endif // TIMELINE_INDEX_H
@@ -2,19 +2,34 @@
 #define USER_H_
 
 #include <pthread.h>
+#include <stdint.h>
 
-#include "chained_list.h"
+#include "deque.h"
+#include "id_set.h"
+#include "timeline_index.h"
 #include "config.h"
 
+#define USER_ID_NONE 0 // IDs start at 1
+
 typedef struct user
 {
-  char username[MAX_USERNAME_LENGTH];
+  char username[MAX_USERNAME_LENGTH + 2];
+  uint32_t id;
+  int address; // hash_address of the username, which chooses its FE
   int sockets_fd[MAX_SESSIONS];
-  CHAINED_LIST *followers;
-  CHAINED_LIST *notifications;
-  CHAINED_LIST *pending_notifications;
+  ID_SET followers; // IDs of the followers
+  ID_SET following; // IDs of the users it follows, whose posts make its home feed
+  DEQUE messages;         // MESSAGE* of the newest posts, oldest first, at most TIMELINE_CACHE_SIZE
+  TIMELINE_INDEX timeline; // Every post of the user kept by the timeline store
+  DEQUE pending_messages; // MESSAGE* to be delivered when the user logs in, the newest ones
+  uint32_t spilled_messages; // Older pending messages, which went to disk
+  uint32_t inbox_generation; // Bumped whenever the inbox is cleared, so a spill running meanwhile drops what it wrote
   int sessions_number;
-  pthread_mutex_t mutex;
+  uint64_t replication_sequence; // Of its last replicated change, so that backups skip the ones they already have
+  pthread_mutex_t mutex;           // Guards the sessions, the inbox, the timeline and the replication sequence
+  pthread_mutex_t followers_mutex; // Held while the followers are copied by a fan-out or changed
+  pthread_mutex_t fan_out_mutex;   // Held during the whole fan-out of a post, so its posts arrive in order
+  pthread_mutex_t spill_mutex;     // Held while the inbox is written to disk, taken before `mutex`
 } USER;
 
 USER *init_user(void);
@@ -8,6 +8,34 @@
 // Server
 #define CONNECTIONS_TO_ACCEPT 15
 #define SAVEFILE_FILE_PATH ".savefile"
+#define SERVER_EVENT_LOOP_THREADS 4
+#define REPLICATION_QUEUE_SIZE 4096
+#define REPLICATION_BATCH_SIZE 64
+#define REPLICATION_GROUP_COMMIT_USEC 200
+#define REPLICATION_RESEND_MSEC 500 // Without acknowledgements, the primary resends its log after this
+#define SNAPSHOT_CHUNK_SIZE 65536
+#define INBOX_DIRECTORY_PATH ".inbox" // Followed by the ring index, as servers may share a directory
+#define INBOX_MEMORY_LIMIT 256        // Pending messages of each user kept in memory
+#define INBOX_SPILL_BATCH 128         // How many of them go to disk at once when over the limit
+#define INBOX_READ_BUFFER_SIZE 65536
+#define WAL_FILE_PATH ".wal"          // Followed by the ring index too
+#define WAL_GROUP_COMMIT_USEC 2000    // Records appended meanwhile are written and synced together
+#define WAL_FSYNC 1                   // 0 leaves the records to the page cache, without waiting for the disk
+#define CHECKPOINT_INTERVAL_SECONDS 60
+#define CHECKPOINT_MIN_WAL_GROWTH (1 << 20) // Bytes logged since the last checkpoint for the next one to run
+#define TIMELINE_DIRECTORY_PATH ".timeline"  // Followed by the ring index too
+#define TIMELINE_SEGMENT_SIZE (8 << 20)      // Bytes after which a new segment is started
+#define TIMELINE_MAX_SEGMENTS 256            // The oldest ones are removed beyond this
+#define TIMELINE_RETENTION_SECONDS (30 * 24 * 60 * 60)
+#define TIMELINE_MAX_POSTS 10000             // Of each user, the oldest ones are dropped beyond this
+#define TIMELINE_CACHE_SIZE 64               // Newest posts of each user kept in memory
+#define TIMELINE_COMPACTION_LIVE_PERCENT 50  // Segments with fewer live posts than this are rewritten
+#define TIMELINE_PAGE_SIZE 20                // Posts of the home feed sent for each TIMELINE command
+
+// Front end
+#define FE_EVENT_LOOP_THREADS 4
+#define FE_MESSAGE_QUEUE_SIZE 4096
+#define FE_SERVER_READ_BUFFER_SIZE 65536
 
 // Client
 #define HANDLE_MIN_SIZE 4
@@ -16,5 +44,7 @@
 #define HANDLE_FIRST_CHARACTER '@'
 #define NUMBER_OF_CHARS_IN_SEND 5
 #define NUMBER_OF_CHARS_IN_FOLLOW 7
+#define NUMBER_OF_CHARS_IN_TIMELINE 8
+#define CLIENT_READ_BUFFER_SIZE 16384
 
 #endif // CONFIG_H
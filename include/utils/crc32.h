@@ -0,0 +1,9 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t crc32_compute(uint8_t *buffer, size_t length);
+
+#endif // CRC32_H
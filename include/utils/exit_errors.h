@@ -7,6 +7,7 @@ enum EXIT_ERRORS
     ERROR_OPEN_SOCKET = 1,
     ERROR_CONFIGURATION_SOCKET,
     ERROR_BINDING_SOCKET,
+    ERROR_EVENT_LOOP,
 
     // Server
     ERROR_ACCEPTING_CONNECTION,
@@ -15,6 +16,10 @@ enum EXIT_ERRORS
     ERROR_LOOKING_FOR_LEADER,
     ERROR_SENDING_ELECTED,
     ERROR_REPLICATING,
+    ERROR_OPENING_INBOX,
+    ERROR_OPENING_WAL,
+    ERROR_OPENING_TIMELINE,
+    ERROR_SHUTDOWN,
 
     // Client
     NOT_ENOUGH_ARGUMENTS_ERROR,
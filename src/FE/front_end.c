@@ -11,16 +11,22 @@
 #include <assert.h>
 #include <errno.h>
 #include <netdb.h>
+#include <sys/resource.h>
 
-#include "chained_list.h"
+#include "deque.h"
+#include "notification_pool.h"
 #include "exit_errors.h"
 #include "logger.h"
 #include "user.h"
 #include "hash.h"
 #include "notification.h"
+#include "protocol.h"
 #include "server_ring.h"
 #include "socket.h"
 #include "front_end.h"
+#include "event_loop.h"
+#include "mpsc_queue.h"
+#include "stream_buffer.h"
 
 #define LOCK(mutex) pthread_mutex_lock(&mutex)
 #define UNLOCK(mutex) pthread_mutex_unlock(&mutex)
@@ -28,21 +34,30 @@
 #define TRUE 1
 #define FALSE 0
 
-CHAINED_LIST *chained_list_sockets_fd = NULL;
-CHAINED_LIST *chained_list_threads = NULL;
-CHAINED_LIST *chained_list_messages = NULL;
+DEQUE threads;
+
+// Notifications waiting to be sent to the server, fed by every client connection
+MPSC_QUEUE *message_queue = NULL;
 
 static int received_sigint = FALSE;
 
 pthread_t message_consumer_tid;
 
-unsigned long long GLOBAL_NOTIFICATION_ID = 0;
-
 HASH_TABLE user_hash_table = NULL;
 
+// Session table, with every client connection indexed by its socket
+CONNECTION **sessions = NULL;
+int sessions_capacity = 0;
+
+// States of a client connection inside the event loop
+typedef enum
+{
+    CONNECTION_STATE__NEW,
+    CONNECTION_STATE__LOGGED
+} CONNECTION_STATE;
+
 // Mutexes
-pthread_mutex_t MUTEX_MESSAGE_QUEUE = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t MUTEX_APPEND_LIST = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t MUTEX_SESSIONS = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t MUTEX_LOGIN = PTHREAD_MUTEX_INITIALIZER;
 
 void cancel_thread(void *);
@@ -53,8 +68,14 @@ void *listen_server_connection(void *);
 void *keep_server_connection(void *);
 void keep_alive_with_server(void);
 void *listen_message_processor(void *);
-void *listen_client_connection(void *);
+int handle_client_connection(CONNECTION *, NOTIFICATION *);
+void session_add(CONNECTION *);
+void session_remove(int);
+int session_write(USER *, int, void *, size_t);
+void send_timeline_page(USER *, int, uint8_t *, size_t);
+void raise_open_files_limit(void);
 void send_server(NOTIFICATION *);
+void enqueue_server(NOTIFICATION *);
 void cleanup(int);
 
 SERVER_RING *ring;
@@ -67,24 +88,24 @@ int main(int argc, char *argv[])
     pthread_t reconnect_tid, listen_connection_tid;
 
     // Sockets Address Config
-    struct sockaddr_in serv_addr, client_addr;
+    struct sockaddr_in serv_addr;
     int port = 0;
 
     // Configure user hash table
     user_hash_table = hash_init();
 
-    // Variables used below to connect to the incoming client connections
-    socklen_t clilen = sizeof(struct sockaddr_in);
-
     handle_signals();
 
+    // Every idle client is a socket, so allow as many of them as we can
+    raise_open_files_limit();
+
     // Server reconnect is responsible to keep the connection to the RM
     pthread_create(&reconnect_tid, NULL, (void *(*)(void *)) & keep_server_connection, NULL);
-    chained_list_threads = chained_list_append_end(chained_list_threads, (void *)reconnect_tid);
+    deque_push_back(&threads, (void *)&reconnect_tid);
 
     // Thread to communicate with server
     pthread_create(&listen_connection_tid, NULL, (void *(*)(void *)) & listen_server_connection, NULL);
-    chained_list_threads = chained_list_append_end(chained_list_threads, (void *)listen_connection_tid);
+    deque_push_back(&threads, (void *)&listen_connection_tid);
     logger_debug("Created new thread %ld to handle server connection\n", listen_connection_tid);
 
     // Creating this socket
@@ -113,7 +134,7 @@ int main(int argc, char *argv[])
             break;
     }
 
-    if (listen(sockfd, CONNECTIONS_TO_ACCEPT) < 0)
+    if (listen(sockfd, SOMAXCONN) < 0)
     {
         logger_error("When starting to listen");
 
@@ -125,34 +146,36 @@ int main(int argc, char *argv[])
     logger_info("Listening on port %d...\n", port);
 
     // Incoming message listener
+    message_queue = mpsc_queue_create(FE_MESSAGE_QUEUE_SIZE);
     pthread_create(&message_consumer_tid, NULL, (void *(*)(void *)) & listen_message_processor, NULL);
 
-    while (TRUE)
+    // Every client is handled by the event loops, the last one running in this thread
+    for (int loop_idx = 0; loop_idx < FE_EVENT_LOOP_THREADS; loop_idx++)
     {
-        int *newsockfd = (int *)malloc(sizeof(int));
-        *newsockfd = accept(sockfd, (struct sockaddr *)&client_addr, &clilen);
-
-        if (*newsockfd == -1)
-        {
-            logger_error("When accepting client connection\n");
-            cleanup(ERROR_ACCEPT);
-        }
+        EVENT_LOOP *loop = event_loop_create(sockfd, &handle_client_connection);
+        if (loop_idx == FE_EVENT_LOOP_THREADS - 1)
+            event_loop_run(loop);
 
-        logger_info("New Client connection from %s:%d\n", inet_ntoa(client_addr.sin_addr), client_addr.sin_port);
-
-        pthread_t *thread = (pthread_t *)malloc(sizeof(pthread_t));
-        pthread_create(thread, NULL, (void *(*)(void *)) & listen_client_connection, (void *)newsockfd);
-        logger_debug("Created new thread %ld to handle this connection\n", *thread);
-
-        LOCK(MUTEX_APPEND_LIST);
-        chained_list_sockets_fd = chained_list_append_end(chained_list_sockets_fd, (void *)newsockfd);
-        chained_list_threads = chained_list_append_end(chained_list_threads, (void *)thread);
-        UNLOCK(MUTEX_APPEND_LIST);
+        event_loop_start(loop);
+        deque_push_back(&threads, (void *)&loop->tid);
     }
 
     return 0;
 }
 
+void raise_open_files_limit(void)
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0)
+        return;
+
+    limit.rlim_cur = limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) < 0)
+        logger_warn("Couldn't raise the open files limit, keeping it as it was\n");
+    else
+        logger_info("Accepting up to %ld open files\n", (long)limit.rlim_cur);
+}
+
 void sigint_handler(int _sigint)
 {
     if (!received_sigint)
@@ -176,7 +199,12 @@ void handle_signals()
 void *listen_server_connection(void *_)
 {
     NOTIFICATION notification;
-    int bytes_read;
+    int bytes_read, buffer_sockfd = -1;
+    STREAM_BUFFER *buffer = stream_buffer_create(FE_SERVER_READ_BUFFER_SIZE);
+
+    // Frames of the timeline page being received, written to its session at once when it ends
+    size_t page_capacity = (TIMELINE_PAGE_SIZE + 1) * PROTOCOL_MAX_FRAME_SIZE, page_length = 0;
+    uint8_t *page = (uint8_t *)malloc(page_capacity);
 
     while (1)
     {
@@ -186,8 +214,15 @@ void *listen_server_connection(void *_)
             continue;
         }
 
-        bzero((void *)&notification, sizeof(NOTIFICATION));
-        bytes_read = read(ring->primary_fd, (void *)&notification, sizeof(NOTIFICATION));
+        // Whatever was left from the previous server connection is meaningless now
+        if (buffer_sockfd != ring->primary_fd)
+        {
+            stream_buffer_clear(buffer);
+            buffer_sockfd = ring->primary_fd;
+            page_length = 0;
+        }
+
+        bytes_read = stream_buffer_read(buffer, ring->primary_fd, &notification);
 
         if (bytes_read < 0)
         {
@@ -201,7 +236,7 @@ void *listen_server_connection(void *_)
             continue;
         }
 
-        if (notification.type != NOTIFICATION_TYPE__MESSAGE && notification.type != NOTIFICATION_TYPE__INFO)
+        if (notification.type != NOTIFICATION_TYPE__MESSAGE && notification.type != NOTIFICATION_TYPE__INFO && notification.type != NOTIFICATION_TYPE__TIMELINE)
         {
             logger_warn("Received unexpected notification type %d from server. Will just ignore it\n", notification.type);
             continue;
@@ -209,16 +244,50 @@ void *listen_server_connection(void *_)
 
         // Send back notification to the connected users
         HASH_NODE *node = hash_find(user_hash_table, notification.receiver);
+        if (node == NULL)
+        {
+            logger_warn("Received notification %llu to %s, who never logged in this FE. Will just ignore it\n", (unsigned long long)notification.id, notification.receiver);
+            continue;
+        }
         USER *user = (USER *)node->value;
+
+        // Clients already know who they are, so the receiver doesn't need to go through the wire
+        uint8_t frame[PROTOCOL_MAX_FRAME_SIZE];
+        notification.receiver[0] = '\0';
+        size_t frame_length = protocol_encode(&notification, frame);
+
+        if (notification.type == NOTIFICATION_TYPE__TIMELINE)
+        {
+            if (page_length + frame_length <= page_capacity)
+            {
+                memcpy(page + page_length, frame, frame_length);
+                page_length += frame_length;
+            }
+
+            // The server writes every frame of a page at once, and the last one carries the command
+            if (notification.command == TIMELINE)
+            {
+                send_timeline_page(user, notification.data, page, page_length);
+                page_length = 0;
+            }
+            continue;
+        }
+
+        // The sessions are copied under the lock, and written after it, like the timeline pages
+        int sockets_fd[MAX_SESSIONS];
+        LOCK(user->mutex);
+        memcpy(sockets_fd, user->sockets_fd, sizeof(sockets_fd));
+        UNLOCK(user->mutex);
+
         for (int i = 0; i < MAX_SESSIONS; i++)
         {
-            int socket_fd = user->sockets_fd[i];
+            int socket_fd = sockets_fd[i];
             if (socket_fd != -1)
             {
-                if (write(socket_fd, &notification, sizeof(NOTIFICATION)) < 0)
-                    logger_error("When sending notification %d to %s through socket %d\n", notification.id, user->username, socket_fd);
+                if (session_write(user, socket_fd, frame, frame_length) < 0)
+                    logger_error("When sending notification %llu to %s through socket %d\n", (unsigned long long)notification.id, user->username, socket_fd);
                 else
-                    logger_info("Sent notification %d with message '%s' to %s on socket %d\n", notification.id, notification.message, notification.receiver, socket_fd);
+                    logger_info("Sent notification %llu with message '%s' to %s on socket %d\n", (unsigned long long)notification.id, notification.message, user->username, socket_fd);
             }
         }
     }
@@ -247,14 +316,14 @@ SERVER_RING *connect_to_leader()
             logger_info("Will try to find which is the primary port\n");
 
             NOTIFICATION notification = {.type = NOTIFICATION_TYPE__LEADER_QUESTION};
-            int bytes_wrote = write(sockfd, (void *)&notification, sizeof(NOTIFICATION));
+            int bytes_wrote = protocol_write(sockfd, &notification);
             if (bytes_wrote < 0)
             {
                 logger_error("Error when trying to sending message to find who is the current leader. Will retry with another ring search...\n");
                 continue;
             }
 
-            int bytes_read = read(sockfd, (void *)&notification, sizeof(NOTIFICATION));
+            int bytes_read = protocol_read(sockfd, &notification);
             if (bytes_read < 0)
             {
                 logger_error("Error when trying to receive message to find who is the current leader. Will retry with another ring search...\n");
@@ -288,7 +357,7 @@ SERVER_RING *connect_to_leader()
             }
 
             NOTIFICATION connect_notification = {.type = NOTIFICATION_TYPE__FE_CONNECTION, .data = front_end_port_idx};
-            bytes_wrote = write(ring->primary_fd, (void *)&connect_notification, sizeof(NOTIFICATION));
+            bytes_wrote = protocol_write(ring->primary_fd, &connect_notification);
             if (bytes_wrote < 0)
             {
                 logger_error("Error when trying to connect to primary server. Will retry with another ring search...\n");
@@ -327,14 +396,14 @@ void keep_alive_with_server()
 
         // Data is 0, because doesn't want to replicate back
         NOTIFICATION notification = {.type = NOTIFICATION_TYPE__KEEPALIVE, .data = 1}, read_notification;
-        int bytes_wrote = send(ring->keepalive_fd, (void *)&notification, sizeof(NOTIFICATION), MSG_NOSIGNAL);
+        int bytes_wrote = protocol_write(ring->keepalive_fd, &notification);
         if (bytes_wrote < 0)
         {
             logger_error("Error when sending keep alive. Main disconnected.\n");
             return;
         }
 
-        int bytes_read = read(ring->keepalive_fd, (void *)&read_notification, sizeof(NOTIFICATION));
+        int bytes_read = protocol_read(ring->keepalive_fd, &read_notification);
         if (bytes_read < 0)
         {
             logger_error("Error when receiving keep alive.\n");
@@ -378,20 +447,27 @@ void *listen_message_processor(void *_)
 {
     while (TRUE)
     {
-        LOCK(MUTEX_MESSAGE_QUEUE);
-        if (chained_list_messages)
-        {
-            logger_info("Received message from client. Processing it..\n");
-            send_server((NOTIFICATION *)chained_list_messages->val);
-            chained_list_messages = chained_list_messages->next;
-        }
-        UNLOCK(MUTEX_MESSAGE_QUEUE);
+        // Sleeps until some client connection pushes a new notification
+        NOTIFICATION *notification = (NOTIFICATION *)mpsc_queue_pop(message_queue);
 
-        // Give control back to another threads for some time
-        usleep(5);
+        logger_info("Received message from client. Processing it..\n");
+        send_server(notification);
+        notification_pool_free(notification);
     }
 }
 
+// Adds a notification to the queue of notifications to be sent to the server,
+// which takes ownership of it. Only waits if the queue is full
+void enqueue_server(NOTIFICATION *notification)
+{
+    if (mpsc_queue_push(message_queue, (void *)notification) == 0)
+        return;
+
+    logger_warn("Message queue is full, waiting for the server to catch up...\n");
+    while (mpsc_queue_push(message_queue, (void *)notification) < 0)
+        usleep(100);
+}
+
 int get_free_socket_spot(int *sockets_fd)
 {
     int i;
@@ -402,33 +478,24 @@ int get_free_socket_spot(int *sockets_fd)
     return -1;
 }
 
-USER *login_user(int sockfd)
+USER *login_user(int sockfd, NOTIFICATION *notification)
 {
-    NOTIFICATION notification;
-
-    int bytes_read = read(sockfd, (void *)&notification, sizeof(NOTIFICATION));
-    if (bytes_read < 0)
+    if (notification->type != NOTIFICATION_TYPE__LOGIN)
     {
-        logger_error("Couldn't read username for socket %d\n", sockfd);
-        return NULL;
-    }
-
-    if (notification.type != NOTIFICATION_TYPE__LOGIN)
-    {
-        logger_error("Expected NOTIFICATION_TYPE__LOGIN from client but received %d... Will cancell thread\n", notification.type);
+        logger_error("Expected NOTIFICATION_TYPE__LOGIN from client but received %d... Will close connection\n", notification->type);
         return NULL;
     }
 
     // Only one user can be logged in each time
     LOCK(MUTEX_LOGIN);
 
-    HASH_NODE *hash_node = hash_find(user_hash_table, notification.author);
+    HASH_NODE *hash_node = hash_find(user_hash_table, notification->author);
     if (hash_node == NULL)
     {
-        logger_info("New user logged: %s\n", notification.author);
+        logger_info("New user logged: %s\n", notification->author);
         USER *user = init_user();
 
-        strcpy(user->username, notification.author);
+        strcpy(user->username, notification->author);
         user->sockets_fd[0] = sockfd;
         user->sessions_number = 1;
 
@@ -465,88 +532,175 @@ USER *login_user(int sockfd)
     return NULL;
 }
 
-void *listen_client_connection(void *void_sockfd)
+// Called by the event loops for every notification received from a client.
+// The first one must be the login, and the next ones are sent to the processing queue.
+// Returns FALSE when the connection should be closed
+int handle_client_connection(CONNECTION *connection, NOTIFICATION *notification)
 {
-    NOTIFICATION notification; // Used to receive the notifications
-    int bytes_read, sockfd = *((int *)void_sockfd);
-
-    USER *current_user = login_user(sockfd);
-    int can_login = current_user != NULL;
+    int sockfd = connection->sockfd;
+    USER *current_user = (USER *)connection->data;
 
-    bytes_read = write(sockfd, &can_login, sizeof(can_login));
-    if (bytes_read < 0)
+    // Client closed the connection (or it broke)
+    if (notification == NULL)
     {
-        logger_error("[Socket %d] When sending login ACK/NACK (%d)\n", sockfd, can_login);
-        return NULL;
+        if (connection->state != CONNECTION_STATE__LOGGED)
+            return FALSE;
+
+        logger_info("[Socket %d] Client closed connection\n", sockfd);
+
+        // Nobody can write to this session anymore, as it is going to be freed
+        session_remove(sockfd);
+
+        // Lock user while playing around with sockets list
+        LOCK(current_user->mutex);
+        current_user->sessions_number--;
+        for (int i = 0; i < MAX_SESSIONS; i++)
+            if (current_user->sockets_fd[i] == sockfd)
+            {
+                logger_info("[Socket %d] Freed %d socket position\n", sockfd, i);
+                current_user->sockets_fd[i] = -1;
+                break;
+            }
+
+        UNLOCK(current_user->mutex);
+
+        // Tell server about this logout
+        NOTIFICATION *user_logout = notification_pool_alloc();
+        user_logout->type = NOTIFICATION_TYPE__LOGOUT;
+        user_logout->command = LOGOUT;
+        strcpy(user_logout->author, current_user->username);
+        logger_info("Sending NOTIFICATION_TYPE__LOGOUT to server with username %s\n", user_logout->author);
+
+        enqueue_server(user_logout);
+
+        return FALSE;
     }
-    if (!can_login)
+
+    if (connection->state == CONNECTION_STATE__NEW)
     {
-        logger_error("User couldn't login! Max connections (%d) reached\n", MAX_SESSIONS);
-        return NULL;
-    }
+        // Must be in the session table before login, as the server may answer right away
+        session_add(connection);
 
-    // Tell server that this guy logged in
-    NOTIFICATION *user_login = (NOTIFICATION *)malloc(sizeof(NOTIFICATION));
-    user_login->type = NOTIFICATION_TYPE__LOGIN;
-    user_login->command = LOGIN;
-    strcpy(user_login->author, current_user->username);
-    logger_info("Sending NOTIFICATION_TYPE__LOGIN to server with username %s\n", user_login->author);
+        current_user = login_user(sockfd, notification);
+        int can_login = current_user != NULL;
 
-    send_server(user_login);
+        // Tells session_write whose session this is, as soon as the socket is one of the user's
+        LOCK(MUTEX_SESSIONS);
+        connection->data = (void *)current_user;
+        UNLOCK(MUTEX_SESSIONS);
 
-    // Keep receiving messages from the client, and sending them to the server
-    while (1)
-    {
-        bzero((void *)&notification, sizeof(NOTIFICATION));
+        // The answer is a LOGIN frame too, telling in `data` if the login was accepted
+        NOTIFICATION login_ack = {
+            .command = LOGIN,
+            .timestamp = time(NULL),
+            .type = NOTIFICATION_TYPE__LOGIN,
+            .data = can_login};
+        strcpy(login_ack.receiver, notification->author);
 
-        /* read from the socket */
-        bytes_read = read(sockfd, (void *)&notification, sizeof(NOTIFICATION));
-        if (bytes_read < 0)
+        uint8_t frame[PROTOCOL_MAX_FRAME_SIZE];
+        size_t frame_length = protocol_encode(&login_ack, frame);
+
+        if (event_loop_write(connection, frame, frame_length) < 0)
         {
-            logger_error("[Socket %d] (listen_client_connection) When reading from socket\n", sockfd);
+            logger_error("[Socket %d] When sending login ACK/NACK (%d)\n", sockfd, can_login);
+            can_login = FALSE;
         }
-        else if (bytes_read == 0)
+        if (!can_login)
         {
-            logger_info("[Socket %d] Client closed connection\n", sockfd);
-
-            // Lock user while playing around with sockets list
-            LOCK(current_user->mutex);
-            current_user->sessions_number--;
-            for (int i = 0; i < MAX_SESSIONS; i++)
-                if (current_user->sockets_fd[i] == sockfd)
-                {
-                    logger_info("[Socket %d] Freed %d socket position\n", sockfd, i);
-                    current_user->sockets_fd[i] = -1;
-                    break;
-                }
-
-            UNLOCK(current_user->mutex);
-
-            // Tell server about this logout
-            NOTIFICATION *user_logout = (NOTIFICATION *)malloc(sizeof(NOTIFICATION));
-            user_logout->type = NOTIFICATION_TYPE__LOGOUT;
-            user_logout->command = LOGOUT;
-            strcpy(user_logout->author, current_user->username);
-            logger_info("Sending NOTIFICATION_TYPE__LOGOUT to server with username %s\n", user_logout->author);
-
-            send_server(user_logout);
-
-            return NULL;
+            logger_error("User couldn't login! Max connections (%d) reached\n", MAX_SESSIONS);
+            session_remove(sockfd);
+            return FALSE;
         }
-        else
-        {
-            logger_info("[Socket %d] Received message with type %d from client (%s), adding to processing queue\n", sockfd, notification.type, notification.message);
 
-            NOTIFICATION *notification_copy = (NOTIFICATION *)calloc(1, sizeof(NOTIFICATION));
-            memcpy(notification_copy, &notification, sizeof(NOTIFICATION));
+        connection->state = CONNECTION_STATE__LOGGED;
 
-            LOCK(MUTEX_MESSAGE_QUEUE);
-            chained_list_messages = chained_list_append_end(chained_list_messages, (void *)notification_copy);
-            UNLOCK(MUTEX_MESSAGE_QUEUE);
-        }
-    };
+        // Tell server that this guy logged in
+        NOTIFICATION *user_login = notification_pool_alloc();
+        user_login->type = NOTIFICATION_TYPE__LOGIN;
+        user_login->command = LOGIN;
+        strcpy(user_login->author, current_user->username);
+        logger_info("Sending NOTIFICATION_TYPE__LOGIN to server with username %s\n", user_login->author);
 
-    return NULL;
+        enqueue_server(user_login);
+
+        return TRUE;
+    }
+
+    logger_info("[Socket %d] Received message with type %d from client (%s), adding to processing queue\n", sockfd, notification->type, notification->message);
+
+    NOTIFICATION *notification_copy = notification_pool_duplicate(notification);
+
+    // Pages of the timeline only go back to the session which asked for them
+    if (notification_copy->type == NOTIFICATION_TYPE__TIMELINE)
+        notification_copy->data = sockfd;
+
+    enqueue_server(notification_copy);
+
+    return TRUE;
+}
+
+void session_add(CONNECTION *connection)
+{
+    LOCK(MUTEX_SESSIONS);
+    if (connection->sockfd >= sessions_capacity)
+    {
+        int new_capacity = 2 * (connection->sockfd + 1);
+        sessions = (CONNECTION **)realloc(sessions, new_capacity * sizeof(CONNECTION *));
+        memset(sessions + sessions_capacity, 0, (new_capacity - sessions_capacity) * sizeof(CONNECTION *));
+        sessions_capacity = new_capacity;
+    }
+
+    sessions[connection->sockfd] = connection;
+    UNLOCK(MUTEX_SESSIONS);
+}
+
+void session_remove(int sockfd)
+{
+    LOCK(MUTEX_SESSIONS);
+    if (sockfd < sessions_capacity)
+        sessions[sockfd] = NULL;
+    UNLOCK(MUTEX_SESSIONS);
+}
+
+// Writes to the session of `user` connected in `sockfd`, without blocking. The socket might have been
+// closed and given to someone else since it was read from the user, so its session must be of the user
+int session_write(USER *user, int sockfd, void *data, size_t length)
+{
+    CONNECTION *connection = NULL;
+
+    // The session is retained so that it can't be freed under us, and written without holding
+    // the lock, so that writes to other sessions and logins don't wait for this one
+    LOCK(MUTEX_SESSIONS);
+    if (sockfd < sessions_capacity && sessions[sockfd] != NULL && sessions[sockfd]->data == (void *)user)
+        connection = event_loop_retain(sessions[sockfd]);
+    UNLOCK(MUTEX_SESSIONS);
+
+    if (!connection)
+        return -1;
+
+    int status = event_loop_write(connection, data, length);
+    event_loop_release(connection);
+
+    return status;
+}
+
+// Writes a whole page of the timeline to the session of a user which asked for it, if it is still there
+void send_timeline_page(USER *user, int socket_fd, uint8_t *page, size_t length)
+{
+    int is_session = FALSE;
+
+    LOCK(user->mutex);
+    for (int i = 0; i < MAX_SESSIONS; i++)
+        if (user->sockets_fd[i] == socket_fd)
+            is_session = TRUE;
+    UNLOCK(user->mutex);
+
+    if (!is_session)
+        logger_warn("Session %d of %s is gone, dropping its timeline page\n", socket_fd, user->username);
+    else if (session_write(user, socket_fd, page, length) < 0)
+        logger_error("When sending timeline page to %s through socket %d\n", user->username, socket_fd);
+    else
+        logger_info("Sent timeline page of %zu bytes to %s on socket %d\n", length, user->username, socket_fd);
 }
 
 void send_server(NOTIFICATION *notification)
@@ -555,15 +709,15 @@ void send_server(NOTIFICATION *notification)
 
     do
     {
-        status = write(ring->primary_fd, notification, sizeof(NOTIFICATION));
+        status = protocol_write(ring->primary_fd, notification);
 
         if (status < 0)
         {
-            logger_info("Failed to send message %d to server. Will retry in a few...\n", notification->id);
+            logger_info("Failed to send message %llu to server. Will retry in a few...\n", (unsigned long long)notification->id);
             sleep(1);
         }
         else
-            logger_info("Sent %s (%d) message to server\n", notification->message, notification->id);
+            logger_info("Sent %s (%llu) message to server\n", notification->message, (unsigned long long)notification->id);
     } while (status < 0);
 }
 
@@ -585,11 +739,13 @@ void close_socket(void *void_socket)
 
 void cleanup(int exit_code)
 {
-    chained_list_iterate(chained_list_threads, &cancel_thread);
-    chained_list_iterate(chained_list_sockets_fd, &close_socket);
-    chained_list_free(chained_list_threads);
-    chained_list_free(chained_list_sockets_fd);
-    chained_list_free(chained_list_messages);
+    deque_iterate(&threads, &cancel_thread);
+    deque_clear(&threads);
+
+    // Closing every client session
+    for (int sockfd = 0; sockfd < sessions_capacity; sockfd++)
+        if (sessions[sockfd])
+            close_socket((void *)&sessions[sockfd]->sockfd);
 
     exit(exit_code);
 }
@@ -10,10 +10,13 @@
 #include <pthread.h>
 #include <signal.h>
 #include <assert.h>
+#include <stdatomic.h>
 
 #include "exit_errors.h"
 #include "logger.h"
 #include "notification.h"
+#include "protocol.h"
+#include "stream_buffer.h"
 #include "user.h"
 #include "hash.h"
 #include "ui.h"
@@ -23,6 +26,7 @@
 #define TRUE 1
 
 long long MESSAGE_GLOBAL_ID = 0;
+_Atomic uint64_t NEXT_TIMELINE_ID = 0; // Cursor of the next page of the timeline, 0 for the newest one
 
 pthread_t read_thread_tid = -1;
 int sockfd = -1;
@@ -128,7 +132,7 @@ int main(int argc, char *argv[])
         .type = NOTIFICATION_TYPE__LOGIN};
     strcpy(notification.author, user_handle);
 
-    bytes_read = write(sockfd, (void *)&notification, sizeof(NOTIFICATION));
+    bytes_read = protocol_write(sockfd, &notification);
     if (bytes_read < 0)
     {
         char *error_message = "Error when sending user handle";
@@ -141,9 +145,10 @@ int main(int argc, char *argv[])
         cleanup(ERROR_STARTING_CONNECTION);
     }
 
-    int can_login;
-    bytes_read = read(sockfd, (void *)&can_login, sizeof(can_login));
-    if (bytes_read < 0)
+    // Only this frame is read here, the ones after it are left for `handle_read`
+    NOTIFICATION login_ack;
+    bytes_read = protocol_read(sockfd, &login_ack);
+    if (bytes_read <= 0 || login_ack.type != NOTIFICATION_TYPE__LOGIN)
     {
         char *error_message = "Error when reading user login status";
         UI_MESSAGE *ui_error_message = (UI_MESSAGE *)calloc(1, sizeof(UI_MESSAGE));
@@ -154,7 +159,7 @@ int main(int argc, char *argv[])
 
         cleanup(ERROR_STARTING_CONNECTION);
     }
-    if (!can_login)
+    if (!login_ack.data)
     {
         char *error_message = (char *)calloc(60, sizeof(char));
         sprintf(error_message, "You cannot login. Max conections exceeded (%d)\n", MAX_SESSIONS);
@@ -179,7 +184,7 @@ int main(int argc, char *argv[])
         command = identify_command(buffer);
         if (command == UNKNOWN)
         {
-            char *info_message = "This message type is unknown! Please prepend the message with FOLLOW or SEND!";
+            char *info_message = "This message type is unknown! Please prepend the message with FOLLOW or SEND, or send TIMELINE!";
             UI_MESSAGE *ui_info_message = (UI_MESSAGE *)calloc(1, sizeof(UI_MESSAGE));
             ui_info_message->timestamp = time(NULL);
             ui_info_message->message = strdup(info_message);
@@ -198,8 +203,15 @@ int main(int argc, char *argv[])
         strcpy(notification.author, user_handle);
         strcpy(notification.message, buffer);
 
+        // Asks for the page after the last one we got, and the `id` carries its cursor
+        if (command == TIMELINE)
+        {
+            notification.type = NOTIFICATION_TYPE__TIMELINE;
+            notification.id = NEXT_TIMELINE_ID;
+        }
+
         /* write in the socket */
-        bytes_read = write(sockfd, (void *)&notification, sizeof(NOTIFICATION));
+        bytes_read = protocol_write(sockfd, &notification);
         if (bytes_read < 0)
         {
             char *error_message = "Error when writing to server";
@@ -218,13 +230,12 @@ void *handle_read(void *void_sockfd)
 {
     NOTIFICATION notification;
     int bytes_read, sockfd = *((int *)void_sockfd);
+    STREAM_BUFFER *buffer = stream_buffer_create(CLIENT_READ_BUFFER_SIZE);
 
     while (1)
     {
-        bzero((void *)&notification, sizeof(NOTIFICATION));
-
-        /* read from the socket */
-        bytes_read = read(sockfd, (void *)&notification, sizeof(NOTIFICATION));
+        /* read from the socket, only when there isn't a notification already buffered */
+        bytes_read = stream_buffer_read(buffer, sockfd, &notification);
         if (bytes_read < 0)
         {
             char *error_message = "Error when receiving message from the server";
@@ -264,6 +275,20 @@ void *handle_read(void *void_sockfd)
             {
                 ui_message->type = UI_MESSAGE_TYPE__INFO;
             }
+            else if (notification.type == NOTIFICATION_TYPE__TIMELINE && notification.command == TIMELINE)
+            {
+                // The end of a page, with the cursor of the next one
+                NEXT_TIMELINE_ID = notification.id;
+
+                free(ui_message->message);
+                ui_message->message = strdup(notification.id ? "Send TIMELINE again for older messages" : "There are no older messages. TIMELINE starts from the newest ones again");
+                ui_message->type = UI_MESSAGE_TYPE__INFO;
+            }
+            else if (notification.type == NOTIFICATION_TYPE__TIMELINE)
+            {
+                ui_message->author = strdup(notification.author);
+                ui_message->type = UI_MESSAGE_TYPE__MESSAGE;
+            }
 
             UI_add_new_message(ui_message);
         }
@@ -278,6 +303,8 @@ COMMAND identify_command(char *message)
         return SEND;
     if (strncmp(message, "FOLLOW ", NUMBER_OF_CHARS_IN_FOLLOW) == 0)
         return FOLLOW;
+    if (strncmp(message, "TIMELINE", NUMBER_OF_CHARS_IN_TIMELINE) == 0)
+        return TIMELINE;
 
     return UNKNOWN;
 }
@@ -288,6 +315,8 @@ char *remove_command_from_message(int command, char *message)
         message = message + NUMBER_OF_CHARS_IN_FOLLOW;
     else if (command == SEND)
         message = message + NUMBER_OF_CHARS_IN_SEND;
+    else if (command == TIMELINE)
+        message = message + NUMBER_OF_CHARS_IN_TIMELINE;
 
     return message;
 }
@@ -5,7 +5,7 @@
 #include <time.h>
 
 #include "ui.h"
-#include "chained_list.h"
+#include "deque.h"
 
 typedef struct
 {
@@ -32,7 +32,7 @@ WINDOW *chatbox = NULL, *timeline = NULL;
 
 pthread_t update_timeline_tid = -1;
 
-CHAINED_LIST *messages_list = NULL;
+DEQUE messages_list; // Newest message first
 
 pthread_mutex_t SYNC_MUTEX = PTHREAD_MUTEX_INITIALIZER;     /* mutex for sync display */
 pthread_mutex_t MESSAGES_MUTEX = PTHREAD_MUTEX_INITIALIZER; /* mutex for messages list */
@@ -125,7 +125,7 @@ char *UI_get_text(unsigned int max_size)
 void UI_add_new_message(UI_MESSAGE *ui_message)
 {
     LOCK_MESSAGES_LIST;
-    messages_list = chained_list_append_start(messages_list, (void *)ui_message);
+    deque_push_front(&messages_list, (void *)ui_message);
     UNLOCK_MESSAGES_LIST;
 }
 
@@ -133,7 +133,7 @@ void UI_add_new_message(UI_MESSAGE *ui_message)
 
 void update_timeline(void *_arg)
 {
-    CHAINED_LIST *old_messages_list = NULL;
+    size_t old_messages_size = 0;
     struct timespec sleep_config = {
         .tv_sec = 0,
         .tv_nsec = 5000000, // 5ms
@@ -144,7 +144,7 @@ void update_timeline(void *_arg)
         nanosleep(&sleep_config, &sleep_config);
 
         LOCK_MESSAGES_LIST;
-        if (old_messages_list == messages_list)
+        if (old_messages_size == messages_list.size)
         {
             UNLOCK_MESSAGES_LIST;
             continue;
@@ -154,7 +154,7 @@ void update_timeline(void *_arg)
         clear_timeline();
 
         LOCK_SCREEN;
-        CHAINED_LIST *message = messages_list;
+        DEQUE_NODE *message = messages_list.head;
         int lines_left = CHATBOX_START_Y - 3;
         while (lines_left > 5 && message) // Give us some space in the last one
         {
@@ -184,7 +184,7 @@ void update_timeline(void *_arg)
         wrefresh(timeline);
         UNLOCK_SCREEN;
 
-        old_messages_list = messages_list;
+        old_messages_size = messages_list.size;
         UNLOCK_MESSAGES_LIST;
 
         wrefresh(timeline);
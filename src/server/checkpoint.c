@@ -0,0 +1,146 @@
+#include "checkpoint.h"
+
+#include "config.h"
+#include "logger.h"
+#include "savefile.h"
+#include "timeline.h"
+#include "wal.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOCK(mutex) pthread_mutex_lock(&mutex)
+#define UNLOCK(mutex) pthread_mutex_unlock(&mutex)
+
+pthread_t checkpoint_tid;
+int checkpoint_started = 0;
+int checkpoint_stopping = 0; // Guarded by MUTEX_CHECKPOINT, and signaled through `checkpoint_wake`
+pthread_mutex_t MUTEX_CHECKPOINT = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t checkpoint_wake = PTHREAD_COND_INITIALIZER;
+
+void *checkpoint_thread(void *);
+long checkpoint_elapsed_usec(struct timespec *);
+
+/// Starts the thread which runs a checkpoint every CHECKPOINT_INTERVAL_SECONDS, once the
+/// WAL has grown enough since the last one, and the maintenance of the timeline store
+///
+/// @param directory USER_DIRECTORY* to be saved
+void checkpoint_start(USER_DIRECTORY *directory)
+{
+    pthread_create(&checkpoint_tid, NULL, &checkpoint_thread, (void *)directory);
+    checkpoint_started = 1;
+}
+
+/// Stops the checkpoint thread, waiting for the checkpoint or maintenance it is running to finish,
+/// so that the caller can save everything without racing with it
+void checkpoint_stop(void)
+{
+    if (!checkpoint_started)
+        return;
+
+    LOCK(MUTEX_CHECKPOINT);
+    checkpoint_stopping = 1;
+    pthread_cond_signal(&checkpoint_wake);
+    UNLOCK(MUTEX_CHECKPOINT);
+
+    pthread_join(checkpoint_tid, NULL);
+    checkpoint_started = 0;
+}
+
+/// Saves a consistent point of the users and inboxes, and removes the WAL records before it.
+///
+/// The WAL is rotated first, so every change from now on is in the new file. Then the inbox of every
+/// user is logged again in it, which replaces what the rotated file had for them, and the users and
+/// follows are saved, having at least everything the rotated file had. Once both are on disk, the
+/// rotated file isn't needed anymore. If anything fails, it stays, and is replayed as usual
+///
+/// @param directory USER_DIRECTORY* to be saved
+///
+/// @returns 0 if the checkpoint finished, -1 otherwise
+int checkpoint_run(USER_DIRECTORY *directory)
+{
+    struct timespec start, user_start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // A rotated file left by a failed checkpoint is removed by this one instead
+    long wal_paused_usec;
+    wal_rotate(&wal_paused_usec);
+
+    long longest_user_pause_usec = 0;
+    uint32_t last_id = user_directory_last_id(directory);
+    for (uint32_t id = 1; id <= last_id; id++)
+    {
+        USER *user = user_directory_get(directory, id);
+        if (!user)
+            continue;
+
+        clock_gettime(CLOCK_MONOTONIC, &user_start);
+        LOCK(user->mutex);
+        wal_log_inbox(user);
+        UNLOCK(user->mutex);
+
+        long user_pause_usec = checkpoint_elapsed_usec(&user_start);
+        if (user_pause_usec > longest_user_pause_usec)
+            longest_user_pause_usec = user_pause_usec;
+    }
+
+    if (save_savefile(directory) < 0)
+    {
+        logger_error("Checkpoint failed when saving the users, keeping the rotated WAL\n");
+        return -1;
+    }
+
+    // The inboxes logged above must be on disk before the rotated file goes away
+    wal_sync();
+    wal_remove_rotated();
+    timeline_sync();
+
+    logger_info("Checkpoint of %u users took %ld ms. Logging paused for %ld us, and a user for at most %ld us\n",
+                last_id, checkpoint_elapsed_usec(&start) / 1000, wal_paused_usec, longest_user_pause_usec);
+    return 0;
+}
+
+void *checkpoint_thread(void *void_directory)
+{
+    USER_DIRECTORY *directory = (USER_DIRECTORY *)void_directory;
+    uint64_t checkpoint_length = wal_length();
+
+    while (1)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += CHECKPOINT_INTERVAL_SECONDS;
+
+        LOCK(MUTEX_CHECKPOINT);
+        while (!checkpoint_stopping && pthread_cond_timedwait(&checkpoint_wake, &MUTEX_CHECKPOINT, &deadline) == 0)
+        {
+        }
+        int stopping = checkpoint_stopping;
+        UNLOCK(MUTEX_CHECKPOINT);
+
+        if (stopping)
+            break;
+
+        // Old posts are removed on every interval, even when the WAL didn't grow
+        timeline_maintain(directory);
+
+        uint64_t length = wal_length();
+        if (length < checkpoint_length + CHECKPOINT_MIN_WAL_GROWTH)
+            continue;
+
+        if (checkpoint_run(directory) == 0)
+            checkpoint_length = wal_length();
+    }
+
+    return NULL;
+}
+
+long checkpoint_elapsed_usec(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start->tv_sec) * 1000000L + (now.tv_nsec - start->tv_nsec) / 1000;
+}
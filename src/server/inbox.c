@@ -0,0 +1,295 @@
+#include "inbox.h"
+
+#include "exit_errors.h"
+#include "logger.h"
+#include "protocol.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+char inbox_directory[64];
+
+void inbox_segment_path(USER *, char *, size_t);
+void inbox_read_segment(int, uint32_t, char *, void (*)(NOTIFICATION *, void *), void *);
+
+/// Chooses the directory of the segments of this server, creating it if needed. Segments left
+/// by an older run are removed, as the pending messages are recovered from the WAL instead
+///
+/// @param server_index Index of this server in the ring
+void inbox_open_directory(int server_index)
+{
+    snprintf(inbox_directory, sizeof(inbox_directory), "%s-%d", INBOX_DIRECTORY_PATH, server_index);
+
+    if (mkdir(inbox_directory, 0700) < 0 && errno != EEXIST)
+    {
+        logger_error("When creating the inbox directory %s: %d\n", inbox_directory, errno);
+        exit(ERROR_OPENING_INBOX);
+    }
+
+    DIR *directory = opendir(inbox_directory);
+    if (!directory)
+    {
+        logger_error("When opening the inbox directory %s: %d\n", inbox_directory, errno);
+        exit(ERROR_OPENING_INBOX);
+    }
+
+    struct dirent *entry;
+    char path[sizeof(inbox_directory) + 256];
+    while ((entry = readdir(directory)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", inbox_directory, entry->d_name);
+        unlink(path);
+    }
+    closedir(directory);
+
+    logger_info("Spilling offline inboxes to %s\n", inbox_directory);
+}
+
+/// Adds a message to the end of the inbox of a user. Spilling the oldest ones to disk is left
+/// to the caller, so that it does not happen while the user's mutex is held
+///
+/// @param user USER* who will receive the message
+/// @param message MESSAGE* to be delivered, whose reference is now owned by the inbox
+///
+/// @returns 1 if there are too many messages in memory, and `inbox_spill` must be called once the user's mutex is released, or 0 otherwise
+int inbox_push(USER *user, MESSAGE *message)
+{
+    deque_push_back(&user->pending_messages, (void *)message);
+
+    return user->pending_messages.size > INBOX_MEMORY_LIMIT;
+}
+
+/// Walks every message of an inbox, from the oldest to the newest, without removing them
+///
+/// @param user USER* whose inbox will be walked
+/// @param function Called with every message, as a NOTIFICATION to the user which is only valid during the call
+/// @param arg Passed along to [function]
+void inbox_iterate(USER *user, void (*function)(NOTIFICATION *, void *), void *arg)
+{
+    NOTIFICATION notification;
+
+    if (user->spilled_messages > 0)
+    {
+        char path[sizeof(inbox_directory) + 16];
+        inbox_segment_path(user, path, sizeof(path));
+
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            logger_error("When opening the inbox segment of %s: %d\n", user->username, errno);
+        else
+        {
+            inbox_read_segment(fd, user->spilled_messages, user->username, function, arg);
+            close(fd);
+        }
+    }
+
+    for (DEQUE_NODE *node = user->pending_messages.head; node; node = node->next)
+    {
+        message_to_notification((MESSAGE *)node->val, user->username, &notification);
+        function(&notification, arg);
+    }
+}
+
+/// Removes every message of an inbox, once they were delivered
+///
+/// @param user USER* whose inbox will be emptied
+void inbox_clear(USER *user)
+{
+    user->inbox_generation++;
+
+    for (MESSAGE *message; (message = (MESSAGE *)deque_pop_front(&user->pending_messages)) != NULL;)
+        message_release(message);
+
+    if (user->spilled_messages > 0)
+    {
+        char path[sizeof(inbox_directory) + 16];
+        inbox_segment_path(user, path, sizeof(path));
+
+        unlink(path);
+        user->spilled_messages = 0;
+    }
+}
+
+/// Copies an inbox, so that it can be walked with `inbox_copy_iterate` after the user's mutex is
+/// released. Only references to the messages in memory are taken, and the segment is opened but not
+/// read, as what it has counted is never changed until a clear, which unlinks it
+///
+/// @param user USER* whose inbox will be copied, with its mutex held
+/// @param copy INBOX_COPY* to be filled, which must be freed with `inbox_copy_free`
+void inbox_copy(USER *user, INBOX_COPY *copy)
+{
+    strcpy(copy->receiver, user->username);
+    copy->segment_fd = -1;
+    copy->spilled_messages = 0;
+
+    if (user->spilled_messages > 0)
+    {
+        char path[sizeof(inbox_directory) + 16];
+        inbox_segment_path(user, path, sizeof(path));
+
+        if ((copy->segment_fd = open(path, O_RDONLY)) < 0)
+            logger_error("When opening the inbox segment of %s: %d\n", user->username, errno);
+        else
+            copy->spilled_messages = user->spilled_messages;
+    }
+
+    copy->messages = (MESSAGE **)malloc((user->pending_messages.size + 1) * sizeof(MESSAGE *));
+    copy->length = 0;
+    for (DEQUE_NODE *node = user->pending_messages.head; node; node = node->next)
+        copy->messages[copy->length++] = message_retain((MESSAGE *)node->val);
+}
+
+/// Walks every message of a copied inbox, from the oldest to the newest, like `inbox_iterate`
+///
+/// @param copy INBOX_COPY* filled by `inbox_copy`
+/// @param function Called with every message, as a NOTIFICATION to the user which is only valid during the call
+/// @param arg Passed along to [function]
+void inbox_copy_iterate(INBOX_COPY *copy, void (*function)(NOTIFICATION *, void *), void *arg)
+{
+    NOTIFICATION notification;
+
+    if (copy->segment_fd >= 0)
+        inbox_read_segment(copy->segment_fd, copy->spilled_messages, copy->receiver, function, arg);
+
+    for (uint32_t message_idx = 0; message_idx < copy->length; message_idx++)
+    {
+        message_to_notification(copy->messages[message_idx], copy->receiver, &notification);
+        function(&notification, arg);
+    }
+}
+
+/// Releases the messages and the segment of a copied inbox
+///
+/// @param copy INBOX_COPY* filled by `inbox_copy`
+void inbox_copy_free(INBOX_COPY *copy)
+{
+    if (copy->segment_fd >= 0)
+        close(copy->segment_fd);
+
+    for (uint32_t message_idx = 0; message_idx < copy->length; message_idx++)
+        message_release(copy->messages[message_idx]);
+    free(copy->messages);
+}
+
+// Streams the first `frames` frames of a segment in big reads, keeping the incomplete one at the end
+// for the next read. A spill might be appending to it, so we stop at the frames it already counted
+void inbox_read_segment(int fd, uint32_t frames, char *receiver, void (*function)(NOTIFICATION *, void *), void *arg)
+{
+    NOTIFICATION notification;
+    uint8_t *buffer = (uint8_t *)malloc(INBOX_READ_BUFFER_SIZE);
+    size_t length = 0;
+    ssize_t bytes_read;
+    uint32_t frames_read = 0;
+
+    lseek(fd, 0, SEEK_SET);
+    while (frames_read < frames && (bytes_read = read(fd, buffer + length, INBOX_READ_BUFFER_SIZE - length)) > 0)
+    {
+        length += bytes_read;
+
+        size_t offset = 0;
+        int frame_length = 0;
+        while (frames_read < frames && (frame_length = protocol_decode(buffer + offset, length - offset, &notification)) > 0)
+        {
+            function(&notification, arg);
+            offset += frame_length;
+            frames_read++;
+        }
+        if (frame_length < 0)
+            break;
+
+        length -= offset;
+        memmove(buffer, buffer + offset, length);
+    }
+
+    if (frames_read != frames)
+        logger_error("Inbox segment of %s had %u of its %u messages\n", receiver, frames_read, frames);
+
+    free(buffer);
+}
+
+void inbox_segment_path(USER *user, char *path, size_t size)
+{
+    snprintf(path, size, "%s/%u", inbox_directory, user->id);
+}
+
+/// Appends the oldest messages in memory to the segment with a single write, if there are still
+/// too many of them. Everything in the segment is older than what is in memory, so the order is kept.
+/// The messages are only encoded under the user's mutex, and stay in memory until the write is done,
+/// so the inbox can be walked or cleared meanwhile. If the write fails, they stay in memory
+///
+/// @param user USER* whose inbox will be spilled, without its mutex held
+void inbox_spill(USER *user)
+{
+    pthread_mutex_lock(&user->spill_mutex);
+    pthread_mutex_lock(&user->mutex);
+
+    if (user->pending_messages.size <= INBOX_MEMORY_LIMIT)
+    {
+        pthread_mutex_unlock(&user->mutex);
+        pthread_mutex_unlock(&user->spill_mutex);
+        return;
+    }
+
+    uint8_t *buffer = (uint8_t *)malloc(INBOX_SPILL_BATCH * PROTOCOL_MAX_FRAME_SIZE);
+    size_t length = 0;
+    int messages = 0;
+
+    NOTIFICATION notification;
+    for (DEQUE_NODE *node = user->pending_messages.head; node && messages < INBOX_SPILL_BATCH; node = node->next, messages++)
+    {
+        message_to_notification((MESSAGE *)node->val, user->username, &notification);
+        length += protocol_encode(&notification, buffer + length);
+    }
+    uint32_t generation = user->inbox_generation;
+
+    pthread_mutex_unlock(&user->mutex);
+
+    char path[sizeof(inbox_directory) + 16];
+    inbox_segment_path(user, path, sizeof(path));
+
+    int written = 1;
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    off_t segment_length = fd < 0 ? -1 : lseek(fd, 0, SEEK_END);
+    if (segment_length < 0 || write(fd, buffer, length) != (ssize_t)length)
+    {
+        logger_error("When spilling %d messages of %s to %s: %d\n", messages, user->username, path, errno);
+
+        // A partial write would leave a broken frame behind, so we drop what was appended
+        if (segment_length >= 0 && ftruncate(fd, segment_length) < 0)
+            logger_error("When truncating %s back to %lld bytes: %d\n", path, (long long)segment_length, errno);
+        written = 0;
+    }
+
+    if (fd >= 0)
+        close(fd);
+    free(buffer);
+
+    pthread_mutex_lock(&user->mutex);
+
+    if (user->inbox_generation != generation)
+    {
+        // The inbox was delivered while we wrote, so what we appended is stale. No other spill
+        // could have written to the segment since, as we hold the spill mutex
+        unlink(path);
+    }
+    else if (written)
+    {
+        for (int message_idx = 0; message_idx < messages; message_idx++)
+            message_release((MESSAGE *)deque_pop_front(&user->pending_messages));
+        user->spilled_messages += messages;
+
+        logger_debug("Spilled %d messages of %s to disk, %u are there now\n", messages, user->username, user->spilled_messages);
+    }
+
+    pthread_mutex_unlock(&user->mutex);
+    pthread_mutex_unlock(&user->spill_mutex);
+}
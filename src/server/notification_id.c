@@ -0,0 +1,92 @@
+#include "notification_id.h"
+
+#include "logger.h"
+
+#include <stdatomic.h>
+#include <time.h>
+
+#define NOTIFICATION_ID_MASK(bits) ((1ULL << (bits)) - 1)
+
+static uint64_t node = 0;
+static atomic_uint next_thread = 0;
+
+// Biggest clock seen in an ID from another server. Threads only read it when their own clock
+// is behind it, and it only moves forward
+static atomic_uint_fast64_t observed_clock = 0;
+
+static _Thread_local int thread_slot = -1;
+static _Thread_local uint64_t thread_clock = 0;
+static _Thread_local uint64_t thread_sequence = 0;
+
+uint64_t notification_id_now(void);
+
+/// Sets the node of this server, which goes in every ID it gives
+///
+/// @param node_index Index of this server in the ring
+void notification_id_init(int node_index)
+{
+    node = (uint64_t)node_index & NOTIFICATION_ID_MASK(NOTIFICATION_ID_NODE_BITS);
+}
+
+/// Gives the next ID of the calling thread, bigger than every ID it gave or observed before
+///
+/// @returns A new notification ID, never 0
+uint64_t notification_id_next(void)
+{
+    if (thread_slot < 0)
+    {
+        unsigned int slot = atomic_fetch_add(&next_thread, 1);
+        if (slot > NOTIFICATION_ID_MASK(NOTIFICATION_ID_THREAD_BITS))
+            logger_warn("More than %d threads giving notification IDs, their IDs may collide\n", 1 << NOTIFICATION_ID_THREAD_BITS);
+
+        thread_slot = slot & NOTIFICATION_ID_MASK(NOTIFICATION_ID_THREAD_BITS);
+    }
+
+    uint64_t clock = notification_id_now();
+    uint64_t observed = atomic_load_explicit(&observed_clock, memory_order_relaxed);
+    if (observed > clock)
+        clock = observed;
+
+    if (clock > thread_clock)
+    {
+        thread_clock = clock;
+        thread_sequence = 0;
+    }
+    else if (++thread_sequence > NOTIFICATION_ID_MASK(NOTIFICATION_ID_SEQUENCE_BITS))
+    {
+        // Too many IDs in the same millisecond, so we borrow the next one
+        thread_clock++;
+        thread_sequence = 0;
+    }
+
+    return (thread_clock << NOTIFICATION_ID_CLOCK_SHIFT) |
+           (node << (NOTIFICATION_ID_THREAD_BITS + NOTIFICATION_ID_SEQUENCE_BITS)) |
+           ((uint64_t)thread_slot << NOTIFICATION_ID_SEQUENCE_BITS) |
+           thread_sequence;
+}
+
+/// Moves the clock past an ID given by another server
+///
+/// @param id Notification ID received, ignored if 0
+void notification_id_observe(uint64_t id)
+{
+    if (!id)
+        return;
+
+    uint64_t clock = id >> NOTIFICATION_ID_CLOCK_SHIFT;
+    uint64_t observed = atomic_load_explicit(&observed_clock, memory_order_relaxed);
+
+    // The sequence may be exhausted in the observed millisecond, so we start on the next one
+    while (clock >= observed && !atomic_compare_exchange_weak_explicit(&observed_clock, &observed, clock + 1, memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+// Milliseconds since NOTIFICATION_ID_EPOCH_MS, never 0
+uint64_t notification_id_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    uint64_t milliseconds = (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+    return milliseconds > NOTIFICATION_ID_EPOCH_MS ? milliseconds - NOTIFICATION_ID_EPOCH_MS : 1;
+}
@@ -0,0 +1,470 @@
+#include "replication.h"
+
+#include "logger.h"
+#include "notification_pool.h"
+#include "protocol.h"
+#include "socket.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#define LOCK(mutex) pthread_mutex_lock(&mutex)
+#define UNLOCK(mutex) pthread_mutex_unlock(&mutex)
+
+// Marks, while still queued, the frames which must not get an LSN (and so are not forwarded)
+#define REPLICATION_UNSEQUENCED UINT64_MAX
+
+void *replication_link_sender(void *);
+int replication_link_collect(REPLICATION_LINK *, NOTIFICATION **);
+void replication_link_sequence(REPLICATION_LINK *, NOTIFICATION **, int, int *);
+int replication_link_flush(REPLICATION_LINK *, NOTIFICATION **, int);
+int replication_link_write(REPLICATION_LINK *, uint8_t *, size_t);
+int replication_link_write_unacknowledged(REPLICATION_LINK *);
+int replication_link_stalled(REPLICATION_LINK *);
+int replication_link_connect(REPLICATION_LINK *);
+void replication_link_disconnect(REPLICATION_LINK *);
+void replication_link_push(REPLICATION_LINK *, NOTIFICATION *);
+uint64_t replication_link_elapsed_usec(struct timespec *);
+
+/// Creates a REPLICATION_LINK and starts its sender thread. It only connects when the first frame is sent
+///
+/// @param ring SERVER_RING* of this server
+/// @param acknowledged Called (on the primary) with every frame once all servers have received it
+///
+/// @returns A new pointer to a REPLICATION_LINK
+REPLICATION_LINK *replication_link_create(SERVER_RING *ring, void (*acknowledged)(NOTIFICATION *))
+{
+    REPLICATION_LINK *link = (REPLICATION_LINK *)calloc(1, sizeof(REPLICATION_LINK));
+    link->ring = ring;
+    link->sockfd = -1;
+    link->queue = mpsc_queue_create(REPLICATION_QUEUE_SIZE);
+    link->acknowledged = acknowledged;
+    link->applied_primary_idx = -1;
+    deque_init(&link->unacknowledged);
+    pthread_mutex_init(&link->MUTEX_UNACKNOWLEDGED, NULL);
+
+    pthread_create(&link->tid, NULL, &replication_link_sender, (void *)link);
+    pthread_detach(link->tid);
+
+    return link;
+}
+
+/// Queues a copy of a replication frame to be sent to the next server. Never blocks on the network,
+/// so it can be called from the event loops. On the primary the frame gets the next LSN when it
+/// is written, while backups forward it with the LSN it already has
+///
+/// @param link REPLICATION_LINK* to send through
+/// @param notification NOTIFICATION* to be replicated, copied before returning
+void replication_link_send(REPLICATION_LINK *link, NOTIFICATION *notification)
+{
+    replication_link_push(link, notification_pool_duplicate(notification));
+}
+
+/// Queues a copy of a frame which is not part of the replication log, so only the next server receives it
+///
+/// @param link REPLICATION_LINK* to send through
+/// @param notification NOTIFICATION* to be sent, copied before returning
+void replication_link_send_unsequenced(REPLICATION_LINK *link, NOTIFICATION *notification)
+{
+    NOTIFICATION *copy = notification_pool_duplicate(notification);
+    copy->lsn = REPLICATION_UNSEQUENCED;
+
+    replication_link_push(link, copy);
+}
+
+/// Checks the LSN of a frame received from the previous server, before it is applied
+///
+/// @param link REPLICATION_LINK* of this server
+/// @param notification NOTIFICATION* received
+///
+/// @returns 1 if the frame must be applied and forwarded, 0 if it was already applied before but must
+/// still be forwarded, as it may be a resend of a frame lost after us, or -1 if it must be dropped
+int replication_link_receive(REPLICATION_LINK *link, NOTIFICATION *notification)
+{
+    if (notification->lsn == 0)
+        return 1;
+
+    // A new primary starts its own sequence, so we can't compare it with the old one
+    if (link->applied_primary_idx != link->ring->primary_idx)
+    {
+        link->applied_primary_idx = link->ring->primary_idx;
+        link->applied_lsn = notification->lsn - 1;
+        link->applied_started = 1;
+    }
+
+    if (notification->lsn <= link->applied_lsn)
+    {
+        logger_debug("Replication frame %llu was already applied. Only forwarding it...\n", (unsigned long long)notification->lsn);
+        return 0;
+    }
+
+    // We joined after the start of the log, and the snapshot has everything before this one
+    if (!link->applied_started)
+    {
+        link->applied_started = 1;
+        link->applied_lsn = notification->lsn - 1;
+    }
+
+    // Forwarding it would let the next servers acknowledge the missing frames too, freeing them in the
+    // primary. So we wait for the primary to resend its log, which starts before them
+    if (notification->lsn != link->applied_lsn + 1)
+    {
+        logger_warn("Replication log gap: expected frame %llu but received %llu. Dropping it until the missing ones are resent\n", (unsigned long long)link->applied_lsn + 1, (unsigned long long)notification->lsn);
+        return -1;
+    }
+
+    link->applied_lsn = notification->lsn;
+
+    return 1;
+}
+
+/// Handles a cumulative acknowledgement from the last server before the primary, completing
+/// every frame up to `lsn`
+///
+/// @param link REPLICATION_LINK* of the primary
+/// @param lsn Last LSN received by every server
+void replication_link_acknowledge(REPLICATION_LINK *link, uint64_t lsn)
+{
+    DEQUE acknowledged;
+    deque_init(&acknowledged);
+
+    LOCK(link->MUTEX_UNACKNOWLEDGED);
+    if (lsn > link->acknowledged_lsn)
+    {
+        link->acknowledged_lsn = lsn;
+        clock_gettime(CLOCK_MONOTONIC, &link->progressed_at);
+    }
+
+    // Detach the acknowledged frames, which are always at the start
+    while (link->unacknowledged.head && ((NOTIFICATION *)link->unacknowledged.head->val)->lsn <= lsn)
+        deque_push_back(&acknowledged, deque_pop_front(&link->unacknowledged));
+    UNLOCK(link->MUTEX_UNACKNOWLEDGED);
+
+    int frames = 0;
+    for (NOTIFICATION *notification; (notification = (NOTIFICATION *)deque_pop_front(&acknowledged)) != NULL; frames++)
+    {
+        link->acknowledged(notification);
+        notification_pool_free(notification);
+    }
+
+    logger_debug("Replication acknowledged up to frame %llu, completing %d frames\n", (unsigned long long)lsn, frames);
+}
+
+/// Finds up to which LSN the state of this server goes, for a snapshot of it.
+/// Frames sequenced later may already be in the snapshot too, which backups find with the
+/// replication sequence of their user
+///
+/// @param link REPLICATION_LINK* of the primary
+///
+/// @returns Last LSN applied to the state of this server
+uint64_t replication_link_snapshot_lsn(REPLICATION_LINK *link)
+{
+    LOCK(link->MUTEX_UNACKNOWLEDGED);
+    uint64_t lsn = link->last_lsn > link->applied_lsn ? link->last_lsn : link->applied_lsn;
+    UNLOCK(link->MUTEX_UNACKNOWLEDGED);
+
+    return lsn;
+}
+
+/// Makes a backup continue the log of the current primary from a snapshot, so that
+/// the frames already in it are ignored when they arrive
+///
+/// @param link REPLICATION_LINK* of the backup
+/// @param lsn LSN of the snapshot loaded
+void replication_link_start_at(REPLICATION_LINK *link, uint64_t lsn)
+{
+    link->applied_primary_idx = link->ring->primary_idx;
+    link->applied_lsn = lsn;
+    link->applied_started = 0;
+}
+
+/// Tells the link, and every server after it, that a server joined the ring, so that they
+/// look for their next server again after everything already queued is sent
+///
+/// @param link REPLICATION_LINK* of this server
+void replication_link_ring_changed(REPLICATION_LINK *link)
+{
+    NOTIFICATION notification = {.type = NOTIFICATION_TYPE__RING_CHANGED};
+    replication_link_send_unsequenced(link, &notification);
+}
+
+void replication_link_push(REPLICATION_LINK *link, NOTIFICATION *notification)
+{
+    if (mpsc_queue_push(link->queue, (void *)notification) == 0)
+        return;
+
+    logger_warn("Replication queue is full, waiting for the next server to catch up...\n");
+    while (mpsc_queue_push(link->queue, (void *)notification) < 0)
+        usleep(100);
+}
+
+void *replication_link_sender(void *void_link)
+{
+    REPLICATION_LINK *link = (REPLICATION_LINK *)void_link;
+    NOTIFICATION *batch[REPLICATION_BATCH_SIZE];
+    int logged[REPLICATION_BATCH_SIZE];
+
+    while (1)
+    {
+        int batch_size = replication_link_collect(link, batch);
+        int ring_changed = 0;
+
+        // Nothing new to send, but the log may have to be resent
+        if (batch_size == 0 && !replication_link_stalled(link))
+            continue;
+
+        // The next server depends on who is the primary
+        if (link->sockfd != -1 && link->primary_idx != link->ring->primary_idx)
+        {
+            logger_info("Primary changed, reconnecting the replication link\n");
+            replication_link_disconnect(link);
+        }
+
+        replication_link_sequence(link, batch, batch_size, logged);
+
+        // Frames in the log may be freed as soon as they are acknowledged, so we must not look at them after flushing
+        for (int batch_idx = 0; batch_idx < batch_size; batch_idx++)
+            if (batch[batch_idx]->type == NOTIFICATION_TYPE__RING_CHANGED)
+                ring_changed = 1;
+
+        // Retry once with a new connection, because the next server might have died
+        if (replication_link_flush(link, batch, batch_size) < 0)
+        {
+            replication_link_disconnect(link);
+            if (replication_link_flush(link, batch, batch_size) < 0)
+            {
+                logger_error("When replicating %d frames to the next server: %d\n", batch_size, errno);
+                replication_link_disconnect(link);
+            }
+        }
+
+        for (int batch_idx = 0; batch_idx < batch_size; batch_idx++)
+            if (!logged[batch_idx])
+                notification_pool_free(batch[batch_idx]);
+
+        // Everything before this was sent through the old topology, now we look for our next server again
+        if (ring_changed)
+            replication_link_disconnect(link);
+    }
+
+    return NULL;
+}
+
+// Group commit: blocks for the first frame, and then waits a short window for others
+// to be written together with it. Returns how many frames were collected, which is 0 when
+// none came in REPLICATION_RESEND_MSEC, so that a stalled log is still noticed
+int replication_link_collect(REPLICATION_LINK *link, NOTIFICATION **batch)
+{
+    struct timespec start;
+    int batch_size = 0;
+
+    if ((batch[batch_size] = (NOTIFICATION *)mpsc_queue_pop_timeout(link->queue, REPLICATION_RESEND_MSEC)) == NULL)
+        return 0;
+
+    batch_size++;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (batch_size < REPLICATION_BATCH_SIZE)
+    {
+        if ((batch[batch_size] = (NOTIFICATION *)mpsc_queue_try_pop(link->queue)))
+            batch_size++;
+        else if (replication_link_elapsed_usec(&start) < REPLICATION_GROUP_COMMIT_USEC)
+            usleep(REPLICATION_GROUP_COMMIT_USEC / 10);
+        else
+            break;
+    }
+
+    return batch_size;
+}
+
+// Gives an LSN to every new frame when we are the primary, keeping them in the log until they are
+// acknowledged. `logged` tells which frames are owned by the log now
+void replication_link_sequence(REPLICATION_LINK *link, NOTIFICATION **batch, int batch_size, int *logged)
+{
+    // When we were a backup, the last LSN we applied is where our own sequence continues
+    if (link->last_lsn < link->applied_lsn)
+        link->last_lsn = link->applied_lsn;
+
+    for (int batch_idx = 0; batch_idx < batch_size; batch_idx++)
+    {
+        NOTIFICATION *notification = batch[batch_idx];
+        logged[batch_idx] = 0;
+
+        if (notification->lsn == REPLICATION_UNSEQUENCED)
+        {
+            notification->lsn = 0;
+            continue;
+        }
+        if (!link->ring->is_primary || notification->lsn != 0)
+            continue;
+
+        logged[batch_idx] = 1;
+
+        LOCK(link->MUTEX_UNACKNOWLEDGED);
+        notification->lsn = ++link->last_lsn;
+        if (link->unacknowledged.size == 0)
+            clock_gettime(CLOCK_MONOTONIC, &link->progressed_at);
+        deque_push_back(&link->unacknowledged, (void *)notification);
+        UNLOCK(link->MUTEX_UNACKNOWLEDGED);
+    }
+}
+
+// Writes a batch to the next server with a single syscall when possible, connecting first if needed.
+// The last server before the primary doesn't forward the frames, but acknowledges all of them at once.
+// Returns 0 on success (also when there is no other server), or -1 on errors
+int replication_link_flush(REPLICATION_LINK *link, NOTIFICATION **batch, int batch_size)
+{
+    uint8_t buffer[(REPLICATION_BATCH_SIZE + 1) * PROTOCOL_MAX_FRAME_SIZE];
+    uint64_t last_lsn = 0;
+    size_t length = 0;
+    int resend = 0;
+
+    for (int batch_idx = 0; batch_idx < batch_size; batch_idx++)
+        if (batch[batch_idx]->lsn > last_lsn)
+            last_lsn = batch[batch_idx]->lsn;
+
+    if (link->sockfd == -1)
+    {
+        if (replication_link_connect(link) < 0)
+        {
+            // Alone in the ring, so every server already has the whole log
+            if (link->ring->is_primary && link->last_lsn)
+                replication_link_acknowledge(link, link->last_lsn);
+
+            return 0;
+        }
+
+        // The primary starts every new connection with everything not acknowledged yet, as frames
+        // may have been lost with the old connection
+        resend = link->ring->is_primary;
+    }
+    else if (replication_link_stalled(link))
+    {
+        // A frame was lost further in the ring, and the servers after it are dropping the next ones
+        logger_warn("Replication log was not acknowledged for %d ms, resending it\n", REPLICATION_RESEND_MSEC);
+        resend = 1;
+    }
+
+    // The log includes the sequenced frames of this batch. Unsequenced ones (like RING_CHANGED)
+    // aren't in it, so they still go below
+    if (resend && replication_link_write_unacknowledged(link) < 0)
+        return -1;
+
+    int is_tail = !link->ring->is_primary && link->next_index == link->primary_idx;
+    for (int batch_idx = 0; batch_idx < batch_size; batch_idx++)
+        if ((!is_tail && !resend) || batch[batch_idx]->lsn == 0)
+            length += protocol_encode(batch[batch_idx], buffer + length);
+
+    if (is_tail && last_lsn)
+    {
+        NOTIFICATION ack = {.type = NOTIFICATION_TYPE__REPLICATION_ACK, .lsn = last_lsn};
+        length += protocol_encode(&ack, buffer + length);
+    }
+
+    return replication_link_write(link, buffer, length);
+}
+
+int replication_link_write(REPLICATION_LINK *link, uint8_t *buffer, size_t length)
+{
+    size_t bytes_wrote = 0;
+
+    while (bytes_wrote < length)
+    {
+        int status = send(link->sockfd, buffer + bytes_wrote, length - bytes_wrote, MSG_NOSIGNAL);
+        if (status < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        bytes_wrote += status;
+    }
+
+    return 0;
+}
+
+// Encodes the unacknowledged frames while holding the lock, but only writes them after releasing it,
+// so that acknowledgements are never blocked by the network
+int replication_link_write_unacknowledged(REPLICATION_LINK *link)
+{
+    size_t length = 0, capacity = REPLICATION_BATCH_SIZE * PROTOCOL_MAX_FRAME_SIZE;
+    uint8_t *buffer = (uint8_t *)malloc(capacity);
+    int frames = 0;
+
+    LOCK(link->MUTEX_UNACKNOWLEDGED);
+    for (DEQUE_NODE *node = link->unacknowledged.head; node; node = node->next, frames++)
+    {
+        if (capacity - length < PROTOCOL_MAX_FRAME_SIZE)
+        {
+            capacity *= 2;
+            buffer = (uint8_t *)realloc(buffer, capacity);
+        }
+
+        length += protocol_encode((NOTIFICATION *)node->val, buffer + length);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &link->progressed_at);
+    UNLOCK(link->MUTEX_UNACKNOWLEDGED);
+
+    logger_debug("Sending %d unacknowledged replication frames through the new link\n", frames);
+    int status = replication_link_write(link, buffer, length);
+    free(buffer);
+
+    return status;
+}
+
+// Tells if the primary waited too long for the oldest frame of the log to be acknowledged
+int replication_link_stalled(REPLICATION_LINK *link)
+{
+    if (!link->ring->is_primary)
+        return 0;
+
+    LOCK(link->MUTEX_UNACKNOWLEDGED);
+    int stalled = link->unacknowledged.size > 0 && replication_link_elapsed_usec(&link->progressed_at) >= REPLICATION_RESEND_MSEC * 1000;
+    UNLOCK(link->MUTEX_UNACKNOWLEDGED);
+
+    return stalled;
+}
+
+// Returns 0 when connected to the next server, or -1 if there is no other server in the ring
+int replication_link_connect(REPLICATION_LINK *link)
+{
+    int sockfd = socket_create();
+    server_ring_connect_with_next_server(link->ring, sockfd);
+
+    link->primary_idx = link->ring->primary_idx;
+    link->next_index = link->ring->next_index;
+
+    if (link->next_index == link->ring->self_index)
+    {
+        logger_debug("There is no other server to replicate to\n");
+        close(sockfd);
+        return -1;
+    }
+
+    logger_info("Replication link connected to port %d\n", link->ring->server_ring_ports[link->next_index]);
+    link->sockfd = sockfd;
+
+    return 0;
+}
+
+void replication_link_disconnect(REPLICATION_LINK *link)
+{
+    if (link->sockfd == -1)
+        return;
+
+    close(link->sockfd);
+    link->sockfd = -1;
+}
+
+uint64_t replication_link_elapsed_usec(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start->tv_sec) * 1000000 + (now.tv_nsec - start->tv_nsec) / 1000;
+}
@@ -1,111 +1,203 @@
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "logger.h"
 #include "user.h"
 #include "savefile.h"
 
-HASH_TABLE read_savefile()
+char savefile_path[64] = SAVEFILE_FILE_PATH;
+pthread_mutex_t MUTEX_SAVEFILE = PTHREAD_MUTEX_INITIALIZER; // Checkpoints and the cleanup share the temporary file
+
+int savefile_is_valid(SAVEFILE_HEADER *, size_t);
+
+// Servers may share a directory, so each one of them has its own savefile
+void savefile_open(int server_index)
+{
+    snprintf(savefile_path, sizeof(savefile_path), "%s-%d", SAVEFILE_FILE_PATH, server_index);
+}
+
+USER_DIRECTORY *read_savefile()
 {
-    FILE *savefile = fopen(SAVEFILE_FILE_PATH, "r");
-    if (!savefile) // File doesn't exist
+    int fd = open(savefile_path, O_RDONLY);
+    if (fd < 0) // File doesn't exist
     {
-        logger_warn("Savefile doesn't exist. Returning empty user hash\n");
-        return hash_init();
+        logger_warn("Savefile doesn't exist. Returning empty user directory\n");
+        return user_directory_create();
     }
 
-    fseek(savefile, 0, SEEK_END);
-    long size = ftell(savefile);
-    if (size == 0) // File is empty
+    struct stat status;
+    if (fstat(fd, &status) < 0 || status.st_size == 0) // File is empty
     {
-        logger_warn("Savefile existed but it was empty. Returning empty user hash\n");
-        return hash_init();
+        logger_warn("Savefile existed but it was empty. Returning empty user directory\n");
+        close(fd);
+        return user_directory_create();
     }
-    fseek(savefile, 0, SEEK_SET); // Go back to start
 
-    logger_debug("Savefile exists, reading from it!\n");
+    // Mapped instead of read, so the followers are copied straight from the page cache
+    size_t size = (size_t)status.st_size;
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        logger_error("When mapping %s: %d. Returning empty user directory\n", savefile_path, errno);
+        return user_directory_create();
+    }
+    madvise(mapping, size, MADV_SEQUENTIAL);
 
-    // It will break if we have more than 80 followers for this guy
-    int MAX_USERNAME_SIZE = MAX_USERNAME_LENGTH + 5,
-        MAX_FOLLOWERS_SIZE = MAX_USERNAME_SIZE * 80;
+    USER_DIRECTORY *directory = user_directory_create();
 
-    char *username = (char *)calloc(MAX_USERNAME_SIZE, sizeof(char)),
-         *followers = (char *)calloc(MAX_FOLLOWERS_SIZE, sizeof(char)),
-         *follower = (char *)calloc(MAX_USERNAME_SIZE, sizeof(char));
-    HASH_TABLE table = hash_init();
-    while (fgets(username, MAX_USERNAME_SIZE, savefile))
+    SAVEFILE_HEADER *header = (SAVEFILE_HEADER *)mapping;
+    if (!savefile_is_valid(header, size))
     {
-        // We are in the last line, so we finished it
-        if (username[0] == '\n')
-            break;
-
-        if (fgets(followers, MAX_FOLLOWERS_SIZE, savefile) == NULL)
-        {
-            logger_warn("Error reading followers list for %s\n", username);
-        };
+        logger_error("Savefile %s is invalid or from another version. Returning empty user directory\n", savefile_path);
+        munmap(mapping, size);
+        return directory;
+    }
 
-        // Remove \n
-        username[strcspn(username, "\n")] = 0;
-        followers[strcspn(followers, "\n")] = 0;
-        logger_debug("%s is followed by %s\n", username, followers);
+    SAVEFILE_USER *index = (SAVEFILE_USER *)((uint8_t *)mapping + header->index_offset);
+    uint32_t *followers = (uint32_t *)((uint8_t *)mapping + header->followers_offset);
 
-        USER *user = init_user();
+    for (uint32_t user_idx = 0; user_idx < header->users; user_idx++)
+    {
+        SAVEFILE_USER *saved_user = &index[user_idx];
+        if (saved_user->first_follower > header->followers || saved_user->followers > header->followers - saved_user->first_follower)
+        {
+            logger_warn("Followers of the user with ID %u are outside of the savefile, ignoring it\n", saved_user->id);
+            continue;
+        }
 
-        follower = strtok(followers, ",");
-        while (follower != NULL)
+        if (memchr(saved_user->username, '\0', sizeof(saved_user->username)) == NULL)
         {
-            user->followers = chained_list_append_end(user->followers, (void *)strdup(follower));
-            follower = strtok(NULL, ",");
+            logger_warn("Username of the user with ID %u doesn't end in the savefile, ignoring it\n", saved_user->id);
+            continue;
         }
 
-        strcpy(user->username, username);
+        USER *user = user_directory_intern(directory, saved_user->username, saved_user->id, NULL);
+        if (user == NULL)
+            continue;
 
-        hash_insert(table, strdup(username), (void *)user);
+        id_set_load(&user->followers, followers + saved_user->first_follower, saved_user->followers);
     }
 
-    // Remember to close the file
-    fclose(savefile);
+    logger_info("Savefile successfully loaded, with %u users and %llu follows\n", header->users, (unsigned long long)header->followers);
+    munmap(mapping, size);
 
-    logger_info("Savefile successfully loaded\n");
-    return table;
+    return directory;
 }
 
-void save_savefile(HASH_TABLE table)
+// Written to a temporary file which replaces the savefile at once, so a crash never leaves half of one.
+// Users are locked one at a time, so it can run while they are being changed. Returns -1 if it failed
+int save_savefile(USER_DIRECTORY *directory)
 {
-    if (!table)
-        return;
+    if (!directory)
+        return -1;
 
-    FILE *savefile = fopen(SAVEFILE_FILE_PATH, "w");
+    char temporary_path[sizeof(savefile_path) + 4];
+    snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", savefile_path);
+
+    pthread_mutex_lock(&MUTEX_SAVEFILE);
+    FILE *savefile = fopen(temporary_path, "w");
+    if (!savefile)
+    {
+        logger_error("When opening %s to save the users\n", temporary_path);
+        pthread_mutex_unlock(&MUTEX_SAVEFILE);
+        return -1;
+    }
+
+    SAVEFILE_HEADER header = {
+        .magic = SAVEFILE_MAGIC,
+        .version = SAVEFILE_VERSION,
+        .user_size = sizeof(SAVEFILE_USER),
+        .followers_offset = sizeof(SAVEFILE_HEADER),
+    };
+    fseek(savefile, sizeof(SAVEFILE_HEADER), SEEK_SET);
+
+    // Followers are streamed, and the index is kept until they are all written
+    uint32_t last_id = user_directory_last_id(directory);
+    SAVEFILE_USER *index = (SAVEFILE_USER *)calloc(last_id + 1, sizeof(SAVEFILE_USER));
+    uint32_t *followers = NULL;
+    uint32_t followers_capacity = 0;
 
-    int list_idx;
-    HASH_NODE *node;
     USER *user;
-    char *username;
-    CHAINED_LIST *follower_list;
-    for (int table_idx = 0; table_idx < HASH_SIZE; table_idx++)
+    for (uint32_t id = 1; id <= last_id; id++)
     {
-        for (node = table[table_idx], list_idx = 0; node; node = node->next, list_idx++)
+        if ((user = user_directory_get(directory, id)) == NULL)
+            continue;
+
+        // Copied while locked, and written after unlocking
+        uint32_t count = 0;
+        pthread_mutex_lock(&user->mutex);
+        if (user->followers.count > followers_capacity)
         {
-            user = (USER *)node->value;
+            followers_capacity = user->followers.count;
+            followers = (uint32_t *)realloc(followers, followers_capacity * sizeof(uint32_t));
+        }
+        for (uint32_t follower_idx = 0; follower_idx < user->followers.length; follower_idx++)
+            if (user->followers.ids[follower_idx] != ID_SET_EMPTY)
+                followers[count++] = user->followers.ids[follower_idx];
+        pthread_mutex_unlock(&user->mutex);
+
+        SAVEFILE_USER *saved_user = &index[header.users++];
+        saved_user->id = user->id;
+        saved_user->followers = count;
+        saved_user->first_follower = header.followers;
+        memcpy(saved_user->username, user->username, sizeof(saved_user->username));
+
+        fwrite(followers, sizeof(uint32_t), count, savefile);
+        header.followers += count;
+    }
+
+    header.index_offset = header.followers_offset + header.followers * sizeof(uint32_t);
+    if (header.index_offset % 8)
+    {
+        uint64_t padding = 0;
+        fwrite(&padding, 1, 8 - header.index_offset % 8, savefile);
+        header.index_offset += 8 - header.index_offset % 8;
+    }
+    fwrite(index, sizeof(SAVEFILE_USER), header.users, savefile);
 
-            username = node->key;
-            fprintf(savefile, "%s\n", username);
+    // The header goes last, once everything it points to was written
+    fseek(savefile, 0, SEEK_SET);
+    fwrite(&header, sizeof(SAVEFILE_HEADER), 1, savefile);
 
-            follower_list = user->followers;
-            while (follower_list)
-            {
-                fprintf(savefile, "%s,", (char *)follower_list->val);
-                follower_list = follower_list->next;
-            }
-            fprintf(savefile, "\n");
+    free(followers);
+    free(index);
 
-            logger_info("Saved user %s to savefile...\n", username);
-        }
+    int failed = ferror(savefile) || fflush(savefile) != 0 || fsync(fileno(savefile)) < 0;
+    if (fclose(savefile) != 0 || failed || rename(temporary_path, savefile_path) < 0)
+    {
+        logger_error("When saving the users to %s: %d\n", savefile_path, errno);
+        unlink(temporary_path);
+        pthread_mutex_unlock(&MUTEX_SAVEFILE);
+        return -1;
     }
+    pthread_mutex_unlock(&MUTEX_SAVEFILE);
 
-    // Remember to close file
-    fclose(savefile);
+    logger_info("Saved %u users and %llu follows to %s\n", header.users, (unsigned long long)header.followers, savefile_path);
+    return 0;
+}
+
+// Checks that the header is from this version, and everything it points to is inside the file
+int savefile_is_valid(SAVEFILE_HEADER *header, size_t size)
+{
+    if (size < sizeof(SAVEFILE_HEADER) || header->magic != SAVEFILE_MAGIC ||
+        header->version != SAVEFILE_VERSION || header->user_size != sizeof(SAVEFILE_USER))
+        return 0;
+
+    if (header->followers_offset != sizeof(SAVEFILE_HEADER) ||
+        header->followers > (size - header->followers_offset) / sizeof(uint32_t))
+        return 0;
+
+    return header->index_offset % 8 == 0 &&
+           header->index_offset >= header->followers_offset + header->followers * sizeof(uint32_t) &&
+           header->index_offset <= size &&
+           header->users <= (size - header->index_offset) / sizeof(SAVEFILE_USER);
 }
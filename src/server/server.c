@@ -11,17 +11,30 @@
 #include <assert.h>
 #include <errno.h>
 #include <netdb.h>
+#include <sys/eventfd.h>
 
-#include "chained_list.h"
+#include "deque.h"
+#include "message.h"
+#include "inbox.h"
+#include "notification_id.h"
 #include "exit_errors.h"
 #include "logger.h"
 #include "user.h"
 #include "hash.h"
+#include "user_directory.h"
 #include "notification.h"
+#include "protocol.h"
 #include "savefile.h"
+#include "wal.h"
+#include "checkpoint.h"
+#include "timeline.h"
 #include "server_ring.h"
+#include "replication.h"
+#include "snapshot.h"
 #include "socket.h"
 #include "front_end.h"
+#include "event_loop.h"
+#include "frame_batch.h"
 
 typedef int boolean;
 #define FALSE 0
@@ -29,12 +42,23 @@ typedef int boolean;
 
 extern int errno;
 
-static int received_sigint = FALSE;
+// Written by the SIGINT handler, which can't take any lock, so that the shutdown thread does the cleanup
+static int shutdown_eventfd = -1;
 
-void *handle_connection(void *);
+// States of a connection inside the event loop, based on the first notification received
+typedef enum
+{
+    CONNECTION_STATE__NEW,
+    CONNECTION_STATE__FE,
+    CONNECTION_STATE__KEEPALIVE,
+    CONNECTION_STATE__REPLICATION
+} CONNECTION_STATE;
+
+int handle_connection(CONNECTION *, NOTIFICATION *);
 void handle_connection_login(int, NOTIFICATION *);
 void handle_connection_leader_question(int);
-void handle_connection_keepalive(int, NOTIFICATION *);
+int handle_connection_keepalive(CONNECTION *, NOTIFICATION *);
+int handle_connection_replication(CONNECTION *, NOTIFICATION *);
 void handle_connection_election(NOTIFICATION *, int sockfd);
 void handle_connection_elected(NOTIFICATION *);
 void handle_connection_fe(int, NOTIFICATION *);
@@ -43,40 +67,42 @@ void cancel_thread(void *);
 void sigint_handler(int);
 void handle_signals(void);
 void *handle_eof(void *);
+void *handle_shutdown(void *);
 void cleanup(int);
-USER *login_user(char *);
-USER *logout_user(char *);
+USER *login_user(char *, uint32_t);
+USER *logout_user(NOTIFICATION *);
+int replication_sequence(USER *, NOTIFICATION *);
 void process_message(NOTIFICATION *, USER *);
 void receive_message(NOTIFICATION *, USER *);
 void follow_user(NOTIFICATION *, USER *);
-void print_username(void *);
 void send_message(NOTIFICATION *);
-void send_initial_replication(int);
+int send_to_fe(USER *, NOTIFICATION *);
+void send_timeline(NOTIFICATION *, USER *);
+int fan_out_message(MESSAGE *, USER *, FRAME_BATCH *);
+void *send_snapshot(void *);
+void request_snapshot(void);
 void send_replication(NOTIFICATION *);
 void handle_replication(NOTIFICATION *);
+void handle_replication_acknowledged(NOTIFICATION *);
 void handle_pending_notifications(USER *current_user, int sockfd, int send);
-void send_pending_notifications(USER *current_user, int sockfd);
+void send_pending_notification(NOTIFICATION *, void *);
 
-CHAINED_LIST *chained_list_sockets_fd = NULL;
-CHAINED_LIST *chained_list_threads = NULL;
-int sockfd = 0;
+DEQUE threads;
 
 SERVER_RING *server_ring = NULL;
 
-HASH_TABLE user_hash_table = NULL;
+REPLICATION_LINK *replication_link = NULL;
+
+USER_DIRECTORY *user_directory = NULL;
 
 int FE_SOCKFDS[NUMBER_OF_FES];
 
 // MUTEXES
-pthread_mutex_t MUTEX_LOGIN = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t MUTEX_FOLLOW = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t MUTEX_PENDING_NOTIFICATIONS = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t MUTEX_FE_SOCKFDS[NUMBER_OF_FES]; // Frames written to the same FE can't interleave
 
 #define LOCK(mutex) pthread_mutex_lock(&mutex)
 #define UNLOCK(mutex) pthread_mutex_unlock(&mutex)
 
-unsigned long long GLOBAL_NOTIFICATION_ID = 0;
-
 int main(int argc, char *argv[])
 {
 
@@ -84,50 +110,63 @@ int main(int argc, char *argv[])
 
     handle_signals();
 
-    user_hash_table = hash_init();
+    for (int fe_idx = 0; fe_idx < NUMBER_OF_FES; fe_idx++)
+        pthread_mutex_init(&MUTEX_FE_SOCKFDS[fe_idx], NULL);
 
     server_ring = server_ring_initialize();
     server_ring_connect(server_ring);
+    inbox_open_directory(server_ring->self_index);
+    notification_id_init(server_ring->self_index);
+    savefile_open(server_ring->self_index);
+    wal_open(server_ring->self_index);
 
-    socklen_t clilen = sizeof(struct sockaddr_in);
-    struct sockaddr_in cli_addr;
+    replication_link = replication_link_create(server_ring, &handle_replication_acknowledged);
 
-    // This loop is responsible for keeping accepting new connections from clients
-    while (1)
+    // The primary recovers its own state, and backups load the state of the primary before handling anything
+    if (server_ring->is_primary)
     {
-        int *newsockfd = (int *)malloc(sizeof(int));
-        *newsockfd = accept(server_ring->self_sockfd, (struct sockaddr *)&cli_addr, &clilen);
-
-        if (*newsockfd == -1)
-        {
-            logger_error("When accepting connection\n");
-            cleanup(ERROR_ACCEPT);
-        }
-
-        logger_info("New connection from %s:%d\n", inet_ntoa(cli_addr.sin_addr), cli_addr.sin_port);
+        user_directory = read_savefile();
+        wal_replay(user_directory);
+    }
+    else
+    {
+        user_directory = user_directory_create();
+        request_snapshot();
+        wal_reset(user_directory);
+    }
+    user_directory_link_following(user_directory);
+    timeline_open(server_ring->self_index, user_directory);
+    checkpoint_start(user_directory);
 
-        pthread_t *thread = (pthread_t *)malloc(sizeof(pthread_t));
-        pthread_create(thread, NULL, (void *(*)(void *)) & handle_connection, (void *)newsockfd);
-        logger_debug("Created new thread %ld to handle this connection\n", *thread);
+    // Every event loop accepts from the same listening socket, and handles the connections it accepted.
+    // The last one runs in this thread, and is responsible for keeping the server alive
+    for (int loop_idx = 0; loop_idx < SERVER_EVENT_LOOP_THREADS; loop_idx++)
+    {
+        EVENT_LOOP *loop = event_loop_create(server_ring->self_sockfd, &handle_connection);
+        if (loop_idx == SERVER_EVENT_LOOP_THREADS - 1)
+            event_loop_run(loop);
 
-        chained_list_sockets_fd = chained_list_append_end(chained_list_sockets_fd, (void *)newsockfd);
-        chained_list_threads = chained_list_append_end(chained_list_threads, (void *)thread);
+        event_loop_start(loop);
+        deque_push_back(&threads, (void *)&loop->tid);
     }
 
     // Assert that this is never reached
     assert(0);
 }
 
+// Runs in a normal thread, so the checkpoint thread is stopped first and we can take the same locks as it
 void cleanup(int exit_code)
 {
-    save_savefile(user_hash_table);
+    checkpoint_stop();
 
-    chained_list_iterate(chained_list_threads, &cancel_thread);
-    chained_list_iterate(chained_list_sockets_fd, &close_socket);
-    chained_list_free(chained_list_threads);
-    chained_list_free(chained_list_sockets_fd);
+    save_savefile(user_directory);
+    wal_sync();
+    timeline_sync();
 
-    close(sockfd);
+    deque_iterate(&threads, &cancel_thread);
+    deque_clear(&threads);
+
+    close(server_ring->self_sockfd);
 
     exit(exit_code);
 }
@@ -142,56 +181,64 @@ int get_free_socket_spot(int *sockets_fd)
     return -1;
 }
 
-USER *login_user(char *username)
+// Backups receive the `id` given by the primary, which gives the next one with USER_ID_NONE
+USER *login_user(char *username, uint32_t id)
 {
     logger_info("Attempting to log user: %s\n", username);
 
-    // Only one user can be logged in each time
-    LOCK(MUTEX_LOGIN);
+    int created;
+    USER *user = user_directory_intern(user_directory, username, id, &created);
+    if (user == NULL)
+        return NULL;
 
-    HASH_NODE *hash_node = hash_find(user_hash_table, username);
-    if (hash_node == NULL)
+    if (created)
     {
-        logger_info("User didn't existed, just created it\n");
-        USER *user = init_user();
-
-        strcpy(user->username, username);
-        user->sessions_number = 1;
-
-        hash_node = hash_insert(user_hash_table, username, (void *)user);
-        logger_debug("Created user on %p\n", hash_node);
-
-        // Need to unlock here because of early return
-        UNLOCK(MUTEX_LOGIN);
-
-        return user;
+        logger_info("User didn't existed, just created it with ID %u\n", user->id);
+        wal_log_login(user);
     }
-    UNLOCK(MUTEX_LOGIN);
-
-    // User already existed, will just increment the session number
-    USER *user = (USER *)hash_node->value;
-    user->sessions_number++;
 
     return user;
 }
 
-USER *logout_user(char *username)
+USER *logout_user(NOTIFICATION *notification)
 {
-    HASH_NODE *hash_node = hash_find(user_hash_table, username);
-    if (hash_node)
+    USER *user = user_directory_find(user_directory, notification->author);
+    if (!user)
+        return NULL;
+
+    LOCK(user->mutex);
+    if (replication_sequence(user, notification))
     {
-        USER *user = (USER *)hash_node->value;
         user->sessions_number--;
-
-        return user;
+        if (server_ring->is_primary)
+            send_replication(notification);
     }
+    UNLOCK(user->mutex);
 
-    return NULL;
+    return user;
 }
 
-void print_username(void *parameter)
+// Orders the replicated changes of a user, whose mutex must be held from the change until its frame
+// is queued, so that the sequences follow the order of the changes and snapshots see them the same way.
+// The primary gives the frame the next sequence of the user, and backups skip the frames whose
+// sequence they already have, as their snapshot may have had the change before the frame arrived.
+// Returns TRUE when the change must be applied
+int replication_sequence(USER *user, NOTIFICATION *notification)
 {
-    printf("%s", (char *)parameter);
+    if (server_ring->is_primary)
+    {
+        notification->sequence = ++user->replication_sequence;
+        return TRUE;
+    }
+
+    if (notification->sequence <= user->replication_sequence)
+    {
+        logger_debug("Change %llu of %s was already in our snapshot. Ignoring...\n", (unsigned long long)notification->sequence, user->username);
+        return FALSE;
+    }
+
+    user->replication_sequence = notification->sequence;
+    return TRUE;
 }
 
 void follow_user(NOTIFICATION *follow_notification, USER *current_user)
@@ -206,7 +253,7 @@ void follow_user(NOTIFICATION *follow_notification, USER *current_user)
 
         NOTIFICATION notification = {
             .command = (COMMAND)NULL,
-            .id = GLOBAL_NOTIFICATION_ID++,
+            .id = notification_id_next(),
             .timestamp = time(NULL),
             .message = "User tried following itself. This is not allowed.",
             .type = NOTIFICATION_TYPE__INFO};
@@ -214,82 +261,74 @@ void follow_user(NOTIFICATION *follow_notification, USER *current_user)
 
         send_message(&notification);
 
+        free(user_to_follow_username);
         return;
     }
 
-    // Only allow one follow to be processed at each given time
-    LOCK(MUTEX_FOLLOW);
+    // Replies are sent after unlocking, so that we never hold the mutexes of two users
+    char error_message[220] = "";
 
-    HASH_NODE *followed_user_node = hash_find(user_hash_table, user_to_follow_username);
-    if (followed_user_node == NULL)
-    {
-        char *error_message = (char *)calloc(220, sizeof(char));
+    USER *user = user_directory_find(user_directory, user_to_follow_username);
+    if (user == NULL)
         sprintf(error_message, "Could not follow the user %s. It doesn't exist\n", user_to_follow_username);
-
-        NOTIFICATION notification = {
-            .command = (COMMAND)NULL,
-            .id = GLOBAL_NOTIFICATION_ID++,
-            .timestamp = time(NULL),
-            .type = NOTIFICATION_TYPE__INFO};
-        strcpy(notification.receiver, current_user->username);
-        strcpy(notification.message, error_message);
-
-        send_message(&notification);
-
-        logger_error(error_message);
-    }
     else
     {
-        USER *user = (USER *)followed_user_node->value;
-        char *dup_current_user_username = strdup(current_user->username);
-
-        // Lock because we are possibly going to play around with follow list
+        // Followers only change while no fan-out of this user walks them. The user mutex
+        // is also held, because snapshots read them with it
+        LOCK(user->followers_mutex);
         LOCK(user->mutex);
 
-        // In a real life, this probably should be a trie or any other tree-like structure
-        // with O(logn) worst case, and not this O(n) solution
-        char *list_current_user_username = (char *)chained_list_find(
-            user->followers,
-            dup_current_user_username,
-            (int (*)(void *, void *))strcmp);
-
-        if (list_current_user_username == NULL)
+        // Adding is O(1), and tells us if it was already following
+        int followed = id_set_add(&user->followers, current_user->id);
+        if (followed)
         {
-            // Execution:
-            user->followers = chained_list_append_end(user->followers, dup_current_user_username);
-            logger_debug("New list of followers of %s:", user->username);
-            chained_list_print(user->followers, &print_username);
+            wal_log_follow(user, current_user);
+            logger_debug("%s has %u followers now\n", user->username, user->followers.count);
 
-            char *info_message = (char *)calloc(220, sizeof(char));
+            char info_message[220];
             sprintf(info_message, "The user '%s' was followed!", user_to_follow_username);
             strcpy(follow_notification->message, info_message);
 
-            // Sending for agreement and response will go after every replication
+            // Sending for agreement and response will go after every replication.
+            // Backups get the follower by its ID
+            follow_notification->data = (int)current_user->id;
             if (server_ring->is_primary)
+            {
+                replication_sequence(user, follow_notification);
                 send_replication(follow_notification);
+            }
         }
         else
-        {
-            char *error_message = (char *)calloc(220, sizeof(char));
             sprintf(error_message, "The user '%s' already follows '%s'", current_user->username, user_to_follow_username);
 
-            NOTIFICATION notification = {
-                .command = (COMMAND)NULL,
-                .id = GLOBAL_NOTIFICATION_ID++,
-                .timestamp = time(NULL),
-                .type = NOTIFICATION_TYPE__INFO};
-            strcpy(notification.message, error_message);
-            strcpy(notification.receiver, current_user->username);
-
-            send_message(&notification);
+        UNLOCK(user->mutex);
+        UNLOCK(user->followers_mutex);
 
-            logger_error("%s\n", error_message);
+        // Its home feed has the posts of who it follows
+        if (followed)
+        {
+            LOCK(current_user->mutex);
+            id_set_add(&current_user->following, user->id);
+            UNLOCK(current_user->mutex);
         }
+    }
 
-        UNLOCK(user->mutex);
+    if (error_message[0])
+    {
+        NOTIFICATION notification = {
+            .command = (COMMAND)NULL,
+            .id = notification_id_next(),
+            .timestamp = time(NULL),
+            .type = NOTIFICATION_TYPE__INFO};
+        strcpy(notification.receiver, current_user->username);
+        strcpy(notification.message, error_message);
+
+        send_message(&notification);
+
+        logger_error("%s\n", error_message);
     }
 
-    UNLOCK(MUTEX_FOLLOW);
+    free(user_to_follow_username);
 }
 
 void process_message(NOTIFICATION *notification, USER *user)
@@ -311,88 +350,242 @@ void process_message(NOTIFICATION *notification, USER *user)
 
 void receive_message(NOTIFICATION *receive_notification, USER *current_user)
 {
-    NOTIFICATION *notification = (NOTIFICATION *)calloc(1, sizeof(NOTIFICATION));
-    strcpy(notification->author, current_user->username);
-    strcpy(notification->receiver, current_user->username);
-    strcpy(notification->message, receive_notification->message);
-    notification->id = GLOBAL_NOTIFICATION_ID++;
-    notification->timestamp = receive_notification->timestamp;
-    notification->type = NOTIFICATION_TYPE__MESSAGE;
+    NOTIFICATION notification = {
+        .id = notification_id_next(),
+        .timestamp = receive_notification->timestamp,
+        .type = NOTIFICATION_TYPE__MESSAGE,
+    };
+    strcpy(notification.author, current_user->username);
+    strcpy(notification.receiver, current_user->username);
+    strcpy(notification.message, receive_notification->message);
+
+    // The only allocation of the post. The author's timeline keeps this reference,
+    // and every offline follower gets another one
+    MESSAGE *message = message_create(&notification);
+
+    // Every receiver gets the same fields, so we encode them only once, and batch
+    // the frames going to each FE to write all of them with as few syscalls as possible
+    uint8_t fields[PROTOCOL_MAX_FRAME_SIZE];
+    uint32_t mask;
+    size_t fields_length = protocol_encode_fields(&notification, fields, &mask);
+
+    FRAME_BATCH *batches = (FRAME_BATCH *)malloc(NUMBER_OF_FES * sizeof(FRAME_BATCH));
+    for (int fe_idx = 0; fe_idx < NUMBER_OF_FES; fe_idx++)
+        frame_batch_init(&batches[fe_idx], FE_SOCKFDS[fe_idx], &MUTEX_FE_SOCKFDS[fe_idx], notification.type, mask, fields, fields_length);
+
+    int receivers = 1, frames = 0, syscalls = 0;
+
+    // Posts of the same author fan out one at a time, so they reach every follower in order,
+    // while posts of different authors fan out in parallel
+    LOCK(current_user->fan_out_mutex);
+
+    // The followers are only copied under their mutex, so follows of this author don't wait
+    // for our writes to the FEs or for the inboxes to spill
+    LOCK(current_user->followers_mutex);
+    uint32_t *follower_ids = (uint32_t *)malloc((current_user->followers.count + 1) * sizeof(uint32_t));
+    int followers = 0;
+    for (uint32_t follower_idx = 0; follower_idx < current_user->followers.length; follower_idx++)
+        if (current_user->followers.ids[follower_idx] != ID_SET_EMPTY)
+            follower_ids[followers++] = current_user->followers.ids[follower_idx];
+    UNLOCK(current_user->followers_mutex);
+
+    frames += fan_out_message(message, current_user, batches);
+    for (int follower_idx = 0; follower_idx < followers; follower_idx++)
+    {
+        frames += fan_out_message(message, user_directory_get(user_directory, follower_ids[follower_idx]), batches);
+        receivers++;
+    }
 
-    LOCK(MUTEX_FOLLOW);
-    CHAINED_LIST *follower = current_user->followers;
-    send_message(notification);
-    while (follower)
+    for (int fe_idx = 0; fe_idx < NUMBER_OF_FES; fe_idx++)
     {
-        strcpy(notification->receiver, (char *)follower->val);
-        send_message(notification);
-        follower = follower->next;
+        if (frame_batch_flush(&batches[fe_idx]) < 0)
+            logger_error("When sending notification %llu to FE %d through socket %d\n", (unsigned long long)message->id, fe_idx, batches[fe_idx].sockfd);
+        syscalls += batches[fe_idx].syscalls;
     }
-    UNLOCK(MUTEX_FOLLOW);
+    UNLOCK(current_user->fan_out_mutex);
+
+    free(follower_ids);
+    free(batches);
+
+    logger_debug("Fan-out of notification %llu to %d receivers: %d frames sent with %d syscalls\n", (unsigned long long)message->id, receivers, frames, syscalls);
 
-    // Lock user to update list of notification
+    // The timeline keeps our reference in the cache of the newest posts
     LOCK(current_user->mutex);
-    current_user->notifications = chained_list_append_end(current_user->notifications, (void *)notification);
+    timeline_append(current_user, message);
     UNLOCK(current_user->mutex);
 }
 
+// Adds `message` to the batch of the receiver's FE if they are online, or a reference to it to
+// their pending messages otherwise. Only the choice is made under the receiver's mutex, as adding to
+// a full batch flushes it and spilling the inbox writes to disk. Returns how many frames were added to a batch
+int fan_out_message(MESSAGE *message, USER *user, FRAME_BATCH *batches)
+{
+    if (!user)
+    {
+        logger_error("When sending message %llu to a non existent user\n", (unsigned long long)message->id);
+        return 0;
+    }
+
+    int online, spill = FALSE;
+    LOCK(user->mutex);
+
+    online = user->sessions_number > 0;
+    if (!online)
+    {
+        logger_info("Added notification %llu with message '%s' to be sent later to %s\n", (unsigned long long)message->id, message->body, user->username);
+        wal_log_pending(user, message);
+        spill = inbox_push(user, message_retain(message));
+    }
+
+    UNLOCK(user->mutex);
+
+    if (spill)
+        inbox_spill(user);
+
+    if (!online)
+        return 0;
+
+    int user_hash = user->address % (NUMBER_OF_FES);
+    if (frame_batch_add(&batches[user_hash], user->username) < 0)
+        logger_error("When sending notification %llu to FE %d through socket %d\n", (unsigned long long)message->id, user_hash, batches[user_hash].sockfd);
+
+    return 1;
+}
+
 // Sends a NOTIFICATION to a user
 void send_message(NOTIFICATION *notification)
 {
-
-    HASH_NODE *node = hash_find(user_hash_table, notification->receiver);
-    if (!node)
+    USER *user = user_directory_find(user_directory, notification->receiver);
+    if (!user)
     {
         logger_error("When sending message to non existent username %s\n", notification->receiver);
         return;
     }
 
-    // Gets the user and lock its mutex
-    USER *user = (USER *)node->value;
+    int spill = FALSE;
+
+    // Lock the user's mutex
     LOCK(user->mutex);
 
     if (user->sessions_number > 0)
+        send_to_fe(user, notification);
+    else
     {
-        int user_hash = hash_address(user->username) % (NUMBER_OF_FES);
-        int socket_fd = FE_SOCKFDS[user_hash];
-
-        if (write(socket_fd, notification, sizeof(NOTIFICATION)) < 0)
-            logger_error("When sending notification %d to %s through socket %d\n", notification->id, user->username, socket_fd);
-        else
-            logger_info("Sent notification %d with message '%s' to %s 's FE on socket %d\n", notification->id, notification->message, notification->receiver, socket_fd);
+        logger_info("Added notification %llu with message '%s' to be sent later to %s\n", (unsigned long long)notification->id, notification->message, user->username);
+        // Add to the messages which must be sent to this user later on. The notification
+        // might be on the caller's stack, so it is kept as a MESSAGE
+        MESSAGE *message = message_create(notification);
+        wal_log_pending(user, message);
+        spill = inbox_push(user, message);
     }
+
+    UNLOCK(user->mutex);
+
+    if (spill)
+        inbox_spill(user);
+}
+
+// Writes a notification to the FE of an online user, whose mutex must be held
+int send_to_fe(USER *user, NOTIFICATION *notification)
+{
+    int user_hash = user->address % (NUMBER_OF_FES);
+    int socket_fd = FE_SOCKFDS[user_hash];
+
+    LOCK(MUTEX_FE_SOCKFDS[user_hash]);
+    int status = protocol_write(socket_fd, notification);
+    UNLOCK(MUTEX_FE_SOCKFDS[user_hash]);
+
+    if (status < 0)
+        logger_error("When sending notification %llu to %s through socket %d\n", (unsigned long long)notification->id, user->username, socket_fd);
     else
+        logger_info("Sent notification %llu with message '%s' to %s 's FE on socket %d\n", (unsigned long long)notification->id, notification->message, notification->receiver, socket_fd);
+
+    return status;
+}
+
+// Sends a page of the home feed of a user, from the newest post before the cursor in the `id` of the request.
+// Its posts go to the FE in a single write, followed by a frame with the TIMELINE command whose `id` is the
+// cursor of the next page, or 0 when there are no older posts. `data` is echoed back in every frame,
+// as the FE uses it to know which session asked for it
+void send_timeline(NOTIFICATION *request, USER *user)
+{
+    NOTIFICATION *page = (NOTIFICATION *)malloc(TIMELINE_PAGE_SIZE * sizeof(NOTIFICATION));
+    int count = timeline_read_feed(user_directory, user, request->id, page, TIMELINE_PAGE_SIZE);
+
+    uint8_t *frames = (uint8_t *)malloc((count + 1) * PROTOCOL_MAX_FRAME_SIZE);
+    size_t length = 0;
+    for (int post_idx = 0; post_idx < count; post_idx++)
     {
-        logger_info("Added notification %ld with message '%s' to be sent later to %s\n", notification->id, notification->message, user->username);
-        // Add to the notifications which must be sent to this user later on
-        LOCK(MUTEX_PENDING_NOTIFICATIONS);
-        user->pending_notifications = chained_list_append_end(user->pending_notifications, (void *)notification);
-        UNLOCK(MUTEX_PENDING_NOTIFICATIONS);
+        page[post_idx].type = NOTIFICATION_TYPE__TIMELINE;
+        page[post_idx].data = request->data;
+        strcpy(page[post_idx].receiver, user->username);
+        length += protocol_encode(&page[post_idx], frames + length);
     }
 
-    UNLOCK(user->mutex);
+    NOTIFICATION end = {
+        .command = TIMELINE,
+        .id = count == TIMELINE_PAGE_SIZE ? page[count - 1].id : 0,
+        .timestamp = time(NULL),
+        .type = NOTIFICATION_TYPE__TIMELINE,
+        .data = request->data};
+    strcpy(end.receiver, user->username);
+    length += protocol_encode(&end, frames + length);
+
+    int user_hash = user->address % (NUMBER_OF_FES);
+    LOCK(MUTEX_FE_SOCKFDS[user_hash]);
+    int status = protocol_write_frames(FE_SOCKFDS[user_hash], frames, length);
+    UNLOCK(MUTEX_FE_SOCKFDS[user_hash]);
+
+    if (status < 0)
+        logger_error("When sending timeline of %s through socket %d\n", user->username, FE_SOCKFDS[user_hash]);
+    else
+        logger_info("Sent %d posts of the timeline of %s before %llu\n", count, user->username, (unsigned long long)request->id);
+
+    free(frames);
+    free(page);
 }
 
-void *handle_connection(void *void_sockfd)
+// Called by the event loops for every notification received in a connection.
+// The first notification decides what this connection is, and long lived connections
+// (FEs and keepalives) change their state so that the next ones are handled accordingly.
+// Returns FALSE when the connection should be closed
+int handle_connection(CONNECTION *connection, NOTIFICATION *notification)
 {
-    int sockfd = *((int *)void_sockfd);
+    int sockfd = connection->sockfd;
 
-    NOTIFICATION notification;
-    int bytes_read = read(sockfd, (void *)&notification, sizeof(NOTIFICATION));
-    if (bytes_read < 0)
+    // The other side closed the connection
+    if (notification == NULL)
     {
-        logger_error("Couldn't read first notification from socket %d\n", sockfd);
-        return NULL;
+        if (connection->state == CONNECTION_STATE__FE)
+            logger_warn("[Socket %d] FE closed its connection\n", sockfd);
+        else if (connection->state == CONNECTION_STATE__REPLICATION)
+            logger_info("[Socket %d] Previous server closed its replication link\n", sockfd);
+
+        return FALSE;
+    }
+
+    switch (connection->state)
+    {
+    case CONNECTION_STATE__FE:
+        handle_connection_fe(sockfd, notification);
+        return TRUE;
+    case CONNECTION_STATE__KEEPALIVE:
+        return handle_connection_keepalive(connection, notification);
+    case CONNECTION_STATE__REPLICATION:
+        return handle_connection_replication(connection, notification);
+    default:
+        break;
     }
 
-    switch (notification.type)
+    switch (notification->type)
     {
     case NOTIFICATION_TYPE__FE_CONNECTION:
         if (server_ring->is_primary)
         {
             logger_info("[Socket %d] Received connection with FE_CONNECTION type.\n", sockfd);
-            handle_connection_fe(sockfd, &notification);
-            break;
+            FE_SOCKFDS[notification->data] = sockfd;
+            connection->state = CONNECTION_STATE__FE;
+            return TRUE;
         }
         logger_warn("[Socket %d] It is not primary, should not receive connection with LOGIN type\n", sockfd);
         break;
@@ -408,262 +601,227 @@ void *handle_connection(void *void_sockfd)
             break;
         }
 
-        handle_connection_keepalive(sockfd, &notification);
-        break;
+        return handle_connection_keepalive(connection, notification);
     case NOTIFICATION_TYPE__ELECTION:
         logger_info("[Socket %d] Received connection with ELECTION type\n", sockfd);
-        handle_connection_election(&notification, sockfd);
+        handle_connection_election(notification, sockfd);
         break;
     case NOTIFICATION_TYPE__ELECTED:
         logger_info("[Socket %d] Received connection with ELECTED type\n", sockfd);
-        handle_connection_elected(&notification);
+        handle_connection_elected(notification);
         break;
+    case NOTIFICATION_TYPE__SNAPSHOT_REQUEST:
+        logger_info("[Socket %d] Received connection with SNAPSHOT_REQUEST type\n", sockfd);
+        if (!server_ring->is_primary)
+        {
+            logger_warn("[Socket %d] It is not primary, should not receive snapshot requests\n", sockfd);
+            break;
+        }
+
+        // The snapshot is written by its own thread, which owns the socket from now on
+        pthread_t tid;
+        int *snapshot_sockfd = (int *)malloc(sizeof(int));
+        *snapshot_sockfd = sockfd;
+        pthread_create(&tid, NULL, (void *(*)(void *)) & send_snapshot, (void *)snapshot_sockfd);
+        pthread_detach(tid);
+
+        return EVENT_LOOP_DETACH;
     case NOTIFICATION_TYPE__REPLICATION:
-        logger_info("[Socket %d] Received connection with REPLICATION type\n", sockfd);
-        handle_replication(&notification);
-        break;
+    case NOTIFICATION_TYPE__REPLICATION_ACK:
+    case NOTIFICATION_TYPE__RING_CHANGED:
+        logger_info("[Socket %d] Received replication link from the previous server\n", sockfd);
+        return handle_connection_replication(connection, notification);
     default:
-        logger_info("[Socket %d] Unhandable connection with %d type\n", sockfd, notification.type);
+        logger_info("[Socket %d] Unhandable connection with %d type\n", sockfd, notification->type);
         break;
     }
 
-    close(sockfd);
-
-    return NULL;
+    return FALSE;
 }
 
-void send_pending_notifications(USER *current_user, int sockfd)
+void send_pending_notification(NOTIFICATION *notification, void *void_user)
 {
-    CHAINED_LIST *pending_notification = current_user->pending_notifications;
-    while (pending_notification)
-    {
-        NOTIFICATION *notification = (NOTIFICATION *)pending_notification->val;
-        strcpy(notification->receiver, current_user->username);
-
-        logger_info("[Socket %d] Sending back pending notification from %d to %d\n", sockfd, notification->author, current_user->username);
-        send_message(notification);
-
-        pending_notification = pending_notification->next;
-    }
+    logger_info("Sending back pending notification from %s to %s\n", notification->author, notification->receiver);
+    send_to_fe((USER *)void_user, notification);
 }
 
+// Delivers the inbox of a user who just logged in, whose mutex must be held. New notifications
+// to this user wait for it, so they can't pass the pending ones
 void handle_pending_notifications(USER *current_user, int sockfd, int send)
 {
-    // Do not allow to add any new notification while we haven't sent the others
-    LOCK(MUTEX_PENDING_NOTIFICATIONS);
     if (send)
     {
+        logger_info("[Socket %d] Sending back %u pending notifications to %s\n", sockfd, (unsigned)current_user->pending_messages.size + current_user->spilled_messages, current_user->username);
 
-        send_pending_notifications(current_user, sockfd);
+        // Oldest first, streaming the ones on disk before the ones in memory
+        inbox_iterate(current_user, &send_pending_notification, (void *)current_user);
     }
     // We have sent them all, so we can clean it
-    current_user->pending_notifications = NULL;
-    UNLOCK(MUTEX_PENDING_NOTIFICATIONS);
+    if (current_user->pending_messages.size + current_user->spilled_messages > 0)
+        wal_log_delivered(current_user);
+    inbox_clear(current_user);
 }
 
 void handle_connection_login(int sockfd, NOTIFICATION *notification)
 {
-    USER *current_user = login_user(notification->author);
-
-    handle_pending_notifications(current_user, sockfd, server_ring->is_primary);
+    USER *current_user = login_user(notification->author, server_ring->is_primary ? USER_ID_NONE : (uint32_t)notification->data);
+    if (current_user == NULL)
+    {
+        logger_error("[Socket %d] Could not log in user %s\n", sockfd, notification->author);
+        return;
+    }
 
-    if (server_ring->is_primary)
+    LOCK(current_user->mutex);
+    if (replication_sequence(current_user, notification))
     {
-        logger_debug("Sending LOGIN replication.\n");
-        send_replication(notification);
+        current_user->sessions_number++;
+        handle_pending_notifications(current_user, sockfd, server_ring->is_primary);
+
+        if (server_ring->is_primary)
+        {
+            logger_debug("Sending LOGIN replication.\n");
+            notification->data = (int)current_user->id;
+            send_replication(notification);
+        }
     }
+    UNLOCK(current_user->mutex);
 }
 
 void handle_connection_leader_question(int sockfd)
 {
     NOTIFICATION notification = {.type = NOTIFICATION_TYPE__ELECTED, .data = server_ring->primary_idx};
-    int bytes_read = write(sockfd, &notification, sizeof(NOTIFICATION));
+    int bytes_read = protocol_write(sockfd, &notification);
     if (bytes_read < 0)
         logger_error("[Socket %d] When sending primary idx (%d) back on request\n", sockfd, server_ring->primary_idx);
 }
 
+// Applies a replication frame received from the previous server, and forwards it to the next one
 void handle_replication(NOTIFICATION *notification)
 {
-    if (notification->command == LOGIN)
+    if (server_ring->is_primary)
     {
-        if (!server_ring->is_primary)
-        {
-            handle_connection_login(0, notification);
-
-            if (notification->data == 1)
-                send_replication(notification);
-        }
-        else
-            logger_debug("Primary received back replication LOGIN. Ignoring...\n");
+        logger_debug("Primary received back replication %d. Ignoring...\n", notification->command);
+        return;
     }
-    else if (notification->command == LOGOUT)
-    {
-        if (!server_ring->is_primary)
-        {
-            logout_user(notification->author);
 
-            if (notification->data == 1)
-                send_replication(notification);
-        }
-        else
-            logger_debug("Primary received back replication LOGOUT. Ignoring...\n");
-    }
-    else
+    int status = replication_link_receive(replication_link, notification);
+    if (status < 0)
+        return;
+
+    // Already applied, but the next servers may still miss it
+    if (status == 0)
     {
+        send_replication(notification);
+        return;
+    }
+
+    // So that our IDs are bigger than the primary's ones if we take its place
+    notification_id_observe(notification->id);
+
+    USER *user, *follower;
 
-        if (notification->command == FOLLOW)
+    switch (notification->command)
+    {
+    case LOGIN:
+        handle_connection_login(0, notification);
+        break;
+    case LOGOUT:
+        logout_user(notification);
+        break;
+    case FOLLOW:
+        // Gets the users, and the follower comes by its ID
+        user = user_directory_find(user_directory, notification->target);
+        follower = user_directory_get(user_directory, (uint32_t)notification->data);
+        if (!user || !follower)
         {
-            if (notification->data == 0)
-            {
-                // Response after Agreement:
-                NOTIFICATION response = {
-                    .command = (COMMAND)NULL,
-                    .id = GLOBAL_NOTIFICATION_ID++,
-                    .timestamp = time(NULL),
-                    .type = NOTIFICATION_TYPE__INFO,
-                };
-                strcpy(response.message, notification->message);
-                strcpy(response.receiver, notification->receiver);
-                send_message(&response);
-            }
-            else
-            {
-                // Gets the user and lock its mutex
-                HASH_NODE *node = hash_find(user_hash_table, notification->target);
-                USER *user = (USER *)node->value;
+            logger_error("When replicating follow of non existent username %s by user %d\n", notification->target, notification->data);
+            break;
+        }
 
-                LOCK(user->mutex); // Because we will modify lists
-                char *dup_current_user_username = strdup(notification->author);
-                user->followers = chained_list_append_end(user->followers, dup_current_user_username);
-                UNLOCK(user->mutex);
+        // Followers only change with both locks, as the fan-out walks them with the followers one
+        LOCK(user->followers_mutex);
+        LOCK(user->mutex);
+        if (replication_sequence(user, notification) && id_set_add(&user->followers, follower->id))
+            wal_log_follow(user, follower);
+        UNLOCK(user->mutex);
+        UNLOCK(user->followers_mutex);
 
-                logger_debug("New list of followers of %s: ", user->username);
-                chained_list_print(user->followers, &print_username);
-                logger_info("Updated follow state\n");
+        LOCK(follower->mutex);
+        id_set_add(&follower->following, user->id);
+        UNLOCK(follower->mutex);
 
-                if (notification->data == 1)
-                    send_replication(notification);
-            }
-        }
-        if (notification->command == SEND)
+        logger_debug("%s has %u followers now\n", user->username, user->followers.count);
+        logger_info("Updated follow state\n");
+        break;
+    case SEND:
+        // Gets the user and lock its mutex
+        user = user_directory_find(user_directory, notification->receiver);
+        if (!user)
         {
-            if (notification->data == 1)
-            {
-                // Gets the user and lock its mutex
-                HASH_NODE *node = hash_find(user_hash_table, notification->receiver);
-                USER *user = (USER *)node->value;
-
-                LOCK(user->mutex);
-                LOCK(MUTEX_PENDING_NOTIFICATIONS);
-                logger_info("Added notification %ld with message '%s' to be sent later to %s\n", notification->id, notification->message, user->username);
-                user->pending_notifications = chained_list_append_end(user->pending_notifications, (void *)notification);
-                UNLOCK(MUTEX_PENDING_NOTIFICATIONS);
-                UNLOCK(user->mutex);
-                send_replication(notification);
-            }
+            logger_error("When replicating notification to non existent username %s\n", notification->receiver);
+            break;
         }
-    }
-}
 
-void send_initial_replication(int sockfd)
-{
-    int list_idx;
-    HASH_NODE *node;
-    if (user_hash_table)
-    {
-        for (int table_idx = 0; table_idx < HASH_SIZE; table_idx++)
+        int spill = FALSE;
+        LOCK(user->mutex);
+        if (replication_sequence(user, notification))
         {
-            for (node = user_hash_table[table_idx], list_idx = 0; node; node = node->next, list_idx++)
-            {
-                USER *user = (USER *)node->value;
-
-                NOTIFICATION login_notification = {
-                    .type = NOTIFICATION_TYPE__REPLICATION,
-                    .command = LOGIN,
-                    .data = 2,
-                    .id = GLOBAL_NOTIFICATION_ID++,
-                    .timestamp = time(NULL),
-                };
-                strcpy(login_notification.author, user->username);
-                logger_debug("[Socket %d] REPLICATION: LOGIN user %s\n", sockfd, user->username);
-                send_replication(&login_notification);
-
-                CHAINED_LIST *list_pending_notification = user->pending_notifications;
-                NOTIFICATION *notification = (NOTIFICATION *)malloc(sizeof(NOTIFICATION));
-                while (list_pending_notification)
-                {
-                    memcpy(notification, list_pending_notification->val, sizeof(NOTIFICATION));
-                    notification->data = 2;
-
-                    logger_debug("[Socket %d] REPLICATION: Pending notification from %s to %s\n", sockfd, notification->author, user->username);
-                    send_replication(notification);
-
-                    list_pending_notification = list_pending_notification->next;
-                }
-
-                NOTIFICATION follow_notification = {
-                    .type = NOTIFICATION_TYPE__REPLICATION,
-                    .command = FOLLOW,
-                    .data = 2, // So that this is not sent ahead
-                    .id = GLOBAL_NOTIFICATION_ID++,
-                    .timestamp = time(NULL),
-                };
-                CHAINED_LIST *list_followers = user->followers;
-                while (list_followers)
-                {
-                    char *following_user = (char *)list_followers->val;
-                    strcpy(follow_notification.author, following_user);
-                    strcpy(follow_notification.receiver, following_user);
-                    strcpy(follow_notification.target, user->username);
-                    logger_debug("[Socket %d] REPLICATION: FOLLOW user %s -> %s\n", sockfd, follow_notification.receiver, follow_notification.target);
-                    send_replication(&follow_notification);
-
-                    list_followers = list_followers->next;
-                }
-            }
+            logger_info("Added notification %llu with message '%s' to be sent later to %s\n", (unsigned long long)notification->id, notification->message, user->username);
+            MESSAGE *message = message_create(notification);
+            wal_log_pending(user, message);
+            spill = inbox_push(user, message);
         }
+        UNLOCK(user->mutex);
+
+        if (spill)
+            inbox_spill(user);
+        break;
+    default:
+        break;
     }
+
+    // Frames outside the log are only meant for us
+    if (notification->lsn)
+        send_replication(notification);
 }
 
-void send_replication(NOTIFICATION *original)
+// Called on the primary for every replicated frame, once all servers have it
+void handle_replication_acknowledged(NOTIFICATION *notification)
 {
+    if (notification->command != FOLLOW)
+        return;
 
-    int keep_replicating = 1;
-
-    // Creating and configuring sockfd for the keepalive
-    int sockfd = socket_create();
-    server_ring_connect_with_next_server(server_ring, sockfd);
-
-    if (server_ring->server_ring_ports[server_ring->primary_idx] == server_ring->server_ring_ports[server_ring->next_index])
-    {
-        logger_debug("Should stop replication on next connection\n");
-        keep_replicating = 0;
-    }
-
-    // To account for the fact that the callee function asked to send this specific numberr
-    if (original->data == 2)
-        keep_replicating = 2;
+    // Response after Agreement:
+    NOTIFICATION response = {
+        .command = (COMMAND)NULL,
+        .id = notification_id_next(),
+        .timestamp = time(NULL),
+        .type = NOTIFICATION_TYPE__INFO,
+    };
+    strcpy(response.message, notification->message);
+    strcpy(response.receiver, notification->receiver);
+    send_message(&response);
+}
 
+// Queues a notification to be replicated to the next server. The primary gives it the next LSN,
+// and backups forward it with the LSN it already has
+void send_replication(NOTIFICATION *original)
+{
     NOTIFICATION notification = {
         .type = NOTIFICATION_TYPE__REPLICATION,
         .command = original->command,
-        .data = keep_replicating,
+        .lsn = original->lsn,
+        .sequence = original->sequence,
         .id = original->id,
         .timestamp = original->timestamp,
+        .data = original->data,
     };
     strcpy(notification.author, original->author);
     strcpy(notification.message, original->message);
     strcpy(notification.receiver, original->receiver);
     strcpy(notification.target, original->target);
 
-    int bytes_wrote = write(sockfd, (void *)&notification, sizeof(NOTIFICATION));
-    if (bytes_wrote < 0)
-    {
-        logger_error("Error when trying to send next replication message.\n");
-        exit(ERROR_REPLICATING);
-    }
-
-    close(sockfd);
+    replication_link_send(replication_link, &notification);
 }
 
 void handle_connection_election(NOTIFICATION *notification, int origin_sockfd)
@@ -677,7 +835,7 @@ void handle_connection_election(NOTIFICATION *notification, int origin_sockfd)
         logger_warn("I'm already primary, but someone doesn't know, telling them\n");
 
         NOTIFICATION notification = {.type = NOTIFICATION_TYPE__ELECTED, .data = server_ring->self_index};
-        int bytes_wrote = write(origin_sockfd, (void *)&notification, sizeof(NOTIFICATION));
+        int bytes_wrote = protocol_write(origin_sockfd, &notification);
         if (bytes_wrote < 0)
         {
             logger_error("Error when trying to send I was elected. Be careful, the node %d may be inoperant.\n");
@@ -711,6 +869,7 @@ void handle_connection_election(NOTIFICATION *notification, int origin_sockfd)
 
         // Become the primary right now
         server_ring->is_primary = 1;
+        server_ring->primary_idx = server_ring->self_index;
     }
     else
     {
@@ -747,7 +906,7 @@ void handle_connection_election(NOTIFICATION *notification, int origin_sockfd)
     logger_info("Connected with next node in port %d\n", server_ring->server_ring_ports[server_ring->next_index]);
     logger_info("Will send the subsequent election message\n");
 
-    int bytes_wrote = write(sockfd, (void *)&new_notification, sizeof(NOTIFICATION));
+    int bytes_wrote = protocol_write(sockfd, &new_notification);
     if (bytes_wrote < 0)
     {
         logger_error("Error when trying to send next election message.\n");
@@ -804,7 +963,7 @@ void handle_connection_elected(NOTIFICATION *notification)
     logger_info("Connected with next node in port %d\n", server_ring->server_ring_ports[server_ring->next_index]);
     logger_info("Will send the subsequent election message\n");
 
-    int bytes_wrote = send(sockfd, (void *)notification, sizeof(NOTIFICATION), MSG_NOSIGNAL);
+    int bytes_wrote = protocol_write(sockfd, notification);
     if (bytes_wrote < 0)
     {
         logger_error("Error when trying to send elected message.\n");
@@ -819,83 +978,77 @@ void handle_connection_elected(NOTIFICATION *notification)
     close(sockfd);
 }
 
-void handle_connection_keepalive(int sockfd, NOTIFICATION *received_notification)
+// Answers every keepalive received with another keepalive.
+// The first one from a backup (data != 1) means it joined the ring
+int handle_connection_keepalive(CONNECTION *connection, NOTIFICATION *received_notification)
 {
-    if (received_notification->data != 1)
-        send_initial_replication(sockfd);
+    int sockfd = connection->sockfd;
 
-    int bytes_read;
-    NOTIFICATION notification = {.type = NOTIFICATION_TYPE__KEEPALIVE}, read_notification;
-
-    while (1)
+    if (connection->state == CONNECTION_STATE__NEW)
     {
-        sleep(1);
-        bytes_read = send(sockfd, (void *)&notification, sizeof(NOTIFICATION), MSG_NOSIGNAL);
-        if (bytes_read < 0)
-        {
-            if (errno == EPIPE)
-            {
-                logger_info("[Socket %d] When sending keepalive to client. Must be dead. Stopping answering keep alives\n", sockfd);
-                return;
-            }
+        connection->state = CONNECTION_STATE__KEEPALIVE;
 
-            logger_error("[Socket %d] When sending keepalive to client. Not an EPIPE. Will retry to send...\n", sockfd);
-            continue;
-        }
+        // A new server joined, so the ring must look for its next servers again.
+        // Its state comes from the snapshot it requests by itself
+        if (received_notification->data != 1)
+            replication_link_ring_changed(replication_link);
+    }
 
-        bytes_read = read(sockfd, (void *)&read_notification, sizeof(NOTIFICATION));
-        if (bytes_read < 0)
+    NOTIFICATION notification = {.type = NOTIFICATION_TYPE__KEEPALIVE};
+    int bytes_wrote = protocol_write(sockfd, &notification);
+    if (bytes_wrote < 0)
+    {
+        if (errno == EPIPE)
         {
-            logger_info("[Socket %d] When receiving keepalive from the client. Must be dead. Stopping answering keep alives\n", sockfd);
-            return;
+            logger_info("[Socket %d] When sending keepalive to client. Must be dead. Stopping answering keep alives\n", sockfd);
+            return FALSE;
         }
+
+        logger_error("[Socket %d] When sending keepalive to client. Not an EPIPE. Will answer the next one...\n", sockfd);
     }
+
+    return TRUE;
 }
 
-void handle_connection_fe(int sockfd, NOTIFICATION *connection_notification)
+void handle_connection_fe(int sockfd, NOTIFICATION *notification)
 {
-    FE_SOCKFDS[connection_notification->data] = sockfd;
-    HASH_NODE *hash_node;
     USER *user;
 
-    while (1)
+    logger_info("Received NOTIFICATION from FE with id %llu and type %d and message %s\n", (unsigned long long)notification->id, notification->type, notification->message);
+
+    switch (notification->type)
     {
-        NOTIFICATION notification;
-        int bytes_read = read(sockfd, (void *)&notification, sizeof(NOTIFICATION));
-        if (bytes_read < 0)
+    case NOTIFICATION_TYPE__LOGIN:
+        logger_info("[Socket %d] Received connection with LOGIN type\n", sockfd);
+        handle_connection_login(sockfd, notification);
+        break;
+    case NOTIFICATION_TYPE__LOGOUT:
+        logger_info("[Socket %d] Received connection with LOGOUT type\n", sockfd);
+        logout_user(notification);
+        break;
+    case NOTIFICATION_TYPE__MESSAGE:
+        logger_info("MESSAGE from author %s and other things %d %s\n", notification->author, notification->command, notification->receiver);
+        user = user_directory_find(user_directory, notification->author);
+        if (!user)
         {
-            logger_error("Couldn't read notification from socket %d\n", sockfd);
-            return;
+            logger_error("[Socket %d] Message from non existent username %s\n", sockfd, notification->author);
+            break;
         }
-
-        logger_info("Received NOTIFICATION from FE with id %d and type %d and message %s\n", notification.id, notification.type, notification.message);
-
-        switch (notification.type)
+        process_message(notification, user);
+        break;
+    case NOTIFICATION_TYPE__TIMELINE:
+        user = user_directory_find(user_directory, notification->author);
+        if (!user)
         {
-        case NOTIFICATION_TYPE__LOGIN:
-            logger_info("[Socket %d] Received connection with LOGIN type\n", sockfd);
-            handle_connection_login(sockfd, &notification);
-            break;
-        case NOTIFICATION_TYPE__LOGOUT:
-            logger_info("[Socket %d] Received connection with LOGOUT type\n", sockfd);
-            logout_user(notification.author);
-            if (server_ring->is_primary)
-                send_replication(&notification);
-            break;
-        case NOTIFICATION_TYPE__MESSAGE:
-            logger_info("MESSAGE from author %s and other things %d %s\n", notification.author, notification.command, notification.receiver);
-            hash_node = hash_find(user_hash_table, notification.author);
-            logger_debug("Hash node author: %p\n", hash_node);
-            user = (USER *)hash_node->value;
-            process_message(&notification, user);
-            break;
-        default:
-            logger_info("[Socket %d] Unhandable message with %d type. Ignoring...\n", sockfd, notification.type);
+            logger_error("[Socket %d] Timeline of non existent username %s\n", sockfd, notification->author);
             break;
         }
+        send_timeline(notification, user);
+        break;
+    default:
+        logger_info("[Socket %d] Unhandable message with %d type. Ignoring...\n", sockfd, notification->type);
+        break;
     }
-
-    close(sockfd);
 }
 
 void close_socket(void *void_socket)
@@ -916,18 +1069,38 @@ void cancel_thread(void *void_pthread)
 
 void sigint_handler(int _sigint)
 {
-    if (!received_sigint)
-    {
-        logger_warn("SIGINT received, closing descriptors and finishing...\n");
-        cleanup(0);
-        received_sigint = TRUE;
-    }
-    else
-        logger_error("Already received SIGINT... Waiting to finish cleaning up...\n");
+    // Only async-signal-safe calls here, the shutdown thread does the rest
+    uint64_t wake = 1;
+    if (write(shutdown_eventfd, &wake, sizeof(wake)) < 0)
+        _exit(ERROR_SHUTDOWN);
+}
+
+void *handle_shutdown(void *arg)
+{
+    uint64_t signals;
+    while (read(shutdown_eventfd, &signals, sizeof(signals)) < 0)
+        if (errno != EINTR)
+            return NULL;
+
+    logger_warn("SIGINT received, closing descriptors and finishing...\n");
+    cleanup(0);
+
+    return NULL;
 }
 
 void handle_signals(void)
 {
+    if ((shutdown_eventfd = eventfd(0, 0)) < 0)
+    {
+        logger_error("When creating the shutdown eventfd: %d\n", errno);
+        exit(ERROR_SHUTDOWN);
+    }
+
+    // It isn't in `threads`, as it is the one cancelling them
+    pthread_t shutdown_tid;
+    pthread_create(&shutdown_tid, NULL, &handle_shutdown, NULL);
+    pthread_detach(shutdown_tid);
+
     struct sigaction sigint_action;
     sigint_action.sa_handler = sigint_handler;
     sigaction(SIGINT, &sigint_action, NULL);
@@ -943,7 +1116,7 @@ void handle_signals(void)
     pthread_create(thread, NULL, (void *(*)(void *)) & handle_eof, (void *)NULL);
     logger_debug("Created new thread to handle EOF detection\n");
 
-    chained_list_append_end(chained_list_threads, (void *)thread);
+    deque_push_back(&threads, (void *)thread);
 }
 
 void *handle_eof(void *arg)
@@ -959,3 +1132,96 @@ void *handle_eof(void *arg)
 
     return NULL;
 }
+
+// Handles every frame received through the replication link of the previous server,
+// which stays open so that frames are pipelined
+int handle_connection_replication(CONNECTION *connection, NOTIFICATION *notification)
+{
+    connection->state = CONNECTION_STATE__REPLICATION;
+
+    if (notification->type == NOTIFICATION_TYPE__RING_CHANGED)
+    {
+        // It went through the whole ring once it is back at the primary
+        if (!server_ring->is_primary)
+        {
+            logger_info("[Socket %d] A server joined the ring, will look for the next server again\n", connection->sockfd);
+            replication_link_ring_changed(replication_link);
+        }
+
+        return TRUE;
+    }
+
+    if (notification->type == NOTIFICATION_TYPE__REPLICATION_ACK)
+    {
+        if (server_ring->is_primary)
+            replication_link_acknowledge(replication_link, notification->lsn);
+        else
+            logger_warn("[Socket %d] Received a replication acknowledgement, but it is not primary. Ignoring...\n", connection->sockfd);
+
+        return TRUE;
+    }
+
+    if (notification->type != NOTIFICATION_TYPE__REPLICATION)
+    {
+        logger_warn("[Socket %d] Unhandable frame with %d type in the replication link. Ignoring...\n", connection->sockfd, notification->type);
+        return TRUE;
+    }
+
+    handle_replication(notification);
+
+    return TRUE;
+}
+
+// Streams the whole state to a backup which just joined the ring, then closes the connection
+void *send_snapshot(void *void_sockfd)
+{
+    int sockfd = *((int *)void_sockfd);
+    free(void_sockfd);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int users = snapshot_send(sockfd, user_directory, replication_link_snapshot_lsn(replication_link));
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (users < 0)
+        logger_error("[Socket %d] When sending snapshot\n", sockfd);
+    else
+        logger_info("[Socket %d] Sent snapshot with %d users in %ld ms\n", sockfd, users, (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000);
+
+    close(sockfd);
+
+    return NULL;
+}
+
+// Loads the state of the primary in a single connection. Replication frames received
+// meanwhile wait in the socket until the event loops start, and the ones already in the
+// snapshot are ignored because of its LSN
+void request_snapshot(void)
+{
+    int sockfd = socket_create();
+    if (server_ring_connect_with_primary(server_ring, sockfd) < 0)
+    {
+        logger_error("When connecting to primary to request a snapshot\n");
+        exit(ERROR_REPLICATING);
+    }
+
+    NOTIFICATION notification = {.type = NOTIFICATION_TYPE__SNAPSHOT_REQUEST};
+    if (protocol_write(sockfd, &notification) < 0)
+    {
+        logger_error("When requesting a snapshot to the primary\n");
+        exit(ERROR_REPLICATING);
+    }
+
+    uint64_t lsn;
+    int users = snapshot_receive(sockfd, user_directory, &lsn);
+    if (users < 0)
+    {
+        logger_error("When receiving a snapshot from the primary\n");
+        exit(ERROR_REPLICATING);
+    }
+    close(sockfd);
+
+    replication_link_start_at(replication_link, lsn);
+    logger_info("Loaded snapshot with %d users from the primary, up to frame %llu\n", users, (unsigned long long)lsn);
+}
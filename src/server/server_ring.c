@@ -2,6 +2,7 @@
 #include "exit_errors.h"
 #include "logger.h"
 #include "notification.h"
+#include "protocol.h"
 #include "socket.h"
 
 #include <stdio.h>
@@ -133,14 +134,14 @@ void server_ring_connect_with_ring(SERVER_RING *ring)
     logger_info("Will try to find which is the primary port\n");
 
     NOTIFICATION notification = {.type = NOTIFICATION_TYPE__LEADER_QUESTION};
-    int bytes_wrote = write(ring->next_sockfd, (void *)&notification, sizeof(NOTIFICATION));
+    int bytes_wrote = protocol_write(ring->next_sockfd, &notification);
     if (bytes_wrote < 0)
     {
         logger_error("Error when trying to sending message to find who is the current leader.\n");
         exit(ERROR_LOOKING_FOR_LEADER);
     }
 
-    int bytes_read = read(ring->next_sockfd, (void *)&notification, sizeof(NOTIFICATION));
+    int bytes_read = protocol_read(ring->next_sockfd, &notification);
     if (bytes_read < 0)
     {
         logger_error("Error when trying to receive message to find who is the current leader.\n");
@@ -178,17 +179,7 @@ void server_ring_keep_alive_primary(void *void_ring)
 
     ring->keepalive_fd = socket_create();
 
-    // Connecting per se
-    struct sockaddr_in keepalive_addr;
-
-    keepalive_addr.sin_family = AF_INET;
-    bzero(&(keepalive_addr.sin_zero), 8);
-
-    keepalive_addr.sin_port = htons(ring->server_ring_ports[ring->primary_idx]);
-    struct hostent *in_addr = gethostbyname(ring->server_ring_addresses[ring->primary_idx]);
-    keepalive_addr.sin_addr = *((struct in_addr *)in_addr->h_addr);
-
-    if (connect(ring->keepalive_fd, (struct sockaddr *)&keepalive_addr, sizeof(keepalive_addr)) < 0)
+    if (server_ring_connect_with_primary(ring, ring->keepalive_fd) < 0)
     {
         logger_error("When connecting to main server\n");
         exit(ERROR_STARTING_CONNECTION);
@@ -199,7 +190,7 @@ void server_ring_keep_alive_primary(void *void_ring)
         logger_debug("Sending a keep alive to %d\n", ring->primary_idx);
 
         NOTIFICATION notification = {.type = NOTIFICATION_TYPE__KEEPALIVE}, read_notification;
-        int bytes_wrote = send(ring->keepalive_fd, (void *)&notification, sizeof(NOTIFICATION), MSG_NOSIGNAL);
+        int bytes_wrote = protocol_write(ring->keepalive_fd, &notification);
         if (bytes_wrote < 0)
         {
             // Master is dead, need to start an election
@@ -214,7 +205,7 @@ void server_ring_keep_alive_primary(void *void_ring)
             exit(ERROR_LOOKING_FOR_LEADER);
         }
 
-        int bytes_read = read(ring->keepalive_fd, (void *)&read_notification, sizeof(NOTIFICATION));
+        int bytes_read = protocol_read(ring->keepalive_fd, &read_notification);
         if (bytes_read < 0)
         {
             // Connection to master timed out, need to start an election
@@ -275,7 +266,7 @@ void start_election(void *void_ring)
         logger_info("Will send an election message\n");
 
         NOTIFICATION notification = {.type = NOTIFICATION_TYPE__ELECTION, .data = ring->self_index};
-        int bytes_wrote = write(sockfd, (void *)&notification, sizeof(NOTIFICATION));
+        int bytes_wrote = protocol_write(sockfd, &notification);
         if (bytes_wrote < 0)
         {
             logger_error("Error when trying to send election message.\n");
@@ -304,3 +295,17 @@ void server_ring_connect_with_next_server(SERVER_RING *ring, int sockfd)
         next_addr.sin_addr = *((struct in_addr *)in_addr->h_addr);
     } while (ring->next_index != ring->self_index && (connect(sockfd, (struct sockaddr *)&next_addr, sizeof(next_addr)) < 0));
 }
+
+int server_ring_connect_with_primary(SERVER_RING *ring, int sockfd)
+{
+    struct sockaddr_in primary_addr;
+
+    primary_addr.sin_family = AF_INET;
+    bzero(&(primary_addr.sin_zero), 8);
+
+    primary_addr.sin_port = htons(ring->server_ring_ports[ring->primary_idx]);
+    struct hostent *in_addr = gethostbyname(ring->server_ring_addresses[ring->primary_idx]);
+    primary_addr.sin_addr = *((struct in_addr *)in_addr->h_addr);
+
+    return connect(sockfd, (struct sockaddr *)&primary_addr, sizeof(primary_addr));
+}
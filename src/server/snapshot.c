@@ -0,0 +1,437 @@
+#include "snapshot.h"
+
+#include "crc32.h"
+#include "logger.h"
+#include "notification.h"
+#include "message.h"
+#include "inbox.h"
+#include "notification_id.h"
+#include "protocol.h"
+#include "user.h"
+
+#include <pthread.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#define LOCK(mutex) pthread_mutex_lock(&mutex)
+#define UNLOCK(mutex) pthread_mutex_unlock(&mutex)
+
+#define SNAPSHOT_RECORD_HEADER_SIZE (1 + 5) // Type and the varint ID of the user
+
+// What is sent of a user, copied under its mutex so that the records are written after releasing it
+typedef struct snapshot_user
+{
+    uint32_t id;
+    char username[MAX_USERNAME_LENGTH + 2];
+    int sessions_number;
+    uint64_t replication_sequence;
+    uint32_t *followers; // Reused by every user, growing to the most followers seen
+    uint32_t followers_count;
+    uint32_t followers_capacity;
+    INBOX_COPY inbox;
+} SNAPSHOT_USER;
+
+typedef struct snapshot_writer
+{
+    int sockfd;
+    uint32_t user_id; // Whose records are being written
+    uint8_t *chunk;  // Chunk header followed by its payload
+    size_t length;   // Payload bytes in the current chunk
+    uint8_t *count;  // Where the follower count of the open FOLLOWERS record is
+    uint32_t counted; // Followers in the open FOLLOWERS record
+    int chunks;
+    int failed;
+} SNAPSHOT_WRITER;
+
+// Bulk loader state, so that the records of the same user don't need to look it up again
+typedef struct snapshot_loader
+{
+    USER_DIRECTORY *directory;
+    USER *user;
+    int users;
+} SNAPSHOT_LOADER;
+
+void snapshot_copy_user(SNAPSHOT_USER *, USER *);
+void snapshot_write_user(SNAPSHOT_WRITER *, SNAPSHOT_USER *);
+void snapshot_write_pending(NOTIFICATION *, void *);
+uint8_t *snapshot_put_record(SNAPSHOT_WRITER *, SNAPSHOT_RECORD, uint32_t);
+void snapshot_reserve(SNAPSHOT_WRITER *, size_t);
+void snapshot_flush(SNAPSHOT_WRITER *);
+int snapshot_load_chunk(SNAPSHOT_LOADER *, uint8_t *, size_t);
+USER *snapshot_load_user(SNAPSHOT_LOADER *, uint32_t);
+int snapshot_send_all(int, uint8_t *, size_t);
+int snapshot_receive_all(int, uint8_t *, size_t);
+void snapshot_put_u32(uint8_t *, uint32_t);
+uint32_t snapshot_get_u32(uint8_t *);
+
+/// Streams every user in `directory` through a socket, as a chunked and checksummed snapshot.
+/// Each user is locked only while it is copied, and its records are sent after. They also have its
+/// replication sequence, as `lsn` can't tell which of the later frames each user already has
+///
+/// @param sockfd Socket to write to
+/// @param directory USER_DIRECTORY* with every USER
+/// @param lsn Last replication LSN already applied to `directory`
+///
+/// @returns How many users were sent, or -1 on error
+int snapshot_send(int sockfd, USER_DIRECTORY *directory, uint64_t lsn)
+{
+    uint8_t header[SNAPSHOT_HEADER_SIZE];
+    memcpy(header, SNAPSHOT_MAGIC, 4);
+    header[4] = SNAPSHOT_VERSION;
+    snapshot_put_u32(header + 5, (uint32_t)lsn);
+    snapshot_put_u32(header + 9, (uint32_t)(lsn >> 32));
+
+    if (snapshot_send_all(sockfd, header, sizeof(header)) < 0)
+        return -1;
+
+    SNAPSHOT_WRITER writer = {.sockfd = sockfd, .chunk = (uint8_t *)malloc(SNAPSHOT_CHUNK_HEADER_SIZE + SNAPSHOT_CHUNK_SIZE)};
+    SNAPSHOT_USER copy = {.followers = NULL, .followers_capacity = 0};
+    int users = 0;
+
+    // IDs are dense, so walking them finds every user
+    uint32_t last_id = user_directory_last_id(directory);
+    for (uint32_t id = 1; id <= last_id && !writer.failed; id++)
+    {
+        USER *user = user_directory_get(directory, id);
+        if (!user)
+            continue;
+
+        // Sending and reading the inbox segment may block, so they happen after unlocking
+        LOCK(user->mutex);
+        snapshot_copy_user(&copy, user);
+        UNLOCK(user->mutex);
+
+        snapshot_write_user(&writer, &copy);
+        inbox_copy_free(&copy.inbox);
+        users++;
+    }
+    free(copy.followers);
+
+    // The empty chunk tells the loader we are done
+    if (writer.length > 0)
+        snapshot_flush(&writer);
+    snapshot_flush(&writer);
+    free(writer.chunk);
+
+    logger_debug("[Socket %d] Sent snapshot of %d users at LSN %llu in %d chunks\n", sockfd, users, (unsigned long long)lsn, writer.chunks);
+
+    return writer.failed ? -1 : users;
+}
+
+/// Receives a snapshot sent with `snapshot_send`, inserting every user in `directory`.
+/// It must be the only one touching the users meanwhile, as they are not locked
+///
+/// @param sockfd Socket to read from
+/// @param directory USER_DIRECTORY* which receives the users
+/// @param lsn Where the LSN of the snapshot will be written
+///
+/// @returns How many users were loaded, or -1 if the snapshot is broken or the socket failed
+int snapshot_receive(int sockfd, USER_DIRECTORY *directory, uint64_t *lsn)
+{
+    uint8_t header[SNAPSHOT_HEADER_SIZE];
+    if (snapshot_receive_all(sockfd, header, sizeof(header)) < 0)
+        return -1;
+
+    if (memcmp(header, SNAPSHOT_MAGIC, 4) != 0 || header[4] != SNAPSHOT_VERSION)
+    {
+        logger_error("[Socket %d] Snapshot has an unknown format\n", sockfd);
+        return -1;
+    }
+    *lsn = (uint64_t)snapshot_get_u32(header + 5) | ((uint64_t)snapshot_get_u32(header + 9) << 32);
+
+    SNAPSHOT_LOADER loader = {.directory = directory};
+    uint8_t *payload = (uint8_t *)malloc(SNAPSHOT_CHUNK_SIZE);
+    int chunks = 0, status = 0;
+
+    while (1)
+    {
+        uint8_t chunk_header[SNAPSHOT_CHUNK_HEADER_SIZE];
+        if ((status = snapshot_receive_all(sockfd, chunk_header, sizeof(chunk_header))) < 0)
+            break;
+
+        uint32_t length = snapshot_get_u32(chunk_header);
+        if (length == 0)
+            break;
+
+        if (length > SNAPSHOT_CHUNK_SIZE)
+        {
+            logger_error("[Socket %d] Snapshot chunk %d has %u bytes, more than allowed\n", sockfd, chunks, length);
+            status = -1;
+            break;
+        }
+
+        if ((status = snapshot_receive_all(sockfd, payload, length)) < 0)
+            break;
+
+        if (crc32_compute(payload, length) != snapshot_get_u32(chunk_header + 4))
+        {
+            logger_error("[Socket %d] Snapshot chunk %d is corrupted\n", sockfd, chunks);
+            status = -1;
+            break;
+        }
+
+        if ((status = snapshot_load_chunk(&loader, payload, length)) < 0)
+        {
+            logger_error("[Socket %d] Snapshot chunk %d has an invalid record\n", sockfd, chunks);
+            break;
+        }
+
+        chunks++;
+    }
+
+    free(payload);
+
+    if (status < 0)
+        return -1;
+
+    logger_debug("[Socket %d] Loaded snapshot of %d users at LSN %llu from %d chunks\n", sockfd, loader.users, (unsigned long long)*lsn, chunks);
+
+    return loader.users;
+}
+
+// Copies what is sent of a user, with its mutex held. The messages in memory are retained
+void snapshot_copy_user(SNAPSHOT_USER *copy, USER *user)
+{
+    copy->id = user->id;
+    strcpy(copy->username, user->username);
+    copy->sessions_number = user->sessions_number;
+    copy->replication_sequence = user->replication_sequence;
+
+    if (user->followers.count > copy->followers_capacity)
+    {
+        copy->followers_capacity = user->followers.count;
+        copy->followers = (uint32_t *)realloc(copy->followers, copy->followers_capacity * sizeof(uint32_t));
+    }
+    copy->followers_count = 0;
+    for (uint32_t follower_idx = 0; follower_idx < user->followers.length; follower_idx++)
+        if (user->followers.ids[follower_idx] != ID_SET_EMPTY)
+            copy->followers[copy->followers_count++] = user->followers.ids[follower_idx];
+
+    inbox_copy(user, &copy->inbox);
+}
+
+void snapshot_write_user(SNAPSHOT_WRITER *writer, SNAPSHOT_USER *user)
+{
+    uint8_t *cursor;
+
+    snapshot_reserve(writer, SNAPSHOT_RECORD_HEADER_SIZE + MAX_USERNAME_LENGTH + 2 + 10 + 10);
+    cursor = snapshot_put_record(writer, SNAPSHOT_RECORD__USER, user->id);
+    cursor = protocol_put_string(cursor, user->username, sizeof(user->username));
+    cursor = protocol_put_varint(cursor, (uint64_t)user->sessions_number);
+    cursor = protocol_put_varint(cursor, user->replication_sequence);
+    writer->length = cursor - (writer->chunk + SNAPSHOT_CHUNK_HEADER_SIZE);
+
+    // Followers are split in as many records as needed for them to fit in the chunks
+    writer->count = NULL;
+    for (uint32_t follower_idx = 0; follower_idx < user->followers_count; follower_idx++)
+    {
+        size_t follower_size = 5; // At most, for a varint of 32 bits
+
+        if (writer->count == NULL || writer->length + follower_size > SNAPSHOT_CHUNK_SIZE)
+        {
+            snapshot_reserve(writer, SNAPSHOT_RECORD_HEADER_SIZE + 4 + follower_size);
+            cursor = snapshot_put_record(writer, SNAPSHOT_RECORD__FOLLOWERS, user->id);
+            writer->count = cursor;
+            writer->counted = 0;
+            cursor += 4;
+            writer->length = cursor - (writer->chunk + SNAPSHOT_CHUNK_HEADER_SIZE);
+        }
+
+        cursor = writer->chunk + SNAPSHOT_CHUNK_HEADER_SIZE + writer->length;
+        cursor = protocol_put_varint(cursor, user->followers[follower_idx]);
+        writer->length = cursor - (writer->chunk + SNAPSHOT_CHUNK_HEADER_SIZE);
+        snapshot_put_u32(writer->count, ++writer->counted);
+    }
+    writer->count = NULL;
+
+    // Including the ones spilled to disk, which the backup spills again by itself
+    writer->user_id = user->id;
+    inbox_copy_iterate(&user->inbox, &snapshot_write_pending, (void *)writer);
+}
+
+void snapshot_write_pending(NOTIFICATION *notification, void *void_writer)
+{
+    SNAPSHOT_WRITER *writer = (SNAPSHOT_WRITER *)void_writer;
+
+    uint8_t frame[PROTOCOL_MAX_FRAME_SIZE];
+    size_t frame_length = protocol_encode(notification, frame);
+
+    snapshot_reserve(writer, SNAPSHOT_RECORD_HEADER_SIZE + 2 + frame_length);
+    uint8_t *cursor = snapshot_put_record(writer, SNAPSHOT_RECORD__PENDING, writer->user_id);
+    cursor = protocol_put_varint(cursor, frame_length);
+    memcpy(cursor, frame, frame_length);
+    writer->length = (cursor + frame_length) - (writer->chunk + SNAPSHOT_CHUNK_HEADER_SIZE);
+}
+
+// Starts a record of the user with `user_id` in the current chunk, returning where its fields go
+uint8_t *snapshot_put_record(SNAPSHOT_WRITER *writer, SNAPSHOT_RECORD type, uint32_t user_id)
+{
+    uint8_t *cursor = writer->chunk + SNAPSHOT_CHUNK_HEADER_SIZE + writer->length;
+
+    *cursor++ = (uint8_t)type;
+    return protocol_put_varint(cursor, user_id);
+}
+
+// Makes sure the current chunk has `size` free bytes, flushing it otherwise
+void snapshot_reserve(SNAPSHOT_WRITER *writer, size_t size)
+{
+    if (writer->length + size > SNAPSHOT_CHUNK_SIZE)
+        snapshot_flush(writer);
+}
+
+void snapshot_flush(SNAPSHOT_WRITER *writer)
+{
+    if (writer->failed)
+        return;
+
+    snapshot_put_u32(writer->chunk, writer->length);
+    snapshot_put_u32(writer->chunk + 4, crc32_compute(writer->chunk + SNAPSHOT_CHUNK_HEADER_SIZE, writer->length));
+
+    if (snapshot_send_all(writer->sockfd, writer->chunk, SNAPSHOT_CHUNK_HEADER_SIZE + writer->length) < 0)
+    {
+        logger_error("[Socket %d] When sending snapshot chunk %d: %d\n", writer->sockfd, writer->chunks, errno);
+        writer->failed = 1;
+    }
+
+    if (writer->length > 0)
+        writer->chunks++;
+    writer->length = 0;
+    writer->count = NULL;
+}
+
+// Returns 0 if every record was loaded, or -1 if there is an invalid one
+int snapshot_load_chunk(SNAPSHOT_LOADER *loader, uint8_t *payload, size_t length)
+{
+    uint8_t *cursor = payload, *end = payload + length;
+    char username[MAX_USERNAME_LENGTH + 2];
+    uint64_t id, value, sequence;
+    USER *user;
+
+    while (cursor && cursor < end)
+    {
+        SNAPSHOT_RECORD type = (SNAPSHOT_RECORD)*cursor++;
+        if ((cursor = protocol_get_varint(cursor, end, &id)) == NULL || id > UINT32_MAX)
+            return -1;
+
+        if (type == SNAPSHOT_RECORD__USER)
+        {
+            if ((cursor = protocol_get_string(cursor, end, username, sizeof(username))) == NULL ||
+                (cursor = protocol_get_varint(cursor, end, &value)) == NULL ||
+                (cursor = protocol_get_varint(cursor, end, &sequence)) == NULL)
+                return -1;
+
+            int created;
+            if ((user = user_directory_intern(loader->directory, username, (uint32_t)id, &created)) == NULL || user->id != id)
+                return -1;
+
+            // Replicated changes of the user up to this sequence are already in the snapshot
+            user->sessions_number = (int)value;
+            user->replication_sequence = sequence;
+            loader->users += created;
+        }
+
+        // Every other record is of a user which came before
+        if ((user = snapshot_load_user(loader, (uint32_t)id)) == NULL)
+            return -1;
+
+        switch (type)
+        {
+        case SNAPSHOT_RECORD__USER:
+            break;
+        case SNAPSHOT_RECORD__FOLLOWERS:
+            if (end - cursor < 4)
+                return -1;
+            uint32_t count = snapshot_get_u32(cursor);
+            cursor += 4;
+
+            for (uint32_t follower_idx = 0; cursor && follower_idx < count; follower_idx++)
+            {
+                if ((cursor = protocol_get_varint(cursor, end, &value)) == NULL || value == ID_SET_EMPTY || value > UINT32_MAX)
+                    return -1;
+
+                id_set_add(&user->followers, (uint32_t)value);
+            }
+            break;
+        case SNAPSHOT_RECORD__PENDING:
+            if ((cursor = protocol_get_varint(cursor, end, &value)) == NULL || value > (uint64_t)(end - cursor))
+                return -1;
+
+            NOTIFICATION notification;
+            if (protocol_decode(cursor, value, &notification) != (int)value)
+                return -1;
+            cursor += value;
+
+            notification_id_observe(notification.id);
+            if (inbox_push(user, message_create(&notification)))
+                inbox_spill(user);
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    return cursor ? 0 : -1;
+}
+
+// Returns the USER of a record, or NULL if there is none with the ID
+USER *snapshot_load_user(SNAPSHOT_LOADER *loader, uint32_t id)
+{
+    if (loader->user && loader->user->id == id)
+        return loader->user;
+
+    return loader->user = user_directory_get(loader->directory, id);
+}
+
+int snapshot_send_all(int sockfd, uint8_t *buffer, size_t length)
+{
+    size_t bytes_wrote = 0;
+
+    while (bytes_wrote < length)
+    {
+        int status = send(sockfd, buffer + bytes_wrote, length - bytes_wrote, MSG_NOSIGNAL);
+        if (status < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        bytes_wrote += status;
+    }
+
+    return 0;
+}
+
+int snapshot_receive_all(int sockfd, uint8_t *buffer, size_t length)
+{
+    size_t bytes_read = 0;
+
+    while (bytes_read < length)
+    {
+        int status = recv(sockfd, buffer + bytes_read, length - bytes_read, 0);
+        if (status < 0 && errno == EINTR)
+            continue;
+        if (status <= 0)
+        {
+            logger_error("[Socket %d] Snapshot ended before it was complete\n", sockfd);
+            return -1;
+        }
+
+        bytes_read += status;
+    }
+
+    return 0;
+}
+
+void snapshot_put_u32(uint8_t *buffer, uint32_t value)
+{
+    buffer[0] = (uint8_t)value;
+    buffer[1] = (uint8_t)(value >> 8);
+    buffer[2] = (uint8_t)(value >> 16);
+    buffer[3] = (uint8_t)(value >> 24);
+}
+
+uint32_t snapshot_get_u32(uint8_t *buffer)
+{
+    return (uint32_t)buffer[0] | ((uint32_t)buffer[1] << 8) | ((uint32_t)buffer[2] << 16) | ((uint32_t)buffer[3] << 24);
+}
@@ -0,0 +1,718 @@
+#include "timeline.h"
+
+#include "exit_errors.h"
+#include "logger.h"
+#include "protocol.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define LOCK(mutex) pthread_mutex_lock(&mutex)
+#define UNLOCK(mutex) pthread_mutex_unlock(&mutex)
+
+#define TIMELINE_READ_BUFFER_SIZE 65536
+
+typedef struct timeline_segment
+{
+    uint32_t seq; // Also its file name
+    int fd;
+    uint64_t length;
+    uint32_t records;
+    uint32_t live;   // Records still in the index of their user
+    int64_t newest;  // Newest timestamp of its records
+    int dirty;       // Written since it was last synced
+} TIMELINE_SEGMENT;
+
+typedef struct timeline_store
+{
+    char directory[64];
+    TIMELINE_SEGMENT *segments; // Sorted by sequence number. Posts are appended to the last one
+    uint32_t segments_number;
+    uint32_t segments_capacity;
+    pthread_mutex_t MUTEX_TIMELINE; // Guards the segments. Taken after the mutex of a user, never before
+} TIMELINE_STORE;
+
+TIMELINE_STORE timeline = {.MUTEX_TIMELINE = PTHREAD_MUTEX_INITIALIZER};
+
+// Position of an author while merging a home feed, at its newest post not read yet
+typedef struct timeline_cursor
+{
+    USER *author;
+    uint64_t next_id;
+} TIMELINE_CURSOR;
+
+// Passed along while walking the records of a segment
+typedef struct timeline_scan
+{
+    USER_DIRECTORY *directory;
+    int64_t oldest; // Timestamp before which posts are expired
+    uint32_t posts; // Loaded or moved
+    int failed;
+} TIMELINE_SCAN;
+
+typedef void (*TIMELINE_RECORD_FUNCTION)(TIMELINE_SEGMENT *, NOTIFICATION *, uint32_t, uint8_t *, size_t, TIMELINE_SCAN *);
+
+TIMELINE_SEGMENT *timeline_segment_open(uint32_t, int);
+TIMELINE_SEGMENT *timeline_segment_find(uint32_t);
+void timeline_segment_remove(uint32_t);
+uint64_t timeline_segment_scan(TIMELINE_SEGMENT *, TIMELINE_RECORD_FUNCTION, TIMELINE_SCAN *);
+void timeline_segment_path(uint32_t, char *, size_t);
+int timeline_sync_segments(void);
+int timeline_write(uint8_t *, size_t, TIMELINE_ENTRY *);
+int timeline_read_entry(TIMELINE_ENTRY *, NOTIFICATION *);
+void timeline_trim(USER *);
+void timeline_drop_removed(USER *);
+int timeline_entry_has_segment(TIMELINE_ENTRY *, void *);
+void timeline_compact(uint32_t, USER_DIRECTORY *);
+void timeline_load_record(TIMELINE_SEGMENT *, NOTIFICATION *, uint32_t, uint8_t *, size_t, TIMELINE_SCAN *);
+void timeline_compact_record(TIMELINE_SEGMENT *, NOTIFICATION *, uint32_t, uint8_t *, size_t, TIMELINE_SCAN *);
+int64_t timeline_oldest_timestamp(void);
+uint64_t timeline_previous_id(USER *, uint64_t, int64_t);
+void timeline_cursor_sift_down(TIMELINE_CURSOR *, uint32_t, uint32_t);
+int compare_segment_seq(const void *, const void *);
+
+/// Opens the segments of this server, creating its directory if needed, and rebuilds the index
+/// of every user from them. Must be called once the users were loaded, before anything is posted
+///
+/// @param server_index Index of this server in the ring, as servers may share a directory
+/// @param directory USER_DIRECTORY* with the authors of the posts
+void timeline_open(int server_index, USER_DIRECTORY *directory)
+{
+    snprintf(timeline.directory, sizeof(timeline.directory), "%s-%d", TIMELINE_DIRECTORY_PATH, server_index);
+
+    if (mkdir(timeline.directory, 0700) < 0 && errno != EEXIST)
+    {
+        logger_error("When creating the timeline directory %s: %d\n", timeline.directory, errno);
+        exit(ERROR_OPENING_TIMELINE);
+    }
+
+    DIR *segments_directory = opendir(timeline.directory);
+    if (!segments_directory)
+    {
+        logger_error("When opening the timeline directory %s: %d\n", timeline.directory, errno);
+        exit(ERROR_OPENING_TIMELINE);
+    }
+
+    uint32_t *seqs = NULL, seqs_number = 0, seqs_capacity = 0;
+    struct dirent *file;
+    while ((file = readdir(segments_directory)) != NULL)
+    {
+        char *end;
+        unsigned long seq = strtoul(file->d_name, &end, 10);
+        if (file->d_name[0] == '.' || *end != '\0' || seq == 0)
+            continue;
+
+        if (seqs_number == seqs_capacity)
+        {
+            seqs_capacity = seqs_capacity ? seqs_capacity * 2 : 16;
+            seqs = (uint32_t *)realloc(seqs, seqs_capacity * sizeof(uint32_t));
+        }
+        seqs[seqs_number++] = (uint32_t)seq;
+    }
+    closedir(segments_directory);
+    qsort(seqs, seqs_number, sizeof(uint32_t), &compare_segment_seq);
+
+    // Oldest first, so a post moved by a compaction ends in its newest copy
+    TIMELINE_SCAN scan = {.directory = directory, .oldest = timeline_oldest_timestamp()};
+    for (uint32_t seq_idx = 0; seq_idx < seqs_number; seq_idx++)
+    {
+        TIMELINE_SEGMENT *segment = timeline_segment_open(seqs[seq_idx], 0);
+        if (!segment)
+            continue;
+
+        uint64_t valid_length = timeline_segment_scan(segment, &timeline_load_record, &scan);
+        if (valid_length < segment->length)
+        {
+            logger_warn("Truncating %llu bytes of a torn post at the end of segment %u\n", (unsigned long long)(segment->length - valid_length), segment->seq);
+            if (ftruncate(segment->fd, valid_length) < 0)
+                logger_error("When truncating segment %u: %d\n", segment->seq, errno);
+            segment->length = valid_length;
+        }
+    }
+    free(seqs);
+
+    uint32_t segments_number = timeline.segments_number;
+    for (uint32_t segment_idx = 0; segment_idx < segments_number; segment_idx++)
+        scan.posts += timeline.segments[segment_idx].live;
+
+    if (segments_number == 0 || timeline.segments[segments_number - 1].length >= TIMELINE_SEGMENT_SIZE)
+    {
+        uint32_t seq = segments_number ? timeline.segments[segments_number - 1].seq + 1 : 1;
+        if (!timeline_segment_open(seq, 1))
+            exit(ERROR_OPENING_TIMELINE);
+    }
+
+    logger_info("Loaded %u posts from %u segments of %s\n", scan.posts, segments_number, timeline.directory);
+}
+
+/// Appends a post of a user to the store and to its index, and keeps it in the cache of its newest ones
+///
+/// @param user USER* who posted it, whose mutex must be held
+/// @param message MESSAGE* posted, whose reference is now owned by the cache
+void timeline_append(USER *user, MESSAGE *message)
+{
+    NOTIFICATION notification;
+    uint8_t frame[PROTOCOL_MAX_FRAME_SIZE];
+    message_to_notification(message, user->username, &notification);
+    size_t length = protocol_encode(&notification, frame);
+
+    TIMELINE_ENTRY entry = {.id = message->id, .timestamp = (int64_t)message->timestamp};
+
+    LOCK(timeline.MUTEX_TIMELINE);
+    int status = timeline_write(frame, length, &entry);
+    UNLOCK(timeline.MUTEX_TIMELINE);
+
+    if (status == 0)
+    {
+        timeline_index_insert(&user->timeline, &entry);
+        timeline_trim(user);
+    }
+
+    deque_push_back(&user->messages, (void *)message);
+    if (user->messages.size > TIMELINE_CACHE_SIZE)
+        message_release((MESSAGE *)deque_pop_front(&user->messages));
+}
+
+/// Reads the posts of a user from the newest to the oldest, from its cache or from the segments
+///
+/// @param user USER* whose posts are read, whose mutex must be held
+/// @param before_id Only posts with smaller IDs are read, or every one if it is 0
+/// @param notifications Where the posts are written
+/// @param max How many posts fit in `notifications`
+///
+/// @returns How many posts were read
+int timeline_read(USER *user, uint64_t before_id, NOTIFICATION *notifications, int max)
+{
+    uint32_t position = before_id ? timeline_index_lower_bound(&user->timeline, before_id) : user->timeline.length;
+    int64_t oldest = timeline_oldest_timestamp();
+    int count = 0;
+
+    // The cache is walked backwards along with the index
+    DEQUE_NODE *cached = user->messages.tail;
+    while (position > 0 && count < max)
+    {
+        TIMELINE_ENTRY *entry = timeline_index_get(&user->timeline, --position);
+        if (entry->timestamp < oldest)
+            break;
+
+        while (cached && ((MESSAGE *)cached->val)->id > entry->id)
+            cached = cached->prev;
+
+        if (cached && ((MESSAGE *)cached->val)->id == entry->id)
+        {
+            message_to_notification((MESSAGE *)cached->val, user->username, &notifications[count++]);
+            continue;
+        }
+
+        int status = timeline_read_entry(entry, &notifications[count]);
+        if (status == 0)
+            count++;
+        else if (status == -1)
+        {
+            // The retention policies removed its segment, and most likely more posts with it, so
+            // every entry of a removed segment is dropped at once and the walk goes on from there
+            uint64_t id = entry->id;
+            timeline_drop_removed(user);
+            position = timeline_index_lower_bound(&user->timeline, id);
+        }
+    }
+
+    return count;
+}
+
+/// Reads the home feed of a user, its posts and the ones of who it follows, from the newest to the oldest.
+/// Authors are merged by ID through their indexes, so the cost depends on the page and on how many
+/// users it follows, not on how much they posted
+///
+/// @param directory USER_DIRECTORY* with the authors
+/// @param user USER* whose feed is read, whose mutex must not be held, as the one of each author is taken
+/// @param before_id Only posts with smaller IDs are read, or every one if it is 0
+/// @param notifications Where the posts are written
+/// @param max How many posts fit in `notifications`
+///
+/// @returns How many posts were read
+int timeline_read_feed(USER_DIRECTORY *directory, USER *user, uint64_t before_id, NOTIFICATION *notifications, int max)
+{
+    // The authors are copied, so that we never hold the mutexes of two users
+    LOCK(user->mutex);
+    uint32_t authors_number = 0;
+    uint32_t *authors = (uint32_t *)malloc((user->following.count + 1) * sizeof(uint32_t));
+    authors[authors_number++] = user->id;
+    for (uint32_t following_idx = 0; following_idx < user->following.length; following_idx++)
+        if (user->following.ids[following_idx] != ID_SET_EMPTY)
+            authors[authors_number++] = user->following.ids[following_idx];
+    UNLOCK(user->mutex);
+
+    int64_t oldest = timeline_oldest_timestamp();
+    uint32_t cursors_number = 0;
+    TIMELINE_CURSOR *cursors = (TIMELINE_CURSOR *)malloc(authors_number * sizeof(TIMELINE_CURSOR));
+    for (uint32_t author_idx = 0; author_idx < authors_number; author_idx++)
+    {
+        USER *author = user_directory_get(directory, authors[author_idx]);
+        if (!author)
+            continue;
+
+        LOCK(author->mutex);
+        uint64_t next_id = timeline_previous_id(author, before_id, oldest);
+        UNLOCK(author->mutex);
+
+        if (next_id)
+            cursors[cursors_number++] = (TIMELINE_CURSOR){.author = author, .next_id = next_id};
+    }
+    free(authors);
+
+    // Max-heap by the next ID, so the newest post of every author is always on top
+    for (uint32_t cursor_idx = cursors_number / 2; cursor_idx-- > 0;)
+        timeline_cursor_sift_down(cursors, cursors_number, cursor_idx);
+
+    int count = 0;
+    while (cursors_number > 0 && count < max)
+    {
+        TIMELINE_CURSOR *top = &cursors[0];
+        NOTIFICATION *notification = &notifications[count];
+
+        LOCK(top->author->mutex);
+        int read = timeline_read(top->author, top->next_id + 1, notification, 1);
+        if (read && notification->id == top->next_id)
+        {
+            count++;
+            top->next_id = timeline_previous_id(top->author, notification->id, oldest);
+        }
+        else
+            // Trimmed or unreadable since we looked, so it goes back with the post we got instead
+            top->next_id = read ? notification->id : 0;
+        UNLOCK(top->author->mutex);
+
+        if (top->next_id == 0)
+            cursors[0] = cursors[--cursors_number];
+        timeline_cursor_sift_down(cursors, cursors_number, 0);
+    }
+    free(cursors);
+
+    return count;
+}
+
+/// Applies the retention policies, removing the segments whose posts all expired and the oldest
+/// ones beyond TIMELINE_MAX_SEGMENTS, and compacts the segments left with few live posts.
+/// Runs in the background, and only one of it at a time
+///
+/// @param directory USER_DIRECTORY* with the authors of the posts
+void timeline_maintain(USER_DIRECTORY *directory)
+{
+    int64_t oldest = timeline_oldest_timestamp();
+    uint32_t removed = 0, *compacted = NULL, compacted_number = 0;
+
+    LOCK(timeline.MUTEX_TIMELINE);
+
+    // The last segment is never removed, as posts are appended to it
+    for (uint32_t segment_idx = 0; segment_idx + 1 < timeline.segments_number;)
+    {
+        TIMELINE_SEGMENT *segment = &timeline.segments[segment_idx];
+        if (segment->newest < oldest || segment->live == 0 || timeline.segments_number > TIMELINE_MAX_SEGMENTS)
+        {
+            timeline_segment_remove(segment->seq);
+            removed++;
+        }
+        else
+            segment_idx++;
+    }
+
+    compacted = (uint32_t *)malloc(timeline.segments_number * sizeof(uint32_t));
+    for (uint32_t segment_idx = 0; segment_idx + 1 < timeline.segments_number; segment_idx++)
+    {
+        TIMELINE_SEGMENT *segment = &timeline.segments[segment_idx];
+        if ((uint64_t)segment->live * 100 < (uint64_t)segment->records * TIMELINE_COMPACTION_LIVE_PERCENT)
+            compacted[compacted_number++] = segment->seq;
+    }
+
+    UNLOCK(timeline.MUTEX_TIMELINE);
+
+    if (removed > 0)
+        logger_info("Removed %u timeline segments by the retention policies\n", removed);
+
+    for (uint32_t compacted_idx = 0; compacted_idx < compacted_number; compacted_idx++)
+        timeline_compact(compacted[compacted_idx], directory);
+    free(compacted);
+}
+
+/// Syncs every segment written since the last call
+void timeline_sync(void)
+{
+    LOCK(timeline.MUTEX_TIMELINE);
+    timeline_sync_segments();
+    UNLOCK(timeline.MUTEX_TIMELINE);
+}
+
+// Syncs every dirty segment with MUTEX_TIMELINE held, returning -1 if any of them failed
+int timeline_sync_segments(void)
+{
+    int status = 0;
+    for (uint32_t segment_idx = 0; segment_idx < timeline.segments_number; segment_idx++)
+    {
+        TIMELINE_SEGMENT *segment = &timeline.segments[segment_idx];
+        if (!segment->dirty)
+            continue;
+
+        if (fdatasync(segment->fd) < 0)
+        {
+            logger_error("When syncing timeline segment %u: %d\n", segment->seq, errno);
+            status = -1;
+        }
+        else
+            segment->dirty = 0;
+    }
+
+    return status;
+}
+
+// Appends a frame to the last segment, starting a new one if it is full, with MUTEX_TIMELINE held.
+// Writes where it went to `entry`, and returns -1 if it couldn't be written
+int timeline_write(uint8_t *frame, size_t length, TIMELINE_ENTRY *entry)
+{
+    if (timeline.segments_number == 0)
+        return -1;
+
+    TIMELINE_SEGMENT *segment = &timeline.segments[timeline.segments_number - 1];
+    if (segment->length >= TIMELINE_SEGMENT_SIZE)
+    {
+        // If it can't be created, the full one keeps being used
+        uint32_t seq = segment->seq + 1;
+        if (timeline_segment_open(seq, 1))
+            logger_debug("Started timeline segment %u\n", seq);
+        segment = &timeline.segments[timeline.segments_number - 1];
+    }
+
+    ssize_t written = write(segment->fd, frame, length);
+    if (written != (ssize_t)length)
+    {
+        logger_error("When appending a post to timeline segment %u: %d\n", segment->seq, errno);
+
+        // A partial write would leave a broken frame behind
+        if (written > 0 && ftruncate(segment->fd, segment->length) < 0)
+            logger_error("When truncating segment %u back to %llu bytes: %d\n", segment->seq, (unsigned long long)segment->length, errno);
+        return -1;
+    }
+
+    entry->segment = segment->seq;
+    entry->offset = (uint32_t)segment->length;
+
+    segment->length += length;
+    segment->records++;
+    segment->live++;
+    segment->dirty = 1;
+    if (entry->timestamp > segment->newest)
+        segment->newest = entry->timestamp;
+
+    return 0;
+}
+
+// Reads the frame of an entry, returning -1 if its segment was removed or -2 if the frame is broken
+int timeline_read_entry(TIMELINE_ENTRY *entry, NOTIFICATION *notification)
+{
+    uint8_t frame[PROTOCOL_MAX_FRAME_SIZE];
+    ssize_t bytes_read = -1;
+
+    // Held while reading, so that the segment isn't removed meanwhile
+    LOCK(timeline.MUTEX_TIMELINE);
+    TIMELINE_SEGMENT *segment = timeline_segment_find(entry->segment);
+    if (segment)
+        bytes_read = pread(segment->fd, frame, sizeof(frame), entry->offset);
+    UNLOCK(timeline.MUTEX_TIMELINE);
+
+    if (!segment)
+        return -1;
+    if (bytes_read <= 0 || protocol_decode(frame, bytes_read, notification) <= 0 || notification->id != entry->id)
+        return -2;
+
+    return 0;
+}
+
+// Drops the oldest posts of a user which expired or are beyond TIMELINE_MAX_POSTS, with its mutex held
+void timeline_trim(USER *user)
+{
+    int64_t oldest = timeline_oldest_timestamp();
+    TIMELINE_ENTRY entry;
+
+    while (user->timeline.length > 0 &&
+           (user->timeline.length > TIMELINE_MAX_POSTS || timeline_index_get(&user->timeline, 0)->timestamp < oldest))
+    {
+        timeline_index_pop_front(&user->timeline, &entry);
+
+        LOCK(timeline.MUTEX_TIMELINE);
+        TIMELINE_SEGMENT *segment = timeline_segment_find(entry.segment);
+        if (segment)
+            segment->live--;
+        UNLOCK(timeline.MUTEX_TIMELINE);
+    }
+}
+
+// Drops the entries of a user whose segment was removed, with its mutex held
+void timeline_drop_removed(USER *user)
+{
+    LOCK(timeline.MUTEX_TIMELINE);
+    uint32_t dropped = timeline_index_filter(&user->timeline, &timeline_entry_has_segment, NULL);
+    UNLOCK(timeline.MUTEX_TIMELINE);
+
+    logger_debug("Dropped %u posts of %s whose timeline segment was removed\n", dropped, user->username);
+}
+
+// Whether the segment of an entry still exists, with MUTEX_TIMELINE held
+int timeline_entry_has_segment(TIMELINE_ENTRY *entry, void *arg)
+{
+    return timeline_segment_find(entry->segment) != NULL;
+}
+
+// Moves the live posts of a segment to the last one, and removes it. Posts can still be appended
+// meanwhile, and the segment is only read, so its descriptor is used without the mutex
+void timeline_compact(uint32_t seq, USER_DIRECTORY *directory)
+{
+    LOCK(timeline.MUTEX_TIMELINE);
+    TIMELINE_SEGMENT *found = timeline_segment_find(seq);
+    TIMELINE_SEGMENT segment = found ? *found : (TIMELINE_SEGMENT){.fd = -1};
+    UNLOCK(timeline.MUTEX_TIMELINE);
+
+    if (segment.fd < 0)
+        return;
+
+    TIMELINE_SCAN scan = {.directory = directory, .oldest = timeline_oldest_timestamp()};
+    timeline_segment_scan(&segment, &timeline_compact_record, &scan);
+    if (scan.failed)
+    {
+        logger_error("Could not compact timeline segment %u, keeping it\n", seq);
+        return;
+    }
+
+    // The moved posts must be on disk, along with the name of a segment started meanwhile,
+    // before their only other copy is deleted
+    LOCK(timeline.MUTEX_TIMELINE);
+    int fd = open(timeline.directory, O_RDONLY | O_DIRECTORY);
+    int status = timeline_sync_segments();
+    if (fd < 0 || fsync(fd) < 0)
+        status = -1;
+    if (status == 0)
+        timeline_segment_remove(seq);
+    UNLOCK(timeline.MUTEX_TIMELINE);
+
+    if (fd >= 0)
+        close(fd);
+
+    if (status < 0)
+    {
+        logger_error("Could not sync the posts moved from timeline segment %u, keeping it: %d\n", seq, errno);
+        return;
+    }
+
+    logger_info("Compacted timeline segment %u, moving %u of its %u posts\n", seq, scan.posts, segment.records);
+}
+
+void timeline_load_record(TIMELINE_SEGMENT *segment, NOTIFICATION *notification, uint32_t offset, uint8_t *frame, size_t length, TIMELINE_SCAN *scan)
+{
+    segment->records++;
+    if ((int64_t)notification->timestamp > segment->newest)
+        segment->newest = (int64_t)notification->timestamp;
+
+    USER *user = user_directory_find(scan->directory, notification->author);
+    if (!user || (int64_t)notification->timestamp < scan->oldest)
+        return;
+
+    // A compaction which didn't finish leaves two copies, and the newest one is used
+    TIMELINE_ENTRY *entry = timeline_index_find(&user->timeline, notification->id);
+    if (entry)
+    {
+        TIMELINE_SEGMENT *previous = timeline_segment_find(entry->segment);
+        if (previous)
+            previous->live--;
+    }
+    else
+    {
+        TIMELINE_ENTRY new_entry = {.id = notification->id, .timestamp = (int64_t)notification->timestamp};
+        entry = timeline_index_insert(&user->timeline, &new_entry);
+    }
+
+    entry->segment = segment->seq;
+    entry->offset = offset;
+    segment->live++;
+
+    if (user->timeline.length > TIMELINE_MAX_POSTS)
+        timeline_trim(user);
+}
+
+void timeline_compact_record(TIMELINE_SEGMENT *segment, NOTIFICATION *notification, uint32_t offset, uint8_t *frame, size_t length, TIMELINE_SCAN *scan)
+{
+    USER *user = user_directory_find(scan->directory, notification->author);
+    if (!user || (int64_t)notification->timestamp < scan->oldest)
+        return;
+
+    LOCK(user->mutex);
+
+    // Posts dropped from the index, or moved already, are left behind
+    TIMELINE_ENTRY *entry = timeline_index_find(&user->timeline, notification->id);
+    if (entry && entry->segment == segment->seq && entry->offset == offset)
+    {
+        TIMELINE_ENTRY moved = *entry;
+
+        LOCK(timeline.MUTEX_TIMELINE);
+        if (timeline_write(frame, length, &moved) == 0)
+        {
+            *entry = moved;
+            scan->posts++;
+        }
+        else
+            scan->failed = 1;
+        UNLOCK(timeline.MUTEX_TIMELINE);
+    }
+
+    UNLOCK(user->mutex);
+}
+
+// Walks the frames of a segment from its start, returning the length of the valid ones
+uint64_t timeline_segment_scan(TIMELINE_SEGMENT *segment, TIMELINE_RECORD_FUNCTION function, TIMELINE_SCAN *scan)
+{
+    uint8_t *buffer = (uint8_t *)malloc(TIMELINE_READ_BUFFER_SIZE);
+    uint64_t buffer_offset = 0; // Where `buffer` starts in the segment
+    size_t length = 0;
+    ssize_t bytes_read;
+    int frame_length = 0;
+    NOTIFICATION notification;
+
+    while (frame_length >= 0 && (bytes_read = pread(segment->fd, buffer + length, TIMELINE_READ_BUFFER_SIZE - length, buffer_offset + length)) > 0)
+    {
+        length += bytes_read;
+
+        size_t offset = 0;
+        while ((frame_length = protocol_decode(buffer + offset, length - offset, &notification)) > 0)
+        {
+            function(segment, &notification, (uint32_t)(buffer_offset + offset), buffer + offset, frame_length, scan);
+            offset += frame_length;
+        }
+
+        buffer_offset += offset;
+        length -= offset;
+        memmove(buffer, buffer + offset, length);
+    }
+    free(buffer);
+
+    return buffer_offset;
+}
+
+// Opens a segment and adds it after the others, with MUTEX_TIMELINE held. New ones are created empty
+TIMELINE_SEGMENT *timeline_segment_open(uint32_t seq, int create)
+{
+    char path[sizeof(timeline.directory) + 16];
+    timeline_segment_path(seq, path, sizeof(path));
+
+    int fd = open(path, O_RDWR | O_APPEND | (create ? O_CREAT | O_TRUNC : 0), 0600);
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) < 0)
+    {
+        logger_error("When opening timeline segment %s: %d\n", path, errno);
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+
+    if (timeline.segments_number == timeline.segments_capacity)
+    {
+        timeline.segments_capacity = timeline.segments_capacity ? timeline.segments_capacity * 2 : 16;
+        timeline.segments = (TIMELINE_SEGMENT *)realloc(timeline.segments, timeline.segments_capacity * sizeof(TIMELINE_SEGMENT));
+    }
+
+    TIMELINE_SEGMENT *segment = &timeline.segments[timeline.segments_number++];
+    memset(segment, 0, sizeof(TIMELINE_SEGMENT));
+    segment->seq = seq;
+    segment->fd = fd;
+    segment->length = (uint64_t)status.st_size;
+
+    return segment;
+}
+
+// Binary search of a segment by its sequence number, with MUTEX_TIMELINE held
+TIMELINE_SEGMENT *timeline_segment_find(uint32_t seq)
+{
+    uint32_t low = 0, high = timeline.segments_number;
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        if (timeline.segments[middle].seq < seq)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    return low < timeline.segments_number && timeline.segments[low].seq == seq ? &timeline.segments[low] : NULL;
+}
+
+// Closes and deletes a segment, with MUTEX_TIMELINE held. Entries still pointing to it are
+// dropped when they are read or trimmed
+void timeline_segment_remove(uint32_t seq)
+{
+    TIMELINE_SEGMENT *segment = timeline_segment_find(seq);
+    if (!segment)
+        return;
+
+    char path[sizeof(timeline.directory) + 16];
+    timeline_segment_path(seq, path, sizeof(path));
+
+    close(segment->fd);
+    if (unlink(path) < 0)
+        logger_error("When removing timeline segment %s: %d\n", path, errno);
+
+    uint32_t segment_idx = segment - timeline.segments;
+    memmove(segment, segment + 1, (timeline.segments_number - segment_idx - 1) * sizeof(TIMELINE_SEGMENT));
+    timeline.segments_number--;
+}
+
+void timeline_segment_path(uint32_t seq, char *path, size_t size)
+{
+    snprintf(path, size, "%s/%010u", timeline.directory, seq);
+}
+
+int64_t timeline_oldest_timestamp(void)
+{
+    return (int64_t)time(NULL) - TIMELINE_RETENTION_SECONDS;
+}
+
+// ID of the newest post of a user older than `before_id` (or than every one if it is 0), or 0 if there
+// is none which didn't expire. Its mutex must be held
+uint64_t timeline_previous_id(USER *user, uint64_t before_id, int64_t oldest)
+{
+    uint32_t position = before_id ? timeline_index_lower_bound(&user->timeline, before_id) : user->timeline.length;
+    if (position == 0)
+        return 0;
+
+    TIMELINE_ENTRY *entry = timeline_index_get(&user->timeline, position - 1);
+    return entry->timestamp < oldest ? 0 : entry->id;
+}
+
+void timeline_cursor_sift_down(TIMELINE_CURSOR *cursors, uint32_t length, uint32_t cursor_idx)
+{
+    while (1)
+    {
+        uint32_t newest_idx = cursor_idx, left_idx = 2 * cursor_idx + 1, right_idx = left_idx + 1;
+        if (left_idx < length && cursors[left_idx].next_id > cursors[newest_idx].next_id)
+            newest_idx = left_idx;
+        if (right_idx < length && cursors[right_idx].next_id > cursors[newest_idx].next_id)
+            newest_idx = right_idx;
+        if (newest_idx == cursor_idx)
+            return;
+
+        TIMELINE_CURSOR swap = cursors[cursor_idx];
+        cursors[cursor_idx] = cursors[newest_idx];
+        cursors[newest_idx] = swap;
+        cursor_idx = newest_idx;
+    }
+}
+
+int compare_segment_seq(const void *first, const void *second)
+{
+    uint32_t first_seq = *(const uint32_t *)first, second_seq = *(const uint32_t *)second;
+
+    return first_seq < second_seq ? -1 : first_seq > second_seq;
+}
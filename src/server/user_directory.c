@@ -0,0 +1,163 @@
+#include "user_directory.h"
+
+#include "logger.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define LOCK(mutex) pthread_mutex_lock(&mutex)
+#define UNLOCK(mutex) pthread_mutex_unlock(&mutex)
+
+/// Creates an empty USER_DIRECTORY
+///
+/// @returns The USER_DIRECTORY* created
+USER_DIRECTORY *user_directory_create(void)
+{
+    USER_DIRECTORY *directory = (USER_DIRECTORY *)malloc(sizeof(USER_DIRECTORY));
+
+    directory->by_name = hash_init();
+    for (int page_idx = 0; page_idx < USER_DIRECTORY_MAX_PAGES; page_idx++)
+        atomic_init(&directory->pages[page_idx], NULL);
+    atomic_init(&directory->last_id, USER_ID_NONE);
+    pthread_mutex_init(&directory->MUTEX_INTERN, NULL);
+
+    return directory;
+}
+
+/// Finds a user by its username
+///
+/// @param directory USER_DIRECTORY* to look in
+/// @param username Username of the user
+///
+/// @returns The USER*, or NULL if there is no user with this username
+USER *user_directory_find(USER_DIRECTORY *directory, char *username)
+{
+    HASH_NODE *node = hash_find(directory->by_name, username);
+
+    return node ? (USER *)node->value : NULL;
+}
+
+/// Finds a user by its ID
+///
+/// @param directory USER_DIRECTORY* to look in
+/// @param id ID of the user
+///
+/// @returns The USER*, or NULL if there is no user with this ID
+USER *user_directory_get(USER_DIRECTORY *directory, uint32_t id)
+{
+    if (id == USER_ID_NONE || id / USER_DIRECTORY_PAGE_SIZE >= USER_DIRECTORY_MAX_PAGES)
+        return NULL;
+
+    _Atomic(USER *) *page = atomic_load_explicit(&directory->pages[id / USER_DIRECTORY_PAGE_SIZE], memory_order_acquire);
+    if (!page)
+        return NULL;
+
+    return atomic_load_explicit(&page[id % USER_DIRECTORY_PAGE_SIZE], memory_order_acquire);
+}
+
+/// Finds a user by its username, creating it if it doesn't exist yet
+///
+/// @param directory USER_DIRECTORY* to look in
+/// @param username Username of the user
+/// @param id ID for the user if it is created, or USER_ID_NONE for the next free one.
+///           Backups use the ID given by the primary, so that every server agrees on them
+/// @param created Where to write if the user was created now, may be NULL
+///
+/// @returns The USER*, or NULL if the username is too long or the ID is already used by another user
+USER *user_directory_intern(USER_DIRECTORY *directory, char *username, uint32_t id, int *created)
+{
+    if (created)
+        *created = 0;
+
+    if (strlen(username) > HANDLE_MAX_SIZE)
+    {
+        logger_error("Can't create %s, because it is longer than %d characters\n", username, HANDLE_MAX_SIZE);
+        return NULL;
+    }
+
+    USER *user = user_directory_find(directory, username);
+    if (user)
+        return user;
+
+    LOCK(directory->MUTEX_INTERN);
+
+    // Someone may have created it while we were waiting
+    if ((user = user_directory_find(directory, username)))
+    {
+        UNLOCK(directory->MUTEX_INTERN);
+        return user;
+    }
+
+    uint32_t last_id = atomic_load_explicit(&directory->last_id, memory_order_relaxed);
+    if (id == USER_ID_NONE)
+        id = last_id + 1;
+
+    if (id / USER_DIRECTORY_PAGE_SIZE >= USER_DIRECTORY_MAX_PAGES || user_directory_get(directory, id))
+    {
+        logger_error("Can't give the ID %u to %s, because it is already used or too big\n", id, username);
+        UNLOCK(directory->MUTEX_INTERN);
+        return NULL;
+    }
+
+    _Atomic(USER *) *page = atomic_load_explicit(&directory->pages[id / USER_DIRECTORY_PAGE_SIZE], memory_order_relaxed);
+    if (!page)
+    {
+        page = (_Atomic(USER *) *)malloc(USER_DIRECTORY_PAGE_SIZE * sizeof(_Atomic(USER *)));
+        for (int user_idx = 0; user_idx < USER_DIRECTORY_PAGE_SIZE; user_idx++)
+            atomic_init(&page[user_idx], NULL);
+        atomic_store_explicit(&directory->pages[id / USER_DIRECTORY_PAGE_SIZE], page, memory_order_release);
+    }
+
+    user = init_user();
+    strcpy(user->username, username);
+    user->id = id;
+    user->address = hash_address(user->username);
+
+    // Published by ID first, so that anyone who finds it by name can also find it by ID
+    atomic_store_explicit(&page[id % USER_DIRECTORY_PAGE_SIZE], user, memory_order_release);
+    if (id > last_id)
+        atomic_store_explicit(&directory->last_id, id, memory_order_release);
+    hash_insert(directory->by_name, user->username, (void *)user);
+
+    UNLOCK(directory->MUTEX_INTERN);
+
+    if (created)
+        *created = 1;
+
+    return user;
+}
+
+/// Biggest ID in the directory, so that every user can be walked with `user_directory_get`
+///
+/// @param directory USER_DIRECTORY* to look in
+///
+/// @returns The biggest ID, or USER_ID_NONE if there are no users
+uint32_t user_directory_last_id(USER_DIRECTORY *directory)
+{
+    return atomic_load_explicit(&directory->last_id, memory_order_acquire);
+}
+
+/// Builds the `following` set of every user from the `followers` ones, which are the only ones
+/// persisted. Must be called once the state was loaded, before the users are shared with other threads
+///
+/// @param directory USER_DIRECTORY* whose users are linked
+void user_directory_link_following(USER_DIRECTORY *directory)
+{
+    uint32_t last_id = user_directory_last_id(directory), edges = 0;
+
+    for (uint32_t id = 1; id <= last_id; id++)
+    {
+        USER *user = user_directory_get(directory, id);
+        if (!user)
+            continue;
+
+        for (uint32_t follower_idx = 0; follower_idx < user->followers.length; follower_idx++)
+        {
+            USER *follower = user_directory_get(directory, user->followers.ids[follower_idx]);
+            if (follower && id_set_add(&follower->following, user->id))
+                edges++;
+        }
+    }
+
+    logger_info("Linked %u follows of %u users\n", edges, last_id);
+}
@@ -0,0 +1,591 @@
+#include "wal.h"
+
+#include "crc32.h"
+#include "exit_errors.h"
+#include "inbox.h"
+#include "logger.h"
+#include "message.h"
+#include "notification_id.h"
+#include "protocol.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#define LOCK(mutex) pthread_mutex_lock(&mutex)
+#define UNLOCK(mutex) pthread_mutex_unlock(&mutex)
+
+#define WAL_MAX_PAYLOAD_SIZE (1 + 10 + 2 + PROTOCOL_MAX_FRAME_SIZE) // A MESSAGE is the biggest record
+#define WAL_READ_BUFFER_SIZE 65536
+#define WAL_INITIAL_BUFFER_SIZE 65536
+
+typedef struct wal
+{
+    int fd; // -1 until it is opened
+    char path[64];
+    char rotated_path[72]; // Previous file, kept until a checkpoint has saved everything in it
+    uint32_t epoch;        // Incremented every time the file is replaced, guarded by MUTEX_WAL
+    uint64_t length;       // Bytes in the file, guarded by MUTEX_WRITE
+
+    uint8_t *buffer; // Records appended but not written yet
+    size_t buffered;
+    size_t capacity;
+    uint8_t *spare; // Swapped with `buffer` when it is written, so appending doesn't wait for the disk
+    size_t spare_capacity;
+
+    pthread_mutex_t MUTEX_WAL;   // Appending to the buffer
+    pthread_mutex_t MUTEX_WRITE; // Writing to the file, so that groups are written in order
+    pthread_cond_t has_records;
+    pthread_t tid;
+} WAL;
+
+WAL wal = {
+    .fd = -1,
+    .epoch = 1, // MESSAGE.wal_epoch starts at 0, before being logged
+    .MUTEX_WAL = PTHREAD_MUTEX_INITIALIZER,
+    .MUTEX_WRITE = PTHREAD_MUTEX_INITIALIZER,
+    .has_records = PTHREAD_COND_INITIALIZER,
+};
+
+void wal_append(uint8_t *, size_t);
+void wal_append_locked(uint8_t *, size_t);
+size_t wal_encode_message(NOTIFICATION *, uint8_t *);
+void wal_write(void);
+void wal_write_buffer(uint8_t *, size_t);
+void *wal_flusher(void *);
+int wal_replay_file(int, USER_DIRECTORY *, HASH_TABLE, off_t *);
+int wal_apply(USER_DIRECTORY *, HASH_TABLE, uint8_t *, size_t);
+void wal_log_inbox_message(NOTIFICATION *, void *);
+void wal_put_u32(uint8_t *, uint32_t);
+uint32_t wal_get_u32(uint8_t *);
+
+/// Opens the WAL of this server, creating it if needed, and starts the thread which writes it
+///
+/// @param server_index Index of this server in the ring, as servers may share a directory
+void wal_open(int server_index)
+{
+    snprintf(wal.path, sizeof(wal.path), "%s-%d", WAL_FILE_PATH, server_index);
+    snprintf(wal.rotated_path, sizeof(wal.rotated_path), "%s.old", wal.path);
+
+    if ((wal.fd = open(wal.path, O_RDWR | O_CREAT | O_APPEND, 0600)) < 0)
+    {
+        logger_error("When opening the WAL %s: %d\n", wal.path, errno);
+        exit(ERROR_OPENING_WAL);
+    }
+
+    wal.buffer = (uint8_t *)malloc(WAL_INITIAL_BUFFER_SIZE);
+    wal.capacity = WAL_INITIAL_BUFFER_SIZE;
+    wal.spare = (uint8_t *)malloc(WAL_INITIAL_BUFFER_SIZE);
+    wal.spare_capacity = WAL_INITIAL_BUFFER_SIZE;
+
+    pthread_create(&wal.tid, NULL, &wal_flusher, NULL);
+    pthread_detach(wal.tid);
+
+    logger_info("Logging changes to %s\n", wal.path);
+}
+
+/// Applies every record of the WAL to the users loaded from the savefile, starting by the rotated
+/// file if a checkpoint didn't finish, and truncates a record torn by a crash at the end.
+/// Must be called before anything else is logged
+///
+/// @param directory USER_DIRECTORY* loaded from the savefile
+///
+/// @returns How many records were applied
+int wal_replay(USER_DIRECTORY *directory)
+{
+    int records = 0;
+    off_t valid_length;
+
+    // Messages are logged once per file and added to inboxes by their IDs
+    HASH_TABLE messages = hash_init();
+
+    int rotated_fd = open(wal.rotated_path, O_RDONLY);
+    if (rotated_fd >= 0)
+    {
+        records += wal_replay_file(rotated_fd, directory, messages, &valid_length);
+        close(rotated_fd);
+    }
+
+    records += wal_replay_file(wal.fd, directory, messages, &valid_length);
+
+    // The inboxes keep their own references
+    HASH_ITERATOR iterator;
+    hash_iterator_init(messages, &iterator);
+    for (HASH_NODE *node; (node = hash_iterator_next(&iterator)) != NULL;)
+        message_release((MESSAGE *)node->value);
+    hash_free(messages);
+
+    off_t file_length = lseek(wal.fd, 0, SEEK_END);
+    if (file_length > valid_length)
+    {
+        logger_warn("Truncating %lld bytes of a torn record at the end of %s\n", (long long)(file_length - valid_length), wal.path);
+        if (ftruncate(wal.fd, valid_length) < 0)
+            logger_error("When truncating %s: %d\n", wal.path, errno);
+    }
+    wal.length = (uint64_t)valid_length;
+
+    logger_info("Replayed %d records of %s\n", records, wal.path);
+    return records;
+}
+
+// Applies the records of a file until its end or a broken one, writing the length of the valid ones
+int wal_replay_file(int fd, USER_DIRECTORY *directory, HASH_TABLE messages, off_t *valid_length)
+{
+    uint8_t *buffer = (uint8_t *)malloc(WAL_READ_BUFFER_SIZE);
+    size_t length = 0;
+    int records = 0, torn = 0;
+    ssize_t bytes_read;
+
+    *valid_length = 0;
+    lseek(fd, 0, SEEK_SET);
+    while (!torn && (bytes_read = read(fd, buffer + length, WAL_READ_BUFFER_SIZE - length)) > 0)
+    {
+        length += bytes_read;
+
+        size_t offset = 0;
+        while (length - offset >= WAL_RECORD_HEADER_SIZE)
+        {
+            uint8_t *header = buffer + offset;
+            uint32_t payload_length = wal_get_u32(header);
+            if (payload_length == 0 || payload_length > WAL_MAX_PAYLOAD_SIZE)
+            {
+                torn = 1;
+                break;
+            }
+            if (length - offset < WAL_RECORD_HEADER_SIZE + payload_length)
+                break;
+
+            uint8_t *payload = header + WAL_RECORD_HEADER_SIZE;
+            if (crc32_compute(payload, payload_length) != wal_get_u32(header + 4) ||
+                wal_apply(directory, messages, payload, payload_length) < 0)
+            {
+                torn = 1;
+                break;
+            }
+
+            offset += WAL_RECORD_HEADER_SIZE + payload_length;
+            *valid_length += WAL_RECORD_HEADER_SIZE + payload_length;
+            records++;
+        }
+
+        length -= offset;
+        memmove(buffer, buffer + offset, length);
+    }
+    free(buffer);
+
+    return records;
+}
+
+/// Replaces the WAL with the records of the whole state of `directory`, for servers which
+/// got their state from somewhere else than the WAL (a snapshot of the primary)
+///
+/// @param directory USER_DIRECTORY* with the state to be logged
+void wal_reset(USER_DIRECTORY *directory)
+{
+    LOCK(wal.MUTEX_WRITE);
+
+    // Bodies logged until now are gone with the file
+    LOCK(wal.MUTEX_WAL);
+    wal.buffered = 0;
+    wal.epoch++;
+    UNLOCK(wal.MUTEX_WAL);
+
+    if (ftruncate(wal.fd, 0) < 0)
+        logger_error("When truncating %s: %d\n", wal.path, errno);
+    unlink(wal.rotated_path);
+    wal.length = 0;
+
+    uint32_t last_id = user_directory_last_id(directory);
+    for (uint32_t id = 1; id <= last_id; id++)
+    {
+        USER *user = user_directory_get(directory, id);
+        if (!user)
+            continue;
+
+        LOCK(user->mutex);
+        wal_log_login(user);
+        for (uint32_t follower_idx = 0; follower_idx < user->followers.length; follower_idx++)
+        {
+            USER *follower = user_directory_get(directory, user->followers.ids[follower_idx]);
+            if (follower)
+                wal_log_follow(user, follower);
+        }
+        wal_log_inbox(user);
+        UNLOCK(user->mutex);
+    }
+
+    wal_write();
+    UNLOCK(wal.MUTEX_WRITE);
+}
+
+/// Writes and syncs every record appended until now
+void wal_sync(void)
+{
+    if (wal.fd < 0)
+        return;
+
+    LOCK(wal.MUTEX_WRITE);
+    wal_write();
+    UNLOCK(wal.MUTEX_WRITE);
+}
+
+/// Replaces the file with an empty one, which receives every record appended from now on. The previous
+/// one is kept as the rotated file, and is still replayed, until wal_remove_rotated. Nothing is done
+/// if there is a rotated file already, as it wasn't saved yet
+///
+/// @param paused_usec Where to write for how long appending was blocked
+///
+/// @returns 0 if the file was replaced, -1 otherwise
+int wal_rotate(long *paused_usec)
+{
+    *paused_usec = 0;
+    if (wal.fd < 0 || access(wal.rotated_path, F_OK) == 0)
+        return -1;
+
+    LOCK(wal.MUTEX_WRITE);
+
+    // The records appended until here go to the current file, and the next ones to the new one
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    LOCK(wal.MUTEX_WAL);
+    uint8_t *buffer = wal.buffer;
+    size_t buffered = wal.buffered, capacity = wal.capacity;
+    wal.buffer = wal.spare;
+    wal.capacity = wal.spare_capacity;
+    wal.buffered = 0;
+    wal.epoch++;
+    UNLOCK(wal.MUTEX_WAL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *paused_usec = (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_nsec - start.tv_nsec) / 1000;
+
+    wal_write_buffer(buffer, buffered);
+    wal.spare = buffer;
+    wal.spare_capacity = capacity;
+
+    int status = -1, fd;
+    if (rename(wal.path, wal.rotated_path) < 0)
+        logger_error("When rotating %s: %d\n", wal.path, errno);
+    else if ((fd = open(wal.path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0600)) < 0)
+    {
+        // Records keep going to the rotated file, which is replayed anyway
+        logger_error("When opening a new %s: %d\n", wal.path, errno);
+        rename(wal.rotated_path, wal.path);
+    }
+    else
+    {
+        close(wal.fd);
+        wal.fd = fd;
+        wal.length = 0;
+        status = 0;
+    }
+
+    UNLOCK(wal.MUTEX_WRITE);
+    return status;
+}
+
+/// Removes the rotated file, once everything in it was saved somewhere else
+void wal_remove_rotated(void)
+{
+    if (unlink(wal.rotated_path) < 0 && errno != ENOENT)
+        logger_error("When removing %s: %d\n", wal.rotated_path, errno);
+}
+
+/// Bytes written to the current file
+///
+/// @returns Its length
+uint64_t wal_length(void)
+{
+    LOCK(wal.MUTEX_WRITE);
+    uint64_t length = wal.length;
+    UNLOCK(wal.MUTEX_WRITE);
+
+    return length;
+}
+
+/// Logs that a user was created, with its ID
+///
+/// @param user USER* just created
+void wal_log_login(USER *user)
+{
+    uint8_t payload[1 + 5 + MAX_USERNAME_LENGTH + 2];
+    uint8_t *cursor = payload;
+
+    *cursor++ = WAL_RECORD__LOGIN;
+    cursor = protocol_put_varint(cursor, user->id);
+    cursor = protocol_put_string(cursor, user->username, sizeof(user->username));
+
+    wal_append(payload, cursor - payload);
+}
+
+/// Logs that a user got a new follower
+///
+/// @param user USER* followed
+/// @param follower USER* following it
+void wal_log_follow(USER *user, USER *follower)
+{
+    uint8_t payload[1 + 5 + 5];
+    uint8_t *cursor = payload;
+
+    *cursor++ = WAL_RECORD__FOLLOW;
+    cursor = protocol_put_varint(cursor, user->id);
+    cursor = protocol_put_varint(cursor, follower->id);
+
+    wal_append(payload, cursor - payload);
+}
+
+/// Logs that a message was added to the inbox of a user, whose mutex must be held. Its body is
+/// logged too, unless it already was in the current file
+///
+/// @param user USER* who will receive it
+/// @param message MESSAGE* added to the inbox
+void wal_log_pending(USER *user, MESSAGE *message)
+{
+    uint8_t payload[1 + 5 + 10];
+    uint8_t *cursor = payload;
+
+    if (wal.fd < 0)
+        return;
+
+    *cursor++ = WAL_RECORD__PENDING;
+    cursor = protocol_put_varint(cursor, user->id);
+    cursor = protocol_put_varint(cursor, message->id);
+
+    // Checked with the buffer locked, so a rotation can't come between the body and this record
+    LOCK(wal.MUTEX_WAL);
+    if (atomic_load_explicit(&message->wal_epoch, memory_order_relaxed) != wal.epoch)
+    {
+        uint8_t message_payload[WAL_MAX_PAYLOAD_SIZE];
+        NOTIFICATION notification;
+        message_to_notification(message, user->username, &notification);
+
+        wal_append_locked(message_payload, wal_encode_message(&notification, message_payload));
+        atomic_store_explicit(&message->wal_epoch, wal.epoch, memory_order_relaxed);
+    }
+    wal_append_locked(payload, cursor - payload);
+    UNLOCK(wal.MUTEX_WAL);
+}
+
+/// Logs the whole inbox of a user, replacing what the WAL had for it, so the previous
+/// files aren't needed for it anymore. Its mutex must be held
+///
+/// @param user USER* whose inbox is logged
+void wal_log_inbox(USER *user)
+{
+    wal_log_delivered(user);
+    inbox_iterate(user, &wal_log_inbox_message, (void *)user);
+}
+
+/// Logs that the inbox of a user was emptied
+///
+/// @param user USER* whose messages were delivered
+void wal_log_delivered(USER *user)
+{
+    uint8_t payload[1 + 5];
+    uint8_t *cursor = payload;
+
+    *cursor++ = WAL_RECORD__DELIVERED;
+    cursor = protocol_put_varint(cursor, user->id);
+
+    wal_append(payload, cursor - payload);
+}
+
+void wal_append(uint8_t *payload, size_t payload_length)
+{
+    if (wal.fd < 0)
+        return;
+
+    LOCK(wal.MUTEX_WAL);
+    wal_append_locked(payload, payload_length);
+    UNLOCK(wal.MUTEX_WAL);
+}
+
+// Appends a record to the buffer, with MUTEX_WAL held
+void wal_append_locked(uint8_t *payload, size_t payload_length)
+{
+    if (wal.buffered + WAL_RECORD_HEADER_SIZE + payload_length > wal.capacity)
+    {
+        while (wal.buffered + WAL_RECORD_HEADER_SIZE + payload_length > wal.capacity)
+            wal.capacity *= 2;
+        wal.buffer = (uint8_t *)realloc(wal.buffer, wal.capacity);
+    }
+
+    uint8_t *header = wal.buffer + wal.buffered;
+    wal_put_u32(header, (uint32_t)payload_length);
+    wal_put_u32(header + 4, crc32_compute(payload, payload_length));
+    memcpy(header + WAL_RECORD_HEADER_SIZE, payload, payload_length);
+
+    if (wal.buffered == 0)
+        pthread_cond_signal(&wal.has_records);
+    wal.buffered += WAL_RECORD_HEADER_SIZE + payload_length;
+}
+
+// Payload of the MESSAGE record of a notification, returning its length
+size_t wal_encode_message(NOTIFICATION *notification, uint8_t *payload)
+{
+    uint8_t frame[PROTOCOL_MAX_FRAME_SIZE];
+    uint8_t *cursor = payload;
+
+    size_t frame_length = protocol_encode(notification, frame);
+
+    *cursor++ = WAL_RECORD__MESSAGE;
+    cursor = protocol_put_varint(cursor, frame_length);
+    memcpy(cursor, frame, frame_length);
+
+    return (cursor + frame_length) - payload;
+}
+
+// Writes the buffer and syncs it, with MUTEX_WRITE held. Appending goes on in the spare buffer meanwhile
+void wal_write(void)
+{
+    LOCK(wal.MUTEX_WAL);
+    uint8_t *buffer = wal.buffer;
+    size_t length = wal.buffered, capacity = wal.capacity;
+    wal.buffer = wal.spare;
+    wal.capacity = wal.spare_capacity;
+    wal.buffered = 0;
+    UNLOCK(wal.MUTEX_WAL);
+
+    wal_write_buffer(buffer, length);
+
+    wal.spare = buffer;
+    wal.spare_capacity = capacity;
+}
+
+// Writes records taken from the buffer to the file, and syncs it, with MUTEX_WRITE held
+void wal_write_buffer(uint8_t *buffer, size_t length)
+{
+    for (size_t written = 0; written < length;)
+    {
+        ssize_t status = write(wal.fd, buffer + written, length - written);
+        if (status < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            logger_error("When writing %zu bytes to %s: %d\n", length - written, wal.path, errno);
+            break;
+        }
+        written += status;
+        wal.length += status;
+    }
+
+    if (length > 0 && WAL_FSYNC && fdatasync(wal.fd) < 0)
+        logger_error("When syncing %s: %d\n", wal.path, errno);
+}
+
+// Group commit: waits for the first record of a group, gives the others some time to join it, and writes all of them
+void *wal_flusher(void *_)
+{
+    while (1)
+    {
+        LOCK(wal.MUTEX_WAL);
+        while (wal.buffered == 0)
+            pthread_cond_wait(&wal.has_records, &wal.MUTEX_WAL);
+        UNLOCK(wal.MUTEX_WAL);
+
+        usleep(WAL_GROUP_COMMIT_USEC);
+        wal_sync();
+    }
+
+    return NULL;
+}
+
+// Applies a record, returning -1 if it is broken
+int wal_apply(USER_DIRECTORY *directory, HASH_TABLE messages, uint8_t *payload, size_t length)
+{
+    uint8_t *cursor = payload + 1, *end = payload + length;
+    uint64_t id, value;
+    char key[24];
+    USER *user;
+
+    if ((cursor = protocol_get_varint(cursor, end, &id)) == NULL)
+        return -1;
+
+    switch ((WAL_RECORD)payload[0])
+    {
+    case WAL_RECORD__LOGIN:
+    {
+        char username[MAX_USERNAME_LENGTH + 2];
+        if (protocol_get_string(cursor, end, username, sizeof(username)) == NULL)
+            return -1;
+
+        user_directory_intern(directory, username, (uint32_t)id, NULL);
+        break;
+    }
+    case WAL_RECORD__FOLLOW:
+        if (protocol_get_varint(cursor, end, &value) == NULL)
+            return -1;
+
+        if ((user = user_directory_get(directory, (uint32_t)id)) != NULL)
+            id_set_add(&user->followers, (uint32_t)value);
+        break;
+    case WAL_RECORD__MESSAGE:
+    {
+        // The ID was the frame length
+        NOTIFICATION notification;
+        if (id > (uint64_t)(end - cursor) || protocol_decode(cursor, id, &notification) != (int)id)
+            return -1;
+
+        notification_id_observe(notification.id);
+
+        MESSAGE *message = message_create(&notification);
+        snprintf(key, sizeof(key), "%llu", (unsigned long long)notification.id);
+        if (hash_insert(messages, key, (void *)message)->value != (void *)message)
+            message_release(message);
+        break;
+    }
+    case WAL_RECORD__PENDING:
+    {
+        if (protocol_get_varint(cursor, end, &value) == NULL)
+            return -1;
+
+        snprintf(key, sizeof(key), "%llu", (unsigned long long)value);
+        HASH_NODE *node = hash_find(messages, key);
+        if (node && (user = user_directory_get(directory, (uint32_t)id)) != NULL)
+        {
+            if (inbox_push(user, message_retain((MESSAGE *)node->value)))
+                inbox_spill(user);
+        }
+        break;
+    }
+    case WAL_RECORD__DELIVERED:
+        if ((user = user_directory_get(directory, (uint32_t)id)) != NULL)
+            inbox_clear(user);
+        break;
+    default:
+        return -1;
+    }
+
+    return 0;
+}
+
+void wal_log_inbox_message(NOTIFICATION *notification, void *void_user)
+{
+    uint8_t payload[WAL_MAX_PAYLOAD_SIZE];
+    uint8_t *cursor = payload;
+
+    wal_append(payload, wal_encode_message(notification, payload));
+
+    *cursor++ = WAL_RECORD__PENDING;
+    cursor = protocol_put_varint(cursor, ((USER *)void_user)->id);
+    cursor = protocol_put_varint(cursor, notification->id);
+    wal_append(payload, cursor - payload);
+}
+
+void wal_put_u32(uint8_t *buffer, uint32_t value)
+{
+    buffer[0] = (uint8_t)value;
+    buffer[1] = (uint8_t)(value >> 8);
+    buffer[2] = (uint8_t)(value >> 16);
+    buffer[3] = (uint8_t)(value >> 24);
+}
+
+uint32_t wal_get_u32(uint8_t *buffer)
+{
+    return (uint32_t)buffer[0] | ((uint32_t)buffer[1] << 8) | ((uint32_t)buffer[2] << 16) | ((uint32_t)buffer[3] << 24);
+}
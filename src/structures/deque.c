@@ -0,0 +1,238 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include "deque.h"
+
+// Nodes freed by this thread, linked through `next`, which are freed too when it exits
+static _Thread_local DEQUE_NODE *deque_node_pool = NULL;
+static _Thread_local size_t deque_node_pool_size = 0;
+static _Thread_local int deque_node_pool_registered = 0;
+
+static pthread_key_t deque_node_pool_key;
+static pthread_once_t deque_node_pool_key_once = PTHREAD_ONCE_INIT;
+
+DEQUE_NODE *deque_node_create(void *val);
+void deque_node_free(DEQUE_NODE *node);
+void deque_node_pool_create_key(void);
+void deque_node_pool_drain(void *);
+
+/// Initializes an empty DEQUE
+///
+/// @param deque The DEQUE* to be initialized
+void deque_init(DEQUE *deque)
+{
+    deque->head = NULL;
+    deque->tail = NULL;
+    deque->size = 0;
+}
+
+/// Appends a value to the end of a DEQUE
+///
+/// @param deque DEQUE* which will have an element inserted
+/// @param val void* value which will be appended to the [deque]
+void deque_push_back(DEQUE *deque, void *val)
+{
+    DEQUE_NODE *node = deque_node_create(val);
+
+    node->prev = deque->tail;
+    if (deque->tail)
+        deque->tail->next = node;
+    else
+        deque->head = node;
+
+    deque->tail = node;
+    deque->size++;
+}
+
+/// Adds a value to the start of a DEQUE
+///
+/// @param deque DEQUE* which will have an element inserted
+/// @param val void* value which will be added to the front of the [deque]
+void deque_push_front(DEQUE *deque, void *val)
+{
+    DEQUE_NODE *node = deque_node_create(val);
+
+    node->next = deque->head;
+    if (deque->head)
+        deque->head->prev = node;
+    else
+        deque->tail = node;
+
+    deque->head = node;
+    deque->size++;
+}
+
+/// Removes the first value of a DEQUE
+///
+/// @param deque DEQUE* to remove from
+///
+/// @returns The void* value removed, or NULL if the [deque] is empty
+void *deque_pop_front(DEQUE *deque)
+{
+    DEQUE_NODE *node = deque->head;
+    if (!node)
+        return NULL;
+
+    deque->head = node->next;
+    if (deque->head)
+        deque->head->prev = NULL;
+    else
+        deque->tail = NULL;
+    deque->size--;
+
+    void *val = node->val;
+    deque_node_free(node);
+
+    return val;
+}
+
+/// Removes the last value of a DEQUE
+///
+/// @param deque DEQUE* to remove from
+///
+/// @returns The void* value removed, or NULL if the [deque] is empty
+void *deque_pop_back(DEQUE *deque)
+{
+    DEQUE_NODE *node = deque->tail;
+    if (!node)
+        return NULL;
+
+    deque->tail = node->prev;
+    if (deque->tail)
+        deque->tail->next = NULL;
+    else
+        deque->head = NULL;
+    deque->size--;
+
+    void *val = node->val;
+    deque_node_free(node);
+
+    return val;
+}
+
+/// Finds a value in the DEQUE
+///
+/// @param deque DEQUE* which will have an element searched
+/// @param val void* value to be searched on [deque]
+/// @param item_compare_function function to be used to compare the values, returning 0 when equal
+///
+/// @returns The void* value which corresponds to it, or NULL if can't find
+void *deque_find(DEQUE *deque, void *val, int(item_compare_function)(void *, void *))
+{
+    for (DEQUE_NODE *node = deque->head; node; node = node->next)
+        if (item_compare_function(val, node->val) == 0)
+            return node->val;
+
+    return NULL;
+}
+
+/// Moves every value of a DEQUE to the end of another one in O(1), leaving it empty
+///
+/// @param destination DEQUE* which receives the values
+/// @param source DEQUE* which will be emptied
+void deque_move(DEQUE *destination, DEQUE *source)
+{
+    if (!source->head)
+        return;
+
+    if (destination->tail)
+    {
+        destination->tail->next = source->head;
+        source->head->prev = destination->tail;
+    }
+    else
+        destination->head = source->head;
+
+    destination->tail = source->tail;
+    destination->size += source->size;
+
+    deque_init(source);
+}
+
+/// Iterates over a DEQUE, from the first to the last value
+///
+/// @param deque DEQUE* to be iterated
+/// @param iterate_function A function which is called for every value in the [deque]
+void deque_iterate(DEQUE *deque, void (*iterate_function)(void *))
+{
+    for (DEQUE_NODE *node = deque->head; node; node = node->next)
+        iterate_function(node->val);
+}
+
+/// Removes every value of a DEQUE. It DOES NOT free the values
+///
+/// @param deque DEQUE* to be cleared
+void deque_clear(DEQUE *deque)
+{
+    DEQUE_NODE *node = deque->head, *next;
+    while (node)
+    {
+        next = node->next;
+        deque_node_free(node);
+
+        node = next;
+    }
+
+    deque_init(deque);
+}
+
+DEQUE_NODE *deque_node_create(void *val)
+{
+    DEQUE_NODE *node = deque_node_pool;
+
+    if (node)
+    {
+        deque_node_pool = node->next;
+        deque_node_pool_size--;
+    }
+    else
+        node = (DEQUE_NODE *)malloc(sizeof(DEQUE_NODE));
+
+    node->val = val;
+    node->prev = NULL;
+    node->next = NULL;
+
+    return node;
+}
+
+// Keeps the node for the next push of this thread, unless there are enough already
+void deque_node_free(DEQUE_NODE *node)
+{
+    if (deque_node_pool_size >= DEQUE_NODE_POOL_SIZE)
+    {
+        free(node);
+        return;
+    }
+
+    // The first node kept by a thread asks for its pool to be drained when it exits. The value
+    // of the key is only set so that its destructor is called
+    if (!deque_node_pool_registered)
+    {
+        pthread_once(&deque_node_pool_key_once, &deque_node_pool_create_key);
+        pthread_setspecific(deque_node_pool_key, (void *)&deque_node_pool_registered);
+        deque_node_pool_registered = 1;
+    }
+
+    node->next = deque_node_pool;
+    deque_node_pool = node;
+    deque_node_pool_size++;
+}
+
+void deque_node_pool_create_key(void)
+{
+    pthread_key_create(&deque_node_pool_key, &deque_node_pool_drain);
+}
+
+// Called when a thread which kept nodes exits, as nobody else can reuse them
+void deque_node_pool_drain(void *_)
+{
+    for (DEQUE_NODE *node = deque_node_pool, *next; node; node = next)
+    {
+        next = node->next;
+        free(node);
+    }
+
+    // If it is used again by another destructor, it registers again to be drained after it
+    deque_node_pool = NULL;
+    deque_node_pool_size = 0;
+    deque_node_pool_registered = 0;
+}
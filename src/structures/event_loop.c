@@ -0,0 +1,359 @@
+#include "event_loop.h"
+
+#include "logger.h"
+#include "exit_errors.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+void event_loop_accept(EVENT_LOOP *);
+void event_loop_read(EVENT_LOOP *, CONNECTION *);
+void event_loop_flush(EVENT_LOOP *, CONNECTION *);
+void event_loop_watch(EVENT_LOOP *, CONNECTION *, int);
+void event_loop_close(EVENT_LOOP *, CONNECTION *);
+void event_loop_detach(EVENT_LOOP *, CONNECTION *);
+
+/// Creates an EVENT_LOOP which accepts connections from `listen_sockfd` and calls
+/// `handler` for every notification received in them.
+/// Several loops can share the same listening socket, each one of them owning the
+/// connections it accepted, so that a connection is only ever handled by one thread
+///
+/// @param listen_sockfd An already listening socket
+/// @param handler Function called for every complete notification
+///
+/// @returns A new pointer to an EVENT_LOOP, which still needs to be started
+EVENT_LOOP *event_loop_create(int listen_sockfd, EVENT_LOOP_HANDLER handler)
+{
+    EVENT_LOOP *loop = (EVENT_LOOP *)calloc(1, sizeof(EVENT_LOOP));
+    loop->listen_sockfd = listen_sockfd;
+    loop->handler = handler;
+
+    if ((loop->epoll_fd = epoll_create1(0)) == -1)
+    {
+        logger_error("When creating epoll instance\n");
+        exit(ERROR_EVENT_LOOP);
+    }
+
+    // Accepting must never block, because every loop is woken up for the same listening socket
+    fcntl(listen_sockfd, F_SETFL, fcntl(listen_sockfd, F_GETFL) | O_NONBLOCK);
+
+    // EPOLLEXCLUSIVE avoids waking up every loop for a single incoming connection
+    struct epoll_event event = {.events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = NULL};
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, listen_sockfd, &event) == -1)
+    {
+        logger_error("When adding listening socket %d to epoll\n", listen_sockfd);
+        exit(ERROR_EVENT_LOOP);
+    }
+
+    return loop;
+}
+
+/// Starts running an EVENT_LOOP in a new thread, saving its TID in `loop->tid`
+///
+/// @param loop The EVENT_LOOP to be started
+void event_loop_start(EVENT_LOOP *loop)
+{
+    pthread_create(&loop->tid, NULL, (void *(*)(void *)) & event_loop_run, (void *)loop);
+    logger_debug("Created new thread %ld to run an event loop\n", loop->tid);
+}
+
+/// Runs an EVENT_LOOP in the current thread. This never returns
+///
+/// @param loop The EVENT_LOOP to be run
+void event_loop_run(EVENT_LOOP *loop)
+{
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+
+    while (1)
+    {
+        int events_number = epoll_wait(loop->epoll_fd, events, EVENT_LOOP_MAX_EVENTS, -1);
+        if (events_number < 0)
+        {
+            if (errno != EINTR)
+                logger_error("When waiting for epoll events: %d\n", errno);
+            continue;
+        }
+
+        for (int i = 0; i < events_number; i++)
+        {
+            CONNECTION *connection = (CONNECTION *)events[i].data.ptr;
+
+            // The listening socket is the only one registered without a connection
+            if (connection == NULL)
+            {
+                event_loop_accept(loop);
+                continue;
+            }
+
+            // Flush first, as reading might close and free the connection
+            if (events[i].events & EPOLLOUT)
+                event_loop_flush(loop, connection);
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                event_loop_read(loop, connection);
+        }
+    }
+}
+
+void event_loop_accept(EVENT_LOOP *loop)
+{
+    struct sockaddr_in cli_addr;
+    socklen_t clilen = sizeof(struct sockaddr_in);
+
+    while (1)
+    {
+        int sockfd = accept(loop->listen_sockfd, (struct sockaddr *)&cli_addr, &clilen);
+        if (sockfd == -1)
+        {
+            // Another loop might have accepted it first, or we have accepted everything
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                logger_error("When accepting connection: %d\n", errno);
+
+            return;
+        }
+
+        logger_info("New connection from %s:%d\n", inet_ntoa(cli_addr.sin_addr), cli_addr.sin_port);
+
+        CONNECTION *connection = (CONNECTION *)calloc(1, sizeof(CONNECTION));
+        connection->sockfd = sockfd;
+        connection->loop = loop;
+        connection->read_buffer = stream_buffer_create(EVENT_LOOP_READ_BUFFER_SIZE);
+        pthread_mutex_init(&connection->write_mutex, NULL);
+        atomic_init(&connection->references, 1);
+
+        struct epoll_event event = {.events = EPOLLIN | EPOLLRDHUP, .data.ptr = (void *)connection};
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, sockfd, &event) == -1)
+        {
+            logger_error("[Socket %d] When adding socket to epoll\n", sockfd);
+            close(sockfd);
+            pthread_mutex_destroy(&connection->write_mutex);
+            stream_buffer_free(connection->read_buffer);
+            free(connection);
+        }
+    }
+}
+
+void event_loop_read(EVENT_LOOP *loop, CONNECTION *connection)
+{
+    while (1)
+    {
+        size_t free_space = connection->read_buffer->capacity - connection->read_buffer->length;
+
+        // Sockets are kept blocking for writes, only the reads here must not block
+        int bytes_read = stream_buffer_fill(connection->read_buffer, connection->sockfd, MSG_DONTWAIT);
+        if (bytes_read < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+
+            logger_error("[Socket %d] When reading from socket: %d\n", connection->sockfd, errno);
+            loop->handler(connection, NULL);
+            event_loop_close(loop, connection);
+            return;
+        }
+        else if (bytes_read == 0)
+        {
+            logger_info("[Socket %d] Connection closed\n", connection->sockfd);
+            loop->handler(connection, NULL);
+            event_loop_close(loop, connection);
+            return;
+        }
+
+        // Dispatch every complete frame we have, keeping the incomplete one for later
+        int frame_length;
+        while ((frame_length = stream_buffer_next(connection->read_buffer, &connection->notification)) > 0)
+        {
+            int status = loop->handler(connection, &connection->notification);
+            if (status == EVENT_LOOP_DETACH)
+            {
+                event_loop_detach(loop, connection);
+                return;
+            }
+            if (!status)
+            {
+                event_loop_close(loop, connection);
+                return;
+            }
+        }
+
+        if (frame_length < 0)
+        {
+            logger_error("[Socket %d] Received an invalid frame, closing connection\n", connection->sockfd);
+            loop->handler(connection, NULL);
+            event_loop_close(loop, connection);
+            return;
+        }
+
+        // A short read means the socket is drained, and epoll will tell us when there is more
+        if ((size_t)bytes_read < free_space)
+            return;
+    }
+}
+
+/// Writes `length` bytes to a connection without ever blocking.
+/// Whatever the socket can't take right now is buffered, and flushed by the
+/// connection's loop when the socket becomes writable again, keeping the order.
+/// Can be called from any thread, by its loop or by someone holding a reference to it.
+/// A peer which doesn't read would make the buffer grow forever, so once more than
+/// EVENT_LOOP_WRITE_HIGH_WATER bytes would be waiting, the connection is shut down instead,
+/// and its loop closes it as if it broke
+///
+/// @param connection The CONNECTION to write to
+/// @param data The bytes to be written
+/// @param length How many bytes from `data` should be written
+///
+/// @returns 0 on success, or -1 if the connection is broken, too slow or already closed
+int event_loop_write(CONNECTION *connection, void *data, size_t length)
+{
+    char *bytes = (char *)data;
+
+    pthread_mutex_lock(&connection->write_mutex);
+
+    // Its socket may be closed already, or even reused by another connection
+    if (connection->closed)
+    {
+        pthread_mutex_unlock(&connection->write_mutex);
+        return -1;
+    }
+
+    // Can only write directly if there is nothing waiting before us
+    if (connection->write_length == 0)
+    {
+        int bytes_wrote = send(connection->sockfd, bytes, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (bytes_wrote < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            pthread_mutex_unlock(&connection->write_mutex);
+            return -1;
+        }
+
+        if (bytes_wrote > 0)
+        {
+            bytes += bytes_wrote;
+            length -= bytes_wrote;
+        }
+
+        if (length == 0)
+        {
+            pthread_mutex_unlock(&connection->write_mutex);
+            return 0;
+        }
+
+        // From now on we need to know when we can write again
+        event_loop_watch(connection->loop, connection, EPOLLOUT);
+    }
+
+    if (connection->write_length + length > EVENT_LOOP_WRITE_HIGH_WATER)
+    {
+        logger_warn("[Socket %d] Closing connection which isn't reading, with %zu bytes waiting to be written\n", connection->sockfd, connection->write_length + length);
+        shutdown(connection->sockfd, SHUT_RDWR);
+        connection->write_length = 0;
+
+        pthread_mutex_unlock(&connection->write_mutex);
+        return -1;
+    }
+
+    if (connection->write_length + length > connection->write_capacity)
+    {
+        connection->write_capacity = 2 * (connection->write_length + length);
+        connection->write_buffer = (char *)realloc(connection->write_buffer, connection->write_capacity);
+    }
+
+    memcpy(connection->write_buffer + connection->write_length, bytes, length);
+    connection->write_length += length;
+
+    pthread_mutex_unlock(&connection->write_mutex);
+
+    return 0;
+}
+
+void event_loop_flush(EVENT_LOOP *loop, CONNECTION *connection)
+{
+    pthread_mutex_lock(&connection->write_mutex);
+
+    while (connection->write_length > 0)
+    {
+        int bytes_wrote = send(connection->sockfd, connection->write_buffer, connection->write_length, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (bytes_wrote < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                // Broken connection, reading from it will close it
+                logger_error("[Socket %d] When flushing socket: %d\n", connection->sockfd, errno);
+                connection->write_length = 0;
+            }
+            break;
+        }
+
+        memmove(connection->write_buffer, connection->write_buffer + bytes_wrote, connection->write_length - bytes_wrote);
+        connection->write_length -= bytes_wrote;
+    }
+
+    // Everything was written, so we don't care about writability anymore
+    if (connection->write_length == 0)
+        event_loop_watch(loop, connection, 0);
+
+    pthread_mutex_unlock(&connection->write_mutex);
+}
+
+void event_loop_watch(EVENT_LOOP *loop, CONNECTION *connection, int extra_events)
+{
+    struct epoll_event event = {.events = EPOLLIN | EPOLLRDHUP | extra_events, .data.ptr = (void *)connection};
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, connection->sockfd, &event);
+}
+
+void event_loop_close(EVENT_LOOP *loop, CONNECTION *connection)
+{
+    int sockfd = connection->sockfd;
+
+    event_loop_detach(loop, connection);
+    close(sockfd);
+}
+
+// Stops watching a connection and drops the reference of its loop, but keeps its socket open
+void event_loop_detach(EVENT_LOOP *loop, CONNECTION *connection)
+{
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, connection->sockfd, NULL);
+
+    pthread_mutex_lock(&connection->write_mutex);
+    connection->closed = 1;
+    pthread_mutex_unlock(&connection->write_mutex);
+
+    event_loop_release(connection);
+}
+
+/// Keeps a connection from being freed, so that it can be written to from another thread
+/// even if its loop closes it meanwhile. The caller must know that it is still alive, for
+/// example because it found it in a table the handler removes it from before closing it
+///
+/// @param connection The CONNECTION to be retained
+///
+/// @returns The same `connection`
+CONNECTION *event_loop_retain(CONNECTION *connection)
+{
+    atomic_fetch_add(&connection->references, 1);
+    return connection;
+}
+
+/// Drops a reference to a connection, freeing it if it was the last one
+///
+/// @param connection The CONNECTION to be released
+void event_loop_release(CONNECTION *connection)
+{
+    if (atomic_fetch_sub(&connection->references, 1) != 1)
+        return;
+
+    pthread_mutex_destroy(&connection->write_mutex);
+    stream_buffer_free(connection->read_buffer);
+    free(connection->write_buffer);
+    free(connection);
+}
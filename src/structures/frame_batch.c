@@ -0,0 +1,100 @@
+#include "frame_batch.h"
+
+#include <errno.h>
+#include <sys/socket.h>
+
+/// Prepares an empty FRAME_BATCH
+///
+/// @param batch FRAME_BATCH* to be initialized
+/// @param sockfd Socket the frames will be written to
+/// @param mutex Mutex held while writing to `sockfd`, or NULL if there is only one writer
+/// @param type Type of every frame
+/// @param mask Mask returned by `protocol_encode_fields`
+/// @param fields Fields shared by every frame, must live until the batch is flushed
+/// @param fields_length How many bytes `fields` has
+void frame_batch_init(FRAME_BATCH *batch, int sockfd, pthread_mutex_t *mutex, NOTIFICATION_TYPE type, uint32_t mask, uint8_t *fields, size_t fields_length)
+{
+    batch->sockfd = sockfd;
+    batch->mutex = mutex;
+    batch->type = type;
+    batch->mask = mask;
+    batch->fields = fields;
+    batch->fields_length = fields_length;
+    batch->frames = 0;
+    batch->syscalls = 0;
+}
+
+/// Adds a frame for `receiver` to the batch, flushing it first if it is full
+///
+/// @param batch FRAME_BATCH* which will have the frame added
+/// @param receiver Username which will receive this frame
+///
+/// @returns 0 on success, or -1 if the batch was full and flushing it failed
+int frame_batch_add(FRAME_BATCH *batch, char *receiver)
+{
+    int status = 0;
+    if (batch->frames == FRAME_BATCH_MAX_FRAMES)
+        status = frame_batch_flush(batch);
+
+    uint8_t *header = batch->headers[batch->frames];
+    struct iovec *iov = &batch->iov[batch->frames * 2];
+
+    iov[0].iov_base = header;
+    iov[0].iov_len = protocol_encode_header(batch->type, batch->mask, receiver, batch->fields_length, header);
+    iov[1].iov_base = batch->fields;
+    iov[1].iov_len = batch->fields_length;
+    batch->frames++;
+
+    return status;
+}
+
+/// Writes every frame in the batch, with as few syscalls as the socket allows,
+/// blocking until all of them are written. The batch is empty afterwards, even on errors
+///
+/// @param batch FRAME_BATCH* to be flushed
+///
+/// @returns 0 on success, or -1 on error (with errno set, EPIPE included)
+int frame_batch_flush(FRAME_BATCH *batch)
+{
+    struct msghdr message = {.msg_iov = batch->iov, .msg_iovlen = batch->frames * 2};
+    int status = 0;
+
+    if (batch->frames == 0)
+        return 0;
+
+    if (batch->mutex)
+        pthread_mutex_lock(batch->mutex);
+
+    while (message.msg_iovlen > 0)
+    {
+        ssize_t bytes_wrote = sendmsg(batch->sockfd, &message, MSG_NOSIGNAL);
+        batch->syscalls++;
+        if (bytes_wrote < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            status = -1;
+            break;
+        }
+
+        // Skip what was written, which might have ended in the middle of an iovec
+        while (message.msg_iovlen > 0 && (size_t)bytes_wrote >= message.msg_iov->iov_len)
+        {
+            bytes_wrote -= message.msg_iov->iov_len;
+            message.msg_iov++;
+            message.msg_iovlen--;
+        }
+        if (message.msg_iovlen > 0)
+        {
+            message.msg_iov->iov_base = (uint8_t *)message.msg_iov->iov_base + bytes_wrote;
+            message.msg_iov->iov_len -= bytes_wrote;
+        }
+    }
+
+    if (batch->mutex)
+        pthread_mutex_unlock(batch->mutex);
+
+    batch->frames = 0;
+
+    return status;
+}
@@ -1,102 +1,334 @@
 #include "hash.h"
 #include <ctype.h>
 
+#define LOCK(mutex) pthread_mutex_lock(&mutex)
+#define UNLOCK(mutex) pthread_mutex_unlock(&mutex)
+
+#define HASH_CONTROL_EMPTY 0x80
+#define HASH_CONTROL_LOW_BITS 0x0101010101010101ULL
+#define HASH_CONTROL_HIGH_BITS 0x8080808080808080ULL
+
+// Lowest 7 bits go to the control bytes, and the rest chooses the first group to probe
+#define HASH_CONTROL(hash) ((uint8_t)((hash) & 0x7F))
+#define HASH_GROUP(hash, buckets) (((hash) >> 7) & ((buckets)->groups - 1))
+
+HASH_BUCKETS *hash_buckets_create(uint64_t groups);
+void hash_buckets_free(HASH_BUCKETS *buckets);
+HASH_NODE *hash_buckets_find(HASH_BUCKETS *buckets, char *key, uint64_t hash);
+HASH_NODE *hash_buckets_push(HASH_BUCKETS *buckets, HASH_NODE *node);
+uint64_t hash_control_match(uint64_t control, uint8_t byte);
+uint64_t hash_control_empty(uint64_t control);
+void hash_resize(HASH_TABLE table);
+void hash_rehash_step(HASH_TABLE table);
+
 HASH_TABLE hash_init(void)
 {
-    HASH_TABLE table;
+    HASH_TABLE table = (HASH_TABLE)calloc(1, sizeof(struct hash_table));
+
+    atomic_init(&table->buckets, hash_buckets_create(HASH_INITIAL_SIZE / HASH_GROUP_SIZE));
+    pthread_mutex_init(&table->MUTEX_WRITE, NULL);
 
-    table = (HASH_TABLE)calloc(HASH_SIZE, sizeof(HASH_NODE *));
     return table;
 }
 
 void hash_free(HASH_TABLE table)
 {
-    HASH_NODE *node, *next_node;
-
     if (!table)
         return;
 
-    // For each position in the table
-    for (int table_idx = 0; table_idx < HASH_SIZE; table_idx++)
+    HASH_BUCKETS *buckets = atomic_load(&table->buckets);
+    HASH_BUCKETS *old = atomic_load(&buckets->old);
+    hash_buckets_free(buckets);
+    if (old)
+        hash_buckets_free(old);
+
+    for (HASH_BUCKETS *retired = table->retired, *next_retired; retired; retired = next_retired)
     {
-        // Get the pointer in the current position
-        node = table[table_idx];
+        next_retired = retired->retired_next;
+        hash_buckets_free(retired);
+    }
 
-        // While pointing at something that is not NULL
-        while (node)
-        {
-            // Save the next
-            next_node = node->next;
+    pthread_mutex_destroy(&table->MUTEX_WRITE);
+
+    // Finally, free the table pointer
+    free(table);
+}
 
-            // Free the text, and the node itself
-            free(node->key);
-            free(node);
+HASH_BUCKETS *hash_buckets_create(uint64_t groups)
+{
+    HASH_BUCKETS *buckets = (HASH_BUCKETS *)calloc(1, sizeof(HASH_BUCKETS));
 
-            // Now we will look for the next node
-            node = next_node;
-        }
+    buckets->groups = groups;
+    buckets->slots = (HASH_NODE *)calloc(groups * HASH_GROUP_SIZE, sizeof(HASH_NODE));
+    buckets->controls = (_Atomic uint64_t *)malloc(groups * sizeof(_Atomic uint64_t));
+    for (uint64_t group_idx = 0; group_idx < groups; group_idx++)
+        atomic_init(&buckets->controls[group_idx], HASH_CONTROL_EMPTY * HASH_CONTROL_LOW_BITS);
+    atomic_init(&buckets->old, NULL);
+
+    return buckets;
+}
+
+void hash_buckets_free(HASH_BUCKETS *buckets)
+{
+    free((void *)buckets->controls);
+    free(buckets->slots);
+    free(buckets);
+}
+
+/// 64 bit FNV-1a, followed by the MurmurHash3 finalizer so that every bit of
+/// the result depends on every character, even for short and similar keys
+///
+/// @param key String to be hashed
+///
+/// @returns The hash of the string
+uint64_t hash_string(char *key)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+
+    for (; *key; key++)
+    {
+        hash ^= (uint8_t)*key;
+        hash *= 0x100000001b3;
     }
 
-    // Finally, free the table pointer
-    free(table);
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccd;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53;
+    hash ^= hash >> 33;
+
+    return hash;
 }
 
+// Non negative number for a key, which is the same in every process.
+// Used to choose the FE of a user
 int hash_address(char *key)
 {
-    int address = 1;
-    int key_idx;
+    return (int)(hash_string(key) >> 33);
+}
+
+// One bit (the highest) set for every control byte equal to `byte`. Full slots
+// only, so that an empty slot is never read even on a false positive
+uint64_t hash_control_match(uint64_t control, uint8_t byte)
+{
+    uint64_t difference = control ^ (byte * HASH_CONTROL_LOW_BITS);
 
-    // Initializing in one, and taking modulo (HASH_SIZE + 1)
-    // we are in range [1, HASH_SIZE + 1)
-    for (key_idx = 0; key_idx < strlen(key); key_idx++)
-        address = (address * key[key_idx]) % HASH_SIZE + 1;
+    return (difference - HASH_CONTROL_LOW_BITS) & ~difference & ~control & HASH_CONTROL_HIGH_BITS;
+}
 
-    // We decrement 1 to be in the range [0, HASH_SIZE),
-    //so that we can access the table correctly
-    return address - 1;
+// One bit (the highest) set for every empty control byte
+uint64_t hash_control_empty(uint64_t control)
+{
+    return control & HASH_CONTROL_HIGH_BITS;
 }
 
+/// Looks for a key without taking any lock, so it can run alongside inserts
+///
+/// @param table HASH_TABLE to look in
+/// @param key String to look for
+///
+/// @returns The HASH_NODE* with the key, or NULL if there is none
 HASH_NODE *hash_find(HASH_TABLE table, char *key)
 {
     if (!table)
         return NULL;
 
-    int address = hash_address(key);
-    HASH_NODE *node = table[address];
+    uint64_t hash = hash_string(key);
+
+    // The old array must be loaded first: if it is gone by then, every slot was already copied
+    HASH_BUCKETS *buckets = atomic_load_explicit(&table->buckets, memory_order_acquire);
+    HASH_BUCKETS *old = atomic_load_explicit(&buckets->old, memory_order_acquire);
+
+    HASH_NODE *node = hash_buckets_find(buckets, key, hash);
+    if (!node && old)
+        node = hash_buckets_find(old, key, hash);
+
+    return node;
+}
+
+// Probes group after group, until the key is found or a group has an empty slot.
+// There is always an empty slot, because of the maximum load factor
+HASH_NODE *hash_buckets_find(HASH_BUCKETS *buckets, char *key, uint64_t hash)
+{
+    uint64_t group_idx = HASH_GROUP(hash, buckets);
 
-    while (node)
+    for (uint64_t probe = 1;; group_idx = (group_idx + probe++) & (buckets->groups - 1))
     {
-        if (strcmp(key, node->key) == 0)
-            return node;
+        uint64_t control = atomic_load_explicit(&buckets->controls[group_idx], memory_order_acquire);
 
-        node = node->next;
-    }
+        for (uint64_t matches = hash_control_match(control, HASH_CONTROL(hash)); matches; matches &= matches - 1)
+        {
+            HASH_NODE *node = &buckets->slots[group_idx * HASH_GROUP_SIZE + (__builtin_ctzll(matches) >> 3)];
+            if (node->hash == hash && strcmp(key, node->key) == 0)
+                return node;
+        }
 
-    return NULL;
+        if (hash_control_empty(control))
+            return NULL;
+    }
 }
 
+/// Inserts a key, unless it is already in the table. Keys must be shorter than HASH_KEY_SIZE
+///
+/// @param table HASH_TABLE to insert in
+/// @param key String to be copied to the table
+/// @param value Value of the key
+///
+/// @returns The HASH_NODE* with the key, or NULL if the key is too long
 HASH_NODE *hash_insert(HASH_TABLE table, char *key, void *value)
 {
-    if (!table)
+    if (!table || strnlen(key, HASH_KEY_SIZE) == HASH_KEY_SIZE)
         return NULL;
 
     HASH_NODE *new_node = hash_find(table, key);
+    if (new_node)
+        return new_node;
+
+    LOCK(table->MUTEX_WRITE);
 
+    // Someone may have inserted it while we were waiting
+    new_node = hash_find(table, key);
     if (!new_node)
     {
-        new_node = (HASH_NODE *)calloc(1, sizeof(HASH_NODE));
-        new_node->value = value;
-        new_node->key = (char *)calloc(strlen(key) + 1, sizeof(char));
-        strcpy(new_node->key, key);
-
-        int address = hash_address(key);
-        new_node->next = table[address];
-        table[address] = new_node;
+        HASH_BUCKETS *buckets = atomic_load_explicit(&table->buckets, memory_order_relaxed);
+        if (atomic_load_explicit(&buckets->old, memory_order_relaxed))
+            hash_rehash_step(table);
+        else if (table->count * 100 >= buckets->groups * HASH_GROUP_SIZE * HASH_MAX_LOAD_FACTOR_PERCENT)
+            hash_resize(table);
+
+        HASH_NODE node = {.hash = hash_string(key), .value = value};
+        strcpy(node.key, key);
+
+        // New keys always go to the newest array
+        new_node = hash_buckets_push(atomic_load_explicit(&table->buckets, memory_order_relaxed), &node);
+        table->count++;
     }
 
+    UNLOCK(table->MUTEX_WRITE);
+
     return new_node;
 }
 
+// Copies a node to the first empty slot of its probe sequence, and publishes it
+// by setting its control byte. Needs MUTEX_WRITE
+HASH_NODE *hash_buckets_push(HASH_BUCKETS *buckets, HASH_NODE *node)
+{
+    uint64_t group_idx = HASH_GROUP(node->hash, buckets), control, empty;
+
+    for (uint64_t probe = 1;; group_idx = (group_idx + probe++) & (buckets->groups - 1))
+    {
+        control = atomic_load_explicit(&buckets->controls[group_idx], memory_order_relaxed);
+        if ((empty = hash_control_empty(control)))
+            break;
+    }
+
+    int byte_idx = __builtin_ctzll(empty) >> 3;
+    HASH_NODE *slot = &buckets->slots[group_idx * HASH_GROUP_SIZE + byte_idx];
+    memcpy(slot, node, sizeof(HASH_NODE));
+
+    control &= ~(0xFFULL << (byte_idx * 8));
+    control |= (uint64_t)HASH_CONTROL(node->hash) << (byte_idx * 8);
+    atomic_store_explicit(&buckets->controls[group_idx], control, memory_order_release);
+
+    return slot;
+}
+
+// Starts copying the slots to an array twice as big. Needs MUTEX_WRITE
+void hash_resize(HASH_TABLE table)
+{
+    HASH_BUCKETS *old = atomic_load_explicit(&table->buckets, memory_order_relaxed);
+    HASH_BUCKETS *buckets = hash_buckets_create(old->groups * 2);
+
+    atomic_init(&buckets->old, old);
+    atomic_store_explicit(&table->buckets, buckets, memory_order_release);
+
+    hash_rehash_step(table);
+}
+
+// Copies the next HASH_REHASH_STEP old groups to the new array, retiring the old one after the
+// last of them. Readers may still be using the old slots, so they stay where they are.
+// Needs MUTEX_WRITE
+void hash_rehash_step(HASH_TABLE table)
+{
+    HASH_BUCKETS *buckets = atomic_load_explicit(&table->buckets, memory_order_relaxed);
+    HASH_BUCKETS *old = atomic_load_explicit(&buckets->old, memory_order_relaxed);
+
+    for (int step = 0; step < HASH_REHASH_STEP && buckets->rehash_idx < old->groups; step++, buckets->rehash_idx++)
+    {
+        uint64_t control = atomic_load_explicit(&old->controls[buckets->rehash_idx], memory_order_relaxed);
+
+        for (uint64_t full = ~control & HASH_CONTROL_HIGH_BITS; full; full &= full - 1)
+        {
+            HASH_NODE copy = old->slots[buckets->rehash_idx * HASH_GROUP_SIZE + (__builtin_ctzll(full) >> 3)];
+            copy.moved = 1;
+
+            hash_buckets_push(buckets, &copy);
+        }
+    }
+
+    if (buckets->rehash_idx == old->groups)
+    {
+        atomic_store_explicit(&buckets->old, NULL, memory_order_release);
+
+        old->retired_next = table->retired;
+        table->retired = old;
+    }
+}
+
+/// Starts walking every node of a table, in no particular order
+///
+/// @param table HASH_TABLE to be walked
+/// @param iterator HASH_ITERATOR* which keeps where we are
+void hash_iterator_init(HASH_TABLE table, HASH_ITERATOR *iterator)
+{
+    memset(iterator, 0, sizeof(HASH_ITERATOR));
+    if (!table)
+        return;
+
+    iterator->buckets = atomic_load_explicit(&table->buckets, memory_order_acquire);
+    iterator->old = atomic_load_explicit(&iterator->buckets->old, memory_order_acquire);
+    iterator->in_old_buckets = iterator->old != NULL;
+}
+
+/// Goes to the next node of a table. While resizing, every node which existed before is
+/// returned from the old array, so their copies in the new one are skipped
+///
+/// @param iterator HASH_ITERATOR* started with `hash_iterator_init`
+///
+/// @returns The next HASH_NODE*, or NULL when every one was already returned
+HASH_NODE *hash_iterator_next(HASH_ITERATOR *iterator)
+{
+    if (!iterator->buckets)
+        return NULL;
+
+    while (1)
+    {
+        HASH_BUCKETS *buckets = iterator->in_old_buckets ? iterator->old : iterator->buckets;
+
+        if (iterator->slot_idx == buckets->groups * HASH_GROUP_SIZE)
+        {
+            if (!iterator->in_old_buckets)
+                return NULL;
+
+            // Old array is done, so go to the new one
+            iterator->in_old_buckets = 0;
+            iterator->slot_idx = 0;
+            continue;
+        }
+
+        uint64_t slot_idx = iterator->slot_idx++;
+        uint64_t control = atomic_load_explicit(&buckets->controls[slot_idx / HASH_GROUP_SIZE], memory_order_acquire);
+        if (control & (0x80ULL << ((slot_idx % HASH_GROUP_SIZE) * 8)))
+            continue;
+
+        HASH_NODE *node = &buckets->slots[slot_idx];
+        if (iterator->old && !iterator->in_old_buckets && node->moved)
+            continue;
+
+        return node;
+    }
+}
+
 void hash_print(HASH_TABLE table)
 {
 #ifdef NO_DEBUG
@@ -106,15 +338,14 @@ void hash_print(HASH_TABLE table)
     if (!table)
         return;
 
-    int list_idx;
+    HASH_ITERATOR iterator;
     HASH_NODE *node;
 
-    printf("Hash: \n");
-    for (int table_idx = 0; table_idx < HASH_SIZE; table_idx++)
-        for (node = table[table_idx], list_idx = 0; node; node = node->next, list_idx++)
-            printf(
-                "Table[%d][%d] -> %s\n",
-                table_idx,
-                list_idx,
-                node->key);
+    LOCK(table->MUTEX_WRITE);
+    printf("Hash (%llu keys): \n", (unsigned long long)table->count);
+    UNLOCK(table->MUTEX_WRITE);
+
+    hash_iterator_init(table, &iterator);
+    while ((node = hash_iterator_next(&iterator)))
+        printf("Table[%llu] -> %s\n", (unsigned long long)node->hash, node->key);
 }
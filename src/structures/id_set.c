@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <string.h>
+#include "id_set.h"
+
+uint32_t *id_set_find_slot(ID_SET *set, uint32_t id);
+void id_set_rebuild(ID_SET *set);
+
+/// Initializes an empty ID_SET, which doesn't allocate anything until the first insertion
+///
+/// @param set The ID_SET* to be initialized
+void id_set_init(ID_SET *set)
+{
+    memset(set, 0, sizeof(ID_SET));
+}
+
+/// Frees what was allocated by an ID_SET, leaving it empty
+///
+/// @param set The ID_SET* to be freed
+void id_set_free(ID_SET *set)
+{
+    free(set->ids);
+    free(set->index);
+    id_set_init(set);
+}
+
+/// Checks if an ID is in the set
+///
+/// @param set The ID_SET* to look in
+/// @param id The ID to look for
+///
+/// @returns 1 if it is in the set, 0 otherwise
+int id_set_contains(ID_SET *set, uint32_t id)
+{
+    uint32_t *slot = id_set_find_slot(set, id);
+
+    return slot != NULL && *slot != 0;
+}
+
+/// Adds an ID to the end of the set, if it isn't there yet
+///
+/// @param set The ID_SET* to add to
+/// @param id The ID to be added, which can't be ID_SET_EMPTY
+///
+/// @returns 1 if it was added, 0 if it was already in the set
+int id_set_add(ID_SET *set, uint32_t id)
+{
+    if (id_set_contains(set, id))
+        return 0;
+
+    // Removed positions are still in the index, so they count for its load too
+    if ((uint64_t)(set->length + 1) * 4 > (uint64_t)set->index_size * 3)
+        id_set_rebuild(set);
+
+    if (set->length == set->capacity)
+    {
+        set->capacity = set->capacity ? set->capacity * 2 : ID_SET_INITIAL_INDEX_SIZE;
+        set->ids = (uint32_t *)realloc(set->ids, set->capacity * sizeof(uint32_t));
+    }
+
+    set->ids[set->length++] = id;
+    set->count++;
+
+    *id_set_find_slot(set, id) = set->length;
+
+    return 1;
+}
+
+/// Removes an ID from the set, keeping the order of the others
+///
+/// @param set The ID_SET* to remove from
+/// @param id The ID to be removed
+///
+/// @returns 1 if it was removed, 0 if it wasn't in the set
+int id_set_remove(ID_SET *set, uint32_t id)
+{
+    uint32_t *slot = id_set_find_slot(set, id);
+    if (slot == NULL || *slot == 0)
+        return 0;
+
+    // Its slot in the index is kept, so that the IDs probed after it can still be found.
+    // Both are reclaimed when the index is rebuilt
+    set->ids[*slot - 1] = ID_SET_EMPTY;
+    set->count--;
+
+    if (set->count < set->length / 2)
+        id_set_rebuild(set);
+
+    return 1;
+}
+
+/// Replaces the contents of a set with distinct IDs, building the index only once
+///
+/// @param set The ID_SET* to be loaded
+/// @param ids IDs to be copied, in order, none of them repeated. ID_SET_EMPTY ones are skipped
+/// @param count How many IDs there are in `ids`
+void id_set_load(ID_SET *set, uint32_t *ids, uint32_t count)
+{
+    id_set_free(set);
+    if (count == 0)
+        return;
+
+    set->ids = (uint32_t *)malloc(count * sizeof(uint32_t));
+    memcpy(set->ids, ids, count * sizeof(uint32_t));
+    set->length = set->capacity = count;
+
+    id_set_rebuild(set);
+    set->count = set->length;
+}
+
+// Slot of the index with the ID, or the free slot where it would be inserted.
+// Returns NULL if there is no index yet
+uint32_t *id_set_find_slot(ID_SET *set, uint32_t id)
+{
+    if (set->index == NULL)
+        return NULL;
+
+    // Multiplicative hashing, so that sequential IDs are spread through the index
+    uint32_t mask = set->index_size - 1;
+    uint32_t slot_idx = (uint32_t)(((uint64_t)id * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+
+    while (set->index[slot_idx] != 0 && set->ids[set->index[slot_idx] - 1] != id)
+        slot_idx = (slot_idx + 1) & mask;
+
+    return &set->index[slot_idx];
+}
+
+// Drops the removed positions and builds the index again, big enough for the IDs left
+void id_set_rebuild(ID_SET *set)
+{
+    uint32_t length = 0;
+    for (uint32_t id_idx = 0; id_idx < set->length; id_idx++)
+        if (set->ids[id_idx] != ID_SET_EMPTY)
+            set->ids[length++] = set->ids[id_idx];
+    set->length = length;
+
+    uint32_t index_size = ID_SET_INITIAL_INDEX_SIZE;
+    while ((uint64_t)(length + 1) * 2 > index_size)
+        index_size *= 2;
+
+    free(set->index);
+    set->index = (uint32_t *)calloc(index_size, sizeof(uint32_t));
+    set->index_size = index_size;
+
+    for (uint32_t id_idx = 0; id_idx < length; id_idx++)
+        *id_set_find_slot(set, set->ids[id_idx]) = id_idx + 1;
+}
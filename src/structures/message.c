@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "message.h"
+
+/// Creates a MESSAGE with the contents of a NOTIFICATION, holding a single reference
+///
+/// @param notification NOTIFICATION* with the id, timestamp, type, author and message
+///
+/// @returns A new MESSAGE*, which must be released with message_release
+MESSAGE *message_create(NOTIFICATION *notification)
+{
+    MESSAGE *message = (MESSAGE *)malloc(sizeof(MESSAGE));
+
+    atomic_init(&message->references, 1);
+    atomic_init(&message->wal_epoch, 0);
+    message->id = notification->id;
+    message->timestamp = notification->timestamp;
+    message->type = notification->type;
+    strcpy(message->author, notification->author);
+    strcpy(message->body, notification->message);
+
+    return message;
+}
+
+/// Adds a reference to a MESSAGE
+///
+/// @param message MESSAGE* which will be kept by one more holder
+///
+/// @returns The same MESSAGE*, so it can be used inline
+MESSAGE *message_retain(MESSAGE *message)
+{
+    atomic_fetch_add_explicit(&message->references, 1, memory_order_relaxed);
+
+    return message;
+}
+
+/// Removes a reference to a MESSAGE, freeing it if it was the last one
+///
+/// @param message MESSAGE* which is not going to be used anymore by this holder
+void message_release(MESSAGE *message)
+{
+    if (atomic_fetch_sub_explicit(&message->references, 1, memory_order_acq_rel) == 1)
+        free(message);
+}
+
+/// Fills a NOTIFICATION to deliver a MESSAGE to one of its recipients
+///
+/// @param message MESSAGE* to be delivered
+/// @param receiver Username of the recipient
+/// @param notification NOTIFICATION* to be filled, usually on the stack
+void message_to_notification(MESSAGE *message, char *receiver, NOTIFICATION *notification)
+{
+    memset(notification, 0, sizeof(NOTIFICATION));
+
+    notification->id = message->id;
+    notification->timestamp = message->timestamp;
+    notification->type = message->type;
+    strcpy(notification->author, message->author);
+    strcpy(notification->message, message->body);
+    strcpy(notification->receiver, receiver);
+}
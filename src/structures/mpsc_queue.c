@@ -0,0 +1,189 @@
+#include "mpsc_queue.h"
+
+#include "logger.h"
+#include "exit_errors.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+/// Creates a MPSC_QUEUE which can hold at least `capacity` values
+///
+/// @param capacity Minimum number of values the queue must hold, rounded up to a power of two
+///
+/// @returns A new pointer to an empty MPSC_QUEUE
+MPSC_QUEUE *mpsc_queue_create(size_t capacity)
+{
+    size_t real_capacity = 2;
+    while (real_capacity < capacity)
+        real_capacity <<= 1;
+
+    MPSC_QUEUE *queue = (MPSC_QUEUE *)calloc(1, sizeof(MPSC_QUEUE));
+    queue->cells = (MPSC_QUEUE_CELL *)calloc(real_capacity, sizeof(MPSC_QUEUE_CELL));
+    queue->mask = real_capacity - 1;
+    queue->head = 0;
+    atomic_init(&queue->tail, 0);
+    atomic_init(&queue->sleeping, 0);
+
+    // Each cell starts free to be written by the producer which reaches its position
+    for (size_t i = 0; i < real_capacity; i++)
+        atomic_init(&queue->cells[i].sequence, i);
+
+    if ((queue->eventfd = eventfd(0, 0)) == -1)
+    {
+        logger_error("When creating the queue eventfd\n");
+        exit(ERROR_EVENT_LOOP);
+    }
+
+    return queue;
+}
+
+/// Pushes a value to the end of the queue, without ever locking.
+/// Can be called from any number of threads at the same time
+///
+/// @param queue MPSC_QUEUE* which will have the value pushed
+/// @param val void* value to be pushed
+///
+/// @returns 0 on success, or -1 if the queue is full
+int mpsc_queue_push(MPSC_QUEUE *queue, void *val)
+{
+    MPSC_QUEUE_CELL *cell;
+    size_t position = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+
+    // Reserve a position, competing only with the other producers
+    while (1)
+    {
+        cell = &queue->cells[position & queue->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+
+        if (difference == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&queue->tail, &position, position + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (difference < 0)
+            return -1; // The consumer hasn't read this cell yet, so we are full
+        else
+            position = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    }
+
+    cell->val = val;
+    atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+
+    // Only pay for the syscall if the consumer is really sleeping
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_exchange(&queue->sleeping, 0))
+    {
+        uint64_t wake = 1;
+        if (write(queue->eventfd, &wake, sizeof(wake)) < 0)
+            logger_error("When waking up the queue consumer: %d\n", errno);
+    }
+
+    return 0;
+}
+
+/// Pops a value from the start of the queue, if there is any.
+/// Must only be called from the consumer thread
+///
+/// @param queue MPSC_QUEUE* which will have the value popped
+///
+/// @returns The popped void* value, or NULL if the queue is empty
+void *mpsc_queue_try_pop(MPSC_QUEUE *queue)
+{
+    MPSC_QUEUE_CELL *cell = &queue->cells[queue->head & queue->mask];
+    size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+
+    // The producer for this position hasn't finished writing yet
+    if (sequence != queue->head + 1)
+        return NULL;
+
+    void *val = cell->val;
+
+    // Free the cell for the producer which will reach it in the next lap
+    atomic_store_explicit(&cell->sequence, queue->head + queue->mask + 1, memory_order_release);
+    queue->head++;
+
+    return val;
+}
+
+/// Pops a value from the start of the queue, blocking while it is empty.
+/// Must only be called from the consumer thread
+///
+/// @param queue MPSC_QUEUE* which will have the value popped
+///
+/// @returns The popped void* value
+void *mpsc_queue_pop(MPSC_QUEUE *queue)
+{
+    void *val;
+    uint64_t wakes;
+
+    while (1)
+    {
+        if ((val = mpsc_queue_try_pop(queue)))
+            return val;
+
+        // Tell the producers we are going to sleep, and check again because
+        // someone may have pushed before seeing it
+        atomic_store(&queue->sleeping, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        if ((val = mpsc_queue_try_pop(queue)))
+        {
+            atomic_store(&queue->sleeping, 0);
+            return val;
+        }
+
+        if (read(queue->eventfd, &wakes, sizeof(wakes)) < 0 && errno != EINTR)
+            logger_error("When waiting for the queue eventfd: %d\n", errno);
+    }
+}
+
+/// Pops a value from the start of the queue, blocking while it is empty for up to `timeout_msec`.
+/// Must only be called from the consumer thread
+///
+/// @param queue MPSC_QUEUE* which will have the value popped
+/// @param timeout_msec Milliseconds to wait for a value
+///
+/// @returns The popped void* value, or NULL if the queue is still empty (also after spurious wake ups)
+void *mpsc_queue_pop_timeout(MPSC_QUEUE *queue, int timeout_msec)
+{
+    void *val;
+    uint64_t wakes;
+
+    if ((val = mpsc_queue_try_pop(queue)))
+        return val;
+
+    // Same as blocking, but a producer may still wake us up after the timeout, which only
+    // leaves a wake up behind for the next pop
+    atomic_store(&queue->sleeping, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    if ((val = mpsc_queue_try_pop(queue)))
+    {
+        atomic_store(&queue->sleeping, 0);
+        return val;
+    }
+
+    struct pollfd pollfd = {.fd = queue->eventfd, .events = POLLIN};
+    int status = poll(&pollfd, 1, timeout_msec);
+    if (status > 0 && read(queue->eventfd, &wakes, sizeof(wakes)) < 0 && errno != EINTR)
+        logger_error("When waiting for the queue eventfd: %d\n", errno);
+    else if (status < 0 && errno != EINTR)
+        logger_error("When polling the queue eventfd: %d\n", errno);
+
+    atomic_store(&queue->sleeping, 0);
+
+    return mpsc_queue_try_pop(queue);
+}
+
+/// Frees a MPSC_QUEUE. It DOES NOT free the values inside of it
+///
+/// @param queue A MPSC_QUEUE* to be freed
+void mpsc_queue_free(MPSC_QUEUE *queue)
+{
+    close(queue->eventfd);
+    free(queue->cells);
+    free(queue);
+}
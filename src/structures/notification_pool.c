@@ -0,0 +1,193 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger.h"
+#include "notification_pool.h"
+
+// Free notifications are reused to link themselves
+typedef struct free_notification
+{
+    struct free_notification *next;       // Next one in the same list
+    struct free_notification *next_batch; // Next batch in the shared pool, only set on the first one
+    size_t batch_size;                    // Notifications in the batch, only set on the first one
+} FREE_NOTIFICATION;
+
+// Every NOTIFICATION must have space for the links
+typedef char notification_pool_fits[sizeof(NOTIFICATION) >= sizeof(FREE_NOTIFICATION) ? 1 : -1];
+
+// Cache of the calling thread, given back to the shared pool when it exits
+static _Thread_local FREE_NOTIFICATION *cache = NULL;
+static _Thread_local size_t cache_size = 0;
+static _Thread_local int cache_registered = 0;
+
+// Batches given back by the threads with too many free notifications, or exiting
+static FREE_NOTIFICATION *batches = NULL;
+static size_t batched = 0; // Notifications in every batch
+static size_t slabs = 0;
+static pthread_mutex_t MUTEX_POOL = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+#define LOCK(mutex) pthread_mutex_lock(&mutex)
+#define UNLOCK(mutex) pthread_mutex_unlock(&mutex)
+
+void notification_pool_refill(void);
+void notification_pool_give_back(FREE_NOTIFICATION *, size_t);
+void notification_pool_register(void);
+void notification_pool_create_key(void);
+void notification_pool_drain(void *);
+
+/// Allocates a zeroed NOTIFICATION
+///
+/// @returns A NOTIFICATION* which must be given back with notification_pool_free
+NOTIFICATION *notification_pool_alloc(void)
+{
+    if (!cache)
+        notification_pool_refill();
+
+    FREE_NOTIFICATION *free_notification = cache;
+    cache = free_notification->next;
+    cache_size--;
+
+    NOTIFICATION *notification = (NOTIFICATION *)free_notification;
+    memset(notification, 0, sizeof(NOTIFICATION));
+
+    return notification;
+}
+
+/// Allocates a copy of a NOTIFICATION
+///
+/// @param notification NOTIFICATION* to be copied
+///
+/// @returns A NOTIFICATION* which must be given back with notification_pool_free
+NOTIFICATION *notification_pool_duplicate(NOTIFICATION *notification)
+{
+    NOTIFICATION *copy = notification_pool_alloc();
+    memcpy(copy, notification, sizeof(NOTIFICATION));
+
+    return copy;
+}
+
+/// Gives a NOTIFICATION back to the pool. It may be freed by a thread other than the one
+/// which allocated it
+///
+/// @param notification NOTIFICATION* to be given back, or NULL
+void notification_pool_free(NOTIFICATION *notification)
+{
+    if (!notification)
+        return;
+
+    if (!cache_registered)
+        notification_pool_register();
+
+    FREE_NOTIFICATION *free_notification = (FREE_NOTIFICATION *)notification;
+    free_notification->next = cache;
+    cache = free_notification;
+    cache_size++;
+
+    if (cache_size < 2 * NOTIFICATION_POOL_BATCH_SIZE)
+        return;
+
+    // Keep one batch, and give the other to the threads which are allocating
+    FREE_NOTIFICATION *batch = cache, *last = cache;
+    for (int idx = 1; idx < NOTIFICATION_POOL_BATCH_SIZE; idx++)
+        last = last->next;
+    cache = last->next;
+    cache_size -= NOTIFICATION_POOL_BATCH_SIZE;
+    last->next = NULL;
+
+    notification_pool_give_back(batch, NOTIFICATION_POOL_BATCH_SIZE);
+}
+
+/// @returns How many slabs the pool allocated. They are never freed, so it only grows
+size_t notification_pool_slabs(void)
+{
+    LOCK(MUTEX_POOL);
+    size_t count = slabs;
+    UNLOCK(MUTEX_POOL);
+
+    return count;
+}
+
+/// @returns How many free notifications are in the shared pool, and not in the cache of a thread.
+///          Once every thread which used the pool exited, it is all of them
+size_t notification_pool_shared(void)
+{
+    LOCK(MUTEX_POOL);
+    size_t count = batched;
+    UNLOCK(MUTEX_POOL);
+
+    return count;
+}
+
+// Adds a list of `size` free notifications to the shared pool, as a batch
+void notification_pool_give_back(FREE_NOTIFICATION *batch, size_t size)
+{
+    batch->batch_size = size;
+
+    LOCK(MUTEX_POOL);
+    batch->next_batch = batches;
+    batches = batch;
+    batched += size;
+    UNLOCK(MUTEX_POOL);
+}
+
+// The first time a thread uses its cache, it asks for it to be drained when exiting. The value
+// of the key is only set so that its destructor is called
+void notification_pool_register(void)
+{
+    pthread_once(&cache_key_once, &notification_pool_create_key);
+    pthread_setspecific(cache_key, (void *)&cache_registered);
+    cache_registered = 1;
+}
+
+void notification_pool_create_key(void)
+{
+    pthread_key_create(&cache_key, &notification_pool_drain);
+}
+
+// Called when a thread which used the pool exits, so that its cache isn't lost with it
+void notification_pool_drain(void *_)
+{
+    if (cache)
+        notification_pool_give_back(cache, cache_size);
+
+    // If it is used again by another destructor, it registers again to be drained after it
+    cache = NULL;
+    cache_size = 0;
+    cache_registered = 0;
+}
+
+// Fills the empty cache with a batch from the shared pool, or with a new slab if there is none
+void notification_pool_refill(void)
+{
+    if (!cache_registered)
+        notification_pool_register();
+
+    LOCK(MUTEX_POOL);
+    if (batches)
+    {
+        cache = batches;
+        cache_size = batches->batch_size;
+        batches = batches->next_batch;
+        batched -= cache_size;
+        UNLOCK(MUTEX_POOL);
+
+        return;
+    }
+    size_t slab_idx = ++slabs;
+    UNLOCK(MUTEX_POOL);
+
+    NOTIFICATION *slab = (NOTIFICATION *)malloc(NOTIFICATION_POOL_SLAB_SIZE * sizeof(NOTIFICATION));
+    for (int idx = NOTIFICATION_POOL_SLAB_SIZE - 1; idx >= 0; idx--)
+    {
+        FREE_NOTIFICATION *free_notification = (FREE_NOTIFICATION *)&slab[idx];
+        free_notification->next = cache;
+        cache = free_notification;
+    }
+    cache_size = NOTIFICATION_POOL_SLAB_SIZE;
+
+    logger_debug("Allocated notification slab %zu, with %zu notifications in the pool\n", slab_idx, slab_idx * NOTIFICATION_POOL_SLAB_SIZE);
+}
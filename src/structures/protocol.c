@@ -0,0 +1,319 @@
+#include "protocol.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+// Signed values are zigzag encoded, so that small negative numbers are still small
+#define ZIGZAG_ENCODE(value) (((uint64_t)(value) << 1) ^ (uint64_t)((int64_t)(value) >> 63))
+#define ZIGZAG_DECODE(value) ((int64_t)((value) >> 1) ^ -(int64_t)((value)&1))
+
+/// Encodes a NOTIFICATION as a length prefixed frame
+///
+/// @param notification The NOTIFICATION to be encoded
+/// @param buffer Where the frame will be written, must hold at least PROTOCOL_MAX_FRAME_SIZE bytes
+///
+/// @returns How many bytes the frame has
+size_t protocol_encode(NOTIFICATION *notification, uint8_t *buffer)
+{
+    uint8_t fields[PROTOCOL_MAX_FRAME_SIZE];
+    uint32_t mask;
+
+    size_t fields_length = protocol_encode_fields(notification, fields, &mask);
+    size_t header_length = protocol_encode_header(notification->type, mask, notification->receiver, fields_length, buffer);
+    memcpy(buffer + header_length, fields, fields_length);
+
+    return header_length + fields_length;
+}
+
+/// Encodes every field of a NOTIFICATION but the receiver, which is part of the header.
+/// This way a notification sent to many receivers only needs to be encoded once
+///
+/// @param notification The NOTIFICATION to be encoded
+/// @param buffer Where the fields will be written, must hold at least PROTOCOL_MAX_FRAME_SIZE bytes
+/// @param mask Where the mask of the encoded fields will be written
+///
+/// @returns How many bytes the fields have
+size_t protocol_encode_fields(NOTIFICATION *notification, uint8_t *buffer, uint32_t *mask)
+{
+    *mask = 0;
+    if (notification->command)
+        *mask |= PROTOCOL_FIELD__COMMAND;
+    if (notification->id)
+        *mask |= PROTOCOL_FIELD__ID;
+    if (notification->timestamp)
+        *mask |= PROTOCOL_FIELD__TIMESTAMP;
+    if (notification->author[0])
+        *mask |= PROTOCOL_FIELD__AUTHOR;
+    if (notification->message[0])
+        *mask |= PROTOCOL_FIELD__MESSAGE;
+    if (notification->data)
+        *mask |= PROTOCOL_FIELD__DATA;
+    if (notification->target[0])
+        *mask |= PROTOCOL_FIELD__TARGET;
+    if (notification->lsn)
+        *mask |= PROTOCOL_FIELD__LSN;
+    if (notification->sequence)
+        *mask |= PROTOCOL_FIELD__SEQUENCE;
+
+    uint8_t *cursor = buffer;
+    if (*mask & PROTOCOL_FIELD__COMMAND)
+        cursor = protocol_put_varint(cursor, (uint64_t)notification->command);
+    if (*mask & PROTOCOL_FIELD__ID)
+        cursor = protocol_put_varint(cursor, (uint64_t)notification->id);
+    if (*mask & PROTOCOL_FIELD__TIMESTAMP)
+        cursor = protocol_put_varint(cursor, ZIGZAG_ENCODE(notification->timestamp));
+    if (*mask & PROTOCOL_FIELD__AUTHOR)
+        cursor = protocol_put_string(cursor, notification->author, sizeof(notification->author));
+    if (*mask & PROTOCOL_FIELD__MESSAGE)
+        cursor = protocol_put_string(cursor, notification->message, sizeof(notification->message));
+    if (*mask & PROTOCOL_FIELD__DATA)
+        cursor = protocol_put_varint(cursor, ZIGZAG_ENCODE(notification->data));
+    if (*mask & PROTOCOL_FIELD__TARGET)
+        cursor = protocol_put_string(cursor, notification->target, sizeof(notification->target));
+    if (*mask & PROTOCOL_FIELD__LSN)
+        cursor = protocol_put_varint(cursor, notification->lsn);
+    if (*mask & PROTOCOL_FIELD__SEQUENCE)
+        cursor = protocol_put_varint(cursor, notification->sequence);
+
+    return cursor - buffer;
+}
+
+/// Encodes the start of a frame, up to (and including) the receiver, for
+/// fields already encoded with `protocol_encode_fields`
+///
+/// @param type Type of the notification
+/// @param mask Mask returned when encoding the fields
+/// @param receiver Receiver of this frame, or an empty string if there is none
+/// @param fields_length How many bytes the encoded fields have
+/// @param buffer Where the header will be written, must hold at least PROTOCOL_MAX_HEADER_SIZE bytes
+///
+/// @returns How many bytes the header has
+size_t protocol_encode_header(NOTIFICATION_TYPE type, uint32_t mask, char *receiver, size_t fields_length, uint8_t *buffer)
+{
+    uint8_t body_start[4 + MAX_USERNAME_LENGTH + 4];
+    uint8_t *cursor = body_start;
+
+    if (receiver[0])
+        mask |= PROTOCOL_FIELD__RECEIVER;
+
+    *cursor++ = PROTOCOL_VERSION;
+    *cursor++ = (uint8_t)type;
+    cursor = protocol_put_varint(cursor, mask);
+    if (receiver[0])
+        cursor = protocol_put_string(cursor, receiver, MAX_USERNAME_LENGTH + 2);
+
+    size_t body_start_length = cursor - body_start;
+    cursor = protocol_put_varint(buffer, body_start_length + fields_length);
+    memcpy(cursor, body_start, body_start_length);
+
+    return (cursor - buffer) + body_start_length;
+}
+
+/// Decodes the first frame of a buffer into a NOTIFICATION
+///
+/// @param buffer Bytes received from a socket
+/// @param length How many bytes there are in `buffer`
+/// @param notification Where the decoded NOTIFICATION will be written
+///
+/// @returns How many bytes the frame used, 0 if the frame is not complete yet, or -1 if it is invalid
+int protocol_decode(uint8_t *buffer, size_t length, NOTIFICATION *notification)
+{
+    uint64_t body_length, value;
+    uint8_t *end = buffer + length;
+
+    uint8_t *cursor = protocol_get_varint(buffer, end, &body_length);
+    if (cursor == NULL)
+        return length >= 2 ? -1 : 0; // Body length always fits in two bytes
+    if (body_length > PROTOCOL_MAX_FRAME_SIZE - 2 || body_length < 3)
+        return -1;
+    if ((size_t)(end - cursor) < body_length)
+        return 0;
+
+    end = cursor + body_length;
+    if (*cursor++ != PROTOCOL_VERSION)
+        return -1;
+
+    bzero((void *)notification, sizeof(NOTIFICATION));
+    notification->type = (NOTIFICATION_TYPE)*cursor++;
+
+    uint64_t mask;
+    cursor = protocol_get_varint(cursor, end, &mask);
+
+    if (cursor && (mask & PROTOCOL_FIELD__RECEIVER))
+        cursor = protocol_get_string(cursor, end, notification->receiver, sizeof(notification->receiver));
+    if (cursor && (mask & PROTOCOL_FIELD__COMMAND))
+    {
+        cursor = protocol_get_varint(cursor, end, &value);
+        notification->command = (COMMAND)value;
+    }
+    if (cursor && (mask & PROTOCOL_FIELD__ID))
+    {
+        cursor = protocol_get_varint(cursor, end, &value);
+        notification->id = value;
+    }
+    if (cursor && (mask & PROTOCOL_FIELD__TIMESTAMP))
+    {
+        cursor = protocol_get_varint(cursor, end, &value);
+        notification->timestamp = (time_t)ZIGZAG_DECODE(value);
+    }
+    if (cursor && (mask & PROTOCOL_FIELD__AUTHOR))
+        cursor = protocol_get_string(cursor, end, notification->author, sizeof(notification->author));
+    if (cursor && (mask & PROTOCOL_FIELD__MESSAGE))
+        cursor = protocol_get_string(cursor, end, notification->message, sizeof(notification->message));
+    if (cursor && (mask & PROTOCOL_FIELD__DATA))
+    {
+        cursor = protocol_get_varint(cursor, end, &value);
+        notification->data = (int)ZIGZAG_DECODE(value);
+    }
+    if (cursor && (mask & PROTOCOL_FIELD__TARGET))
+        cursor = protocol_get_string(cursor, end, notification->target, sizeof(notification->target));
+    if (cursor && (mask & PROTOCOL_FIELD__LSN))
+        cursor = protocol_get_varint(cursor, end, &notification->lsn);
+    if (cursor && (mask & PROTOCOL_FIELD__SEQUENCE))
+        cursor = protocol_get_varint(cursor, end, &notification->sequence);
+
+    if (cursor == NULL)
+        return -1;
+
+    return end - buffer;
+}
+
+/// Encodes and writes a NOTIFICATION to a socket, blocking until the whole frame is written
+///
+/// @param sockfd Socket to write to
+/// @param notification The NOTIFICATION to be written
+///
+/// @returns How many bytes were written, or -1 on error (with errno set, EPIPE included)
+int protocol_write(int sockfd, NOTIFICATION *notification)
+{
+    uint8_t frame[PROTOCOL_MAX_FRAME_SIZE];
+    size_t length = protocol_encode(notification, frame);
+
+    return protocol_write_frames(sockfd, frame, length);
+}
+
+/// Writes frames already encoded one after the other to a socket, blocking until all of them are written
+///
+/// @param sockfd Socket to write to
+/// @param frames Buffer with the frames
+/// @param length Bytes in `frames`
+///
+/// @returns How many bytes were written, or -1 on error (with errno set, EPIPE included)
+int protocol_write_frames(int sockfd, uint8_t *frames, size_t length)
+{
+    size_t bytes_wrote = 0;
+
+    while (bytes_wrote < length)
+    {
+        int status = send(sockfd, frames + bytes_wrote, length - bytes_wrote, MSG_NOSIGNAL);
+        if (status < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        bytes_wrote += status;
+    }
+
+    return bytes_wrote;
+}
+
+/// Reads a single frame from a socket, blocking until it is complete
+///
+/// @param sockfd Socket to read from
+/// @param notification Where the decoded NOTIFICATION will be written
+///
+/// @returns How many bytes were read, 0 if the socket was closed, or -1 on error
+int protocol_read(int sockfd, NOTIFICATION *notification)
+{
+    uint8_t frame[PROTOCOL_MAX_FRAME_SIZE];
+    uint64_t body_length;
+    size_t length = 0, prefix_length;
+    int status;
+
+    // Read the length prefix byte by byte, as we can't read past this frame
+    do
+    {
+        if ((status = read(sockfd, frame + length, 1)) <= 0)
+            return status;
+        length++;
+    } while ((frame[length - 1] & 0x80) && length < 2);
+
+    if (protocol_get_varint(frame, frame + length, &body_length) == NULL || body_length > PROTOCOL_MAX_FRAME_SIZE - length)
+    {
+        errno = EPROTO;
+        return -1;
+    }
+
+    prefix_length = length;
+    while (length < prefix_length + body_length)
+    {
+        if ((status = read(sockfd, frame + length, prefix_length + body_length - length)) <= 0)
+            return status;
+        length += status;
+    }
+
+    if (protocol_decode(frame, length, notification) <= 0)
+    {
+        errno = EPROTO;
+        return -1;
+    }
+
+    return length;
+}
+
+uint8_t *protocol_put_varint(uint8_t *buffer, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        *buffer++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *buffer++ = (uint8_t)value;
+
+    return buffer;
+}
+
+uint8_t *protocol_put_string(uint8_t *buffer, char *string, size_t max_size)
+{
+    size_t length = strnlen(string, max_size - 1);
+
+    buffer = protocol_put_varint(buffer, length);
+    memcpy(buffer, string, length);
+
+    return buffer + length;
+}
+
+// Returns the position after the varint, or NULL if it doesn't fit before `end`
+uint8_t *protocol_get_varint(uint8_t *buffer, uint8_t *end, uint64_t *value)
+{
+    *value = 0;
+    for (int shift = 0; buffer < end && shift < 64; shift += 7)
+    {
+        uint8_t byte = *buffer++;
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+
+        if (!(byte & 0x80))
+            return buffer;
+    }
+
+    return NULL;
+}
+
+// Returns the position after the string, or NULL if it doesn't fit in `max_size` or before `end`
+uint8_t *protocol_get_string(uint8_t *buffer, uint8_t *end, char *string, size_t max_size)
+{
+    uint64_t length;
+
+    buffer = protocol_get_varint(buffer, end, &length);
+    if (buffer == NULL || length >= max_size || length > (uint64_t)(end - buffer))
+        return NULL;
+
+    memcpy(string, buffer, length);
+    string[length] = '\0';
+
+    return buffer + length;
+}
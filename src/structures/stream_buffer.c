@@ -0,0 +1,146 @@
+#include "stream_buffer.h"
+#include "protocol.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define min(x, y) (((x) <= (y)) ? (x) : (y))
+
+/// Creates an empty STREAM_BUFFER
+///
+/// @param capacity How many bytes it can hold, rounded up to a power of two, and never smaller than a frame
+///
+/// @returns A new pointer to a STREAM_BUFFER
+STREAM_BUFFER *stream_buffer_create(size_t capacity)
+{
+    size_t real_capacity = PROTOCOL_MAX_FRAME_SIZE;
+    while (real_capacity < capacity)
+        real_capacity <<= 1;
+
+    STREAM_BUFFER *buffer = (STREAM_BUFFER *)calloc(1, sizeof(STREAM_BUFFER));
+    buffer->data = (uint8_t *)malloc(real_capacity);
+    buffer->capacity = real_capacity;
+
+    return buffer;
+}
+
+/// Receives as many bytes as there is free space in the buffer, with a single syscall.
+/// The free space might wrap around the end of the buffer, so we read it in (at most) two pieces
+///
+/// @param buffer STREAM_BUFFER* which will receive the bytes
+/// @param sockfd Socket to read from
+/// @param flags Flags passed to recvmsg, as MSG_DONTWAIT
+///
+/// @returns How many bytes were read, 0 if the socket was closed, or -1 on error (with errno set)
+int stream_buffer_fill(STREAM_BUFFER *buffer, int sockfd, int flags)
+{
+    size_t free_space = buffer->capacity - buffer->length;
+    if (free_space == 0)
+    {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    size_t end = (buffer->start + buffer->length) & (buffer->capacity - 1);
+    size_t first_piece = min(free_space, buffer->capacity - end);
+
+    struct iovec pieces[2] = {
+        {.iov_base = buffer->data + end, .iov_len = first_piece},
+        {.iov_base = buffer->data, .iov_len = free_space - first_piece}};
+    struct msghdr message = {.msg_iov = pieces, .msg_iovlen = free_space > first_piece ? 2 : 1};
+
+    int bytes_read = recvmsg(sockfd, &message, flags);
+    if (bytes_read > 0)
+        buffer->length += bytes_read;
+
+    return bytes_read;
+}
+
+/// Decodes the next complete frame in the buffer
+///
+/// @param buffer STREAM_BUFFER* to decode from
+/// @param notification Where the decoded NOTIFICATION will be written
+///
+/// @returns How many bytes the frame had, 0 if there is no complete frame yet, or -1 if it is invalid
+int stream_buffer_next(STREAM_BUFFER *buffer, NOTIFICATION *notification)
+{
+    int frame_length;
+
+    if (buffer->length == 0)
+        return 0;
+
+    size_t contiguous = buffer->capacity - buffer->start;
+    if (contiguous >= buffer->length)
+    {
+        frame_length = protocol_decode(buffer->data + buffer->start, buffer->length, notification);
+    }
+    else
+    {
+        // The frame wraps around the end, so we join both pieces before decoding
+        uint8_t frame[PROTOCOL_MAX_FRAME_SIZE];
+        size_t frame_bytes = min(buffer->length, PROTOCOL_MAX_FRAME_SIZE);
+        size_t first_piece = min(frame_bytes, contiguous);
+
+        memcpy(frame, buffer->data + buffer->start, first_piece);
+        memcpy(frame + first_piece, buffer->data, frame_bytes - first_piece);
+
+        frame_length = protocol_decode(frame, frame_bytes, notification);
+    }
+
+    if (frame_length > 0)
+    {
+        buffer->start = (buffer->start + frame_length) & (buffer->capacity - 1);
+        buffer->length -= frame_length;
+    }
+
+    return frame_length;
+}
+
+/// Returns the next frame from a blocking socket, only reading from it
+/// when there isn't a complete frame already buffered
+///
+/// @param buffer STREAM_BUFFER* used for this socket
+/// @param sockfd Socket to read from
+/// @param notification Where the decoded NOTIFICATION will be written
+///
+/// @returns How many bytes the frame had, 0 if the socket was closed, or -1 on error
+int stream_buffer_read(STREAM_BUFFER *buffer, int sockfd, NOTIFICATION *notification)
+{
+    int status;
+
+    while ((status = stream_buffer_next(buffer, notification)) == 0)
+    {
+        int bytes_read = stream_buffer_fill(buffer, sockfd, 0);
+        if (bytes_read <= 0)
+            return bytes_read;
+    }
+
+    if (status < 0)
+    {
+        errno = EPROTO;
+        return -1;
+    }
+
+    return status;
+}
+
+/// Discards everything in the buffer, as when its socket is replaced
+///
+/// @param buffer STREAM_BUFFER* to be cleared
+void stream_buffer_clear(STREAM_BUFFER *buffer)
+{
+    buffer->start = 0;
+    buffer->length = 0;
+}
+
+/// Frees a STREAM_BUFFER
+///
+/// @param buffer STREAM_BUFFER* to be freed
+void stream_buffer_free(STREAM_BUFFER *buffer)
+{
+    free(buffer->data);
+    free(buffer);
+}
@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "timeline_index.h"
+
+#define TIMELINE_INDEX_INITIAL_CAPACITY 8
+
+void timeline_index_grow(TIMELINE_INDEX *index);
+
+/// Initializes an empty TIMELINE_INDEX, which doesn't allocate anything until the first insertion
+///
+/// @param index The TIMELINE_INDEX* to be initialized
+void timeline_index_init(TIMELINE_INDEX *index)
+{
+    memset(index, 0, sizeof(TIMELINE_INDEX));
+}
+
+/// Frees what was allocated by a TIMELINE_INDEX, leaving it empty
+///
+/// @param index The TIMELINE_INDEX* to be freed
+void timeline_index_free(TIMELINE_INDEX *index)
+{
+    free(index->entries);
+    timeline_index_init(index);
+}
+
+/// Gets an entry by its position, from the oldest one
+///
+/// @param index The TIMELINE_INDEX* to look in
+/// @param position Position of the entry, smaller than the length of the index
+///
+/// @returns The TIMELINE_ENTRY*, valid until the index is changed
+TIMELINE_ENTRY *timeline_index_get(TIMELINE_INDEX *index, uint32_t position)
+{
+    return &index->entries[(index->start + position) & (index->capacity - 1)];
+}
+
+/// Binary search for the first entry whose ID isn't smaller than `id`
+///
+/// @param index The TIMELINE_INDEX* to look in
+/// @param id The ID to look for
+///
+/// @returns Its position, or the length of the index if every ID is smaller
+uint32_t timeline_index_lower_bound(TIMELINE_INDEX *index, uint64_t id)
+{
+    uint32_t low = 0, high = index->length;
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        if (timeline_index_get(index, middle)->id < id)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    return low;
+}
+
+/// Finds the entry of a post
+///
+/// @param index The TIMELINE_INDEX* to look in
+/// @param id The ID of the post
+///
+/// @returns The TIMELINE_ENTRY*, or NULL if it isn't in the index
+TIMELINE_ENTRY *timeline_index_find(TIMELINE_INDEX *index, uint64_t id)
+{
+    uint32_t position = timeline_index_lower_bound(index, id);
+    if (position == index->length)
+        return NULL;
+
+    TIMELINE_ENTRY *entry = timeline_index_get(index, position);
+    return entry->id == id ? entry : NULL;
+}
+
+/// Inserts an entry in the position of its ID, which must not be in the index yet
+///
+/// @param index The TIMELINE_INDEX* to insert in
+/// @param entry The TIMELINE_ENTRY* to be copied
+///
+/// @returns The TIMELINE_ENTRY* in the index, valid until it is changed
+TIMELINE_ENTRY *timeline_index_insert(TIMELINE_INDEX *index, TIMELINE_ENTRY *entry)
+{
+    if (index->length == index->capacity)
+        timeline_index_grow(index);
+
+    // Newer entries are moved one position forward, which usually are none
+    uint32_t position = index->length;
+    while (position > 0 && timeline_index_get(index, position - 1)->id > entry->id)
+    {
+        *timeline_index_get(index, position) = *timeline_index_get(index, position - 1);
+        position--;
+    }
+    index->length++;
+
+    TIMELINE_ENTRY *inserted = timeline_index_get(index, position);
+    *inserted = *entry;
+
+    return inserted;
+}
+
+/// Removes the oldest entry
+///
+/// @param index The TIMELINE_INDEX* to remove from
+/// @param entry Where the removed entry will be copied to
+///
+/// @returns 1 if an entry was removed, 0 if the index was empty
+int timeline_index_pop_front(TIMELINE_INDEX *index, TIMELINE_ENTRY *entry)
+{
+    if (index->length == 0)
+        return 0;
+
+    *entry = *timeline_index_get(index, 0);
+    index->start = (index->start + 1) & (index->capacity - 1);
+    index->length--;
+
+    return 1;
+}
+
+/// Removes every entry for which `keep` returns 0, keeping the order of the others
+///
+/// @param index The TIMELINE_INDEX* to remove from
+/// @param keep Called with every entry and `arg`
+/// @param arg Passed along to [keep]
+///
+/// @returns How many entries were removed
+uint32_t timeline_index_filter(TIMELINE_INDEX *index, int (*keep)(TIMELINE_ENTRY *, void *), void *arg)
+{
+    uint32_t length = 0;
+    for (uint32_t position = 0; position < index->length; position++)
+    {
+        TIMELINE_ENTRY *entry = timeline_index_get(index, position);
+        if (keep(entry, arg))
+            *timeline_index_get(index, length++) = *entry;
+    }
+
+    uint32_t removed = index->length - length;
+    index->length = length;
+
+    return removed;
+}
+
+// Doubles the capacity, moving the entries to the start of the new array
+void timeline_index_grow(TIMELINE_INDEX *index)
+{
+    uint32_t capacity = index->capacity ? index->capacity * 2 : TIMELINE_INDEX_INITIAL_CAPACITY;
+    TIMELINE_ENTRY *entries = (TIMELINE_ENTRY *)malloc(capacity * sizeof(TIMELINE_ENTRY));
+
+    for (uint32_t position = 0; position < index->length; position++)
+        entries[position] = *timeline_index_get(index, position);
+
+    free(index->entries);
+    index->entries = entries;
+    index->capacity = capacity;
+    index->start = 0;
+}
@@ -8,9 +8,16 @@ USER *init_user(void)
     USER *user = (USER *)calloc(1, sizeof(USER));
 
     pthread_mutex_init(&user->mutex, NULL);
-    user->followers = NULL;
-    user->notifications = NULL;
-    user->pending_notifications = NULL;
+    pthread_mutex_init(&user->followers_mutex, NULL);
+    pthread_mutex_init(&user->fan_out_mutex, NULL);
+    pthread_mutex_init(&user->spill_mutex, NULL);
+    id_set_init(&user->followers);
+    id_set_init(&user->following);
+    deque_init(&user->messages);
+    timeline_index_init(&user->timeline);
+    deque_init(&user->pending_messages);
+    user->spilled_messages = 0;
+    user->inbox_generation = 0;
     user->sessions_number = 0;
 
     for (int i = 0; i < MAX_SESSIONS; i++)
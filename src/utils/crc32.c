@@ -0,0 +1,29 @@
+#include <pthread.h>
+
+#include "crc32.h"
+
+// Standard CRC-32 (the one used by zlib and ethernet), with a table built on the first use
+uint32_t crc32_table[256];
+pthread_once_t crc32_table_once = PTHREAD_ONCE_INIT;
+
+void crc32_build_table(void)
+{
+    for (uint32_t byte = 0; byte < 256; byte++)
+    {
+        uint32_t crc = byte;
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+        crc32_table[byte] = crc;
+    }
+}
+
+uint32_t crc32_compute(uint8_t *buffer, size_t length)
+{
+    pthread_once(&crc32_table_once, &crc32_build_table);
+
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t idx = 0; idx < length; idx++)
+        crc = crc32_table[(crc ^ buffer[idx]) & 0xFF] ^ (crc >> 8);
+
+    return crc ^ 0xFFFFFFFF;
+}